@@ -175,6 +175,43 @@ int compat_closedir( compat_dir directory );
 double compat_timer_get_time( void );
 void compat_timer_sleep( int ms );
 
+/* Threading. Only available when built with HAVE_FUSE_THREADS; otherwise
+   compat_thread_create() always fails and callers must do the work on the
+   calling thread instead */
+
+typedef struct compat_thread_t *compat_thread;
+typedef struct compat_mutex_t *compat_mutex;
+typedef struct compat_cond_t *compat_cond;
+
+compat_thread compat_thread_create( void (*function)( void *data ),
+                                    void *data );
+void compat_thread_join( compat_thread thread );
+
+compat_mutex compat_mutex_create( void );
+void compat_mutex_lock( compat_mutex mutex );
+void compat_mutex_unlock( compat_mutex mutex );
+void compat_mutex_destroy( compat_mutex mutex );
+
+compat_cond compat_cond_create( void );
+void compat_cond_wait( compat_cond cond, compat_mutex mutex );
+void compat_cond_signal( compat_cond cond );
+void compat_cond_destroy( compat_cond cond );
+
+/* Ordered access to a counter shared between exactly one producer and one
+   consumer thread, for lock-free single producer/single consumer queues.
+   Without COMPAT_HAVE_ATOMICS these are plain accesses, which are only
+   safe single threaded: Fuse's own threads are only enabled with gcc
+   compatible compilers, and anything called on a thread it doesn't
+   control must check COMPAT_HAVE_ATOMICS itself */
+#ifdef __GNUC__
+#define COMPAT_HAVE_ATOMICS 1
+#define compat_atomic_load( p ) __atomic_load_n( p, __ATOMIC_ACQUIRE )
+#define compat_atomic_store( p, v ) __atomic_store_n( p, v, __ATOMIC_RELEASE )
+#else				/* #ifdef __GNUC__ */
+#define compat_atomic_load( p ) ( *(p) )
+#define compat_atomic_store( p, v ) ( *(p) = (v) )
+#endif				/* #ifdef __GNUC__ */
+
 /* TUN/TAP handling */
 
 int compat_get_tap( const char *interface_name );
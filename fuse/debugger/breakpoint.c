@@ -44,6 +44,25 @@ GSList *debugger_breakpoints;
 /* The next breakpoint ID to use */
 static size_t next_breakpoint_id;
 
+/* The breakpoints indexed by type, so debugger_check() only looks at
+   those which could match. The memory breakpoint types are also indexed
+   by address: debugger_breakpoint_map has a bit set for each address
+   with any breakpoints, and a hash maps the address to the list of those
+   breakpoints. Rebuilt from debugger_breakpoints whenever it changes */
+
+#define BREAKPOINT_TYPE_COUNT ( DEBUGGER_BREAKPOINT_TYPE_EVENT + 1 )
+
+libspectrum_byte
+  debugger_breakpoint_map[ DEBUGGER_BREAKPOINT_ADDRESS_TYPES ][ 0x10000 / 8 ];
+
+static GSList *breakpoints_by_type[ BREAKPOINT_TYPE_COUNT ];
+static GHashTable *breakpoints_by_address[ DEBUGGER_BREAKPOINT_ADDRESS_TYPES ];
+
+/* Non-zero while debugger_check() is walking one of the index lists, in
+   which case any rebuild is left until it has finished */
+static int breakpoint_index_busy = 0;
+static int breakpoint_index_dirty = 0;
+
 /* Textual representations of the breakpoint types and lifetimes */
 const char *debugger_breakpoint_type_text[] = {
   "Execute", "Read", "Write", "Port Read", "Port Write", "Time", "Event",
@@ -78,6 +97,8 @@ static gint find_breakpoint_by_address( gconstpointer data,
 					gconstpointer user_data );
 static void free_breakpoint( gpointer data, gpointer user_data );
 static void add_time_event( gpointer data, gpointer user_data );
+static void breakpoint_index_changed( void );
+static void breakpoint_index_rebuild( void );
 
 /* Add a breakpoint */
 int
@@ -199,12 +220,14 @@ breakpoint_add( debugger_breakpoint_type type, debugger_breakpoint_value value,
   bp->id = next_breakpoint_id++; bp->type = type;
   bp->value = value;
   bp->ignore = ignore; bp->life = life;
+  bp->program = NULL;
   if( condition ) {
     bp->condition = debugger_expression_copy( condition );
     if( !bp->condition ) {
       libspectrum_free( bp );
       return 1;
     }
+    bp->program = debugger_expression_compile( bp->condition );
   } else {
     bp->condition = NULL;
   }
@@ -212,6 +235,7 @@ breakpoint_add( debugger_breakpoint_type type, debugger_breakpoint_value value,
   bp->commands = NULL;
 
   debugger_breakpoints = g_slist_append( debugger_breakpoints, bp );
+  breakpoint_index_changed();
 
   if( debugger_mode == DEBUGGER_MODE_INACTIVE )
     debugger_mode = DEBUGGER_MODE_ACTIVE;
@@ -240,7 +264,20 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
   case DEBUGGER_MODE_INACTIVE: return 0;
 
   case DEBUGGER_MODE_ACTIVE:
-    for( ptr = debugger_breakpoints; ptr; ptr = ptr_next ) {
+    if( type < DEBUGGER_BREAKPOINT_ADDRESS_TYPES ) {
+      libspectrum_word address = value;
+
+      if( !debugger_breakpoint_at( type, address ) ) return 0;
+
+      ptr = g_hash_table_lookup( breakpoints_by_address[ type ],
+                                 GINT_TO_POINTER( address ) );
+    } else {
+      ptr = breakpoints_by_type[ type ];
+    }
+
+    breakpoint_index_busy++;
+
+    for( ; ptr; ptr = ptr_next ) {
 
       bp = ptr->data;
       ptr_next = ptr->next;
@@ -250,13 +287,15 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
         debugger_command_evaluate( bp->commands );
 
         if( bp->life == DEBUGGER_BREAKPOINT_LIFE_ONESHOT ) {
-          debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
-          libspectrum_free( bp );
+          debugger_breakpoint_delete( bp );
           signal_breakpoints_updated = 1;
         }
       }
 
     }
+
+    if( !--breakpoint_index_busy && breakpoint_index_dirty )
+      breakpoint_index_rebuild();
     break;
 
   case DEBUGGER_MODE_HALTED: return 1;
@@ -270,6 +309,94 @@ debugger_check( debugger_breakpoint_type type, libspectrum_dword value )
   return ( debugger_mode == DEBUGGER_MODE_HALTED );
 }
 
+static void
+free_index_list( gpointer key GCC_UNUSED, gpointer value,
+                 gpointer user_data GCC_UNUSED )
+{
+  g_slist_free( value );
+}
+
+static void
+index_address( debugger_breakpoint_type type, libspectrum_word address,
+               debugger_breakpoint *bp )
+{
+  GSList *list;
+
+  list = g_hash_table_lookup( breakpoints_by_address[ type ],
+                              GINT_TO_POINTER( address ) );
+  list = g_slist_append( list, bp );
+  g_hash_table_insert( breakpoints_by_address[ type ],
+                       GINT_TO_POINTER( address ), list );
+
+  bitmap_set( debugger_breakpoint_map[ type ], address );
+}
+
+static void
+breakpoint_index_changed( void )
+{
+  if( breakpoint_index_busy ) {
+    breakpoint_index_dirty = 1;
+  } else {
+    breakpoint_index_rebuild();
+  }
+}
+
+static void
+breakpoint_index_rebuild( void )
+{
+  debugger_breakpoint *bp;
+  GSList *ptr;
+  size_t i;
+
+  for( i = 0; i < BREAKPOINT_TYPE_COUNT; i++ ) {
+    g_slist_free( breakpoints_by_type[i] );
+    breakpoints_by_type[i] = NULL;
+  }
+
+  for( i = 0; i < DEBUGGER_BREAKPOINT_ADDRESS_TYPES; i++ ) {
+    if( breakpoints_by_address[i] ) {
+      g_hash_table_foreach( breakpoints_by_address[i], free_index_list, NULL );
+      g_hash_table_destroy( breakpoints_by_address[i] );
+    }
+    breakpoints_by_address[i] = g_hash_table_new( NULL, NULL );
+  }
+  memset( debugger_breakpoint_map, 0, sizeof( debugger_breakpoint_map ) );
+
+  for( ptr = debugger_breakpoints; ptr; ptr = ptr->next ) {
+    bp = ptr->data;
+
+    breakpoints_by_type[ bp->type ] =
+      g_slist_prepend( breakpoints_by_type[ bp->type ], bp );
+
+    if( bp->type >= DEBUGGER_BREAKPOINT_ADDRESS_TYPES ) continue;
+
+    /* Page-specific breakpoints can match at any address with the right
+       offset within a 16K page; breakpoint_check() sorts out which */
+    if( bp->value.address.source == memory_source_any ) {
+      index_address( bp->type, bp->value.address.offset, bp );
+    } else {
+      for( i = 0; i < 0x10000; i += 0x4000 )
+        index_address( bp->type, i | ( bp->value.address.offset & 0x3fff ),
+                       bp );
+    }
+  }
+
+  for( i = 0; i < BREAKPOINT_TYPE_COUNT; i++ )
+    breakpoints_by_type[i] = g_slist_reverse( breakpoints_by_type[i] );
+
+  breakpoint_index_dirty = 0;
+}
+
+/* Remove a breakpoint from the list and free it */
+void
+debugger_breakpoint_delete( debugger_breakpoint *bp )
+{
+  debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
+  breakpoint_index_changed();
+
+  free_breakpoint( bp, NULL );
+}
+
 void
 debugger_breakpoint_reduce_tstates( libspectrum_dword tstates )
 {
@@ -318,7 +445,9 @@ debugger_breakpoint_trigger( debugger_breakpoint *bp )
   if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME )
     bp->value.time.triggered = 1;
 
-  if( bp->condition && !debugger_expression_evaluate( bp->condition ) )
+  if( bp->condition &&
+      !( bp->program ? debugger_bytecode_evaluate( bp->program ) :
+                       debugger_expression_evaluate( bp->condition ) ) )
     return 0;
 
   return 1;
@@ -385,10 +514,6 @@ debugger_breakpoint_remove( size_t id )
 
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
-  debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
-  if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
-    debugger_mode = DEBUGGER_MODE_INACTIVE;
-
   /* If this was a timed breakpoint, remove the event as well */
   if( bp->type == DEBUGGER_BREAKPOINT_TYPE_TIME ) {
 
@@ -400,7 +525,9 @@ debugger_breakpoint_remove( size_t id )
     event_foreach( remove_time, &remove );
   }
 
-  libspectrum_free( bp );
+  debugger_breakpoint_delete( bp );
+  if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
+    debugger_mode = DEBUGGER_MODE_INACTIVE;
 
   ui_breakpoints_updated();
 
@@ -467,11 +594,9 @@ debugger_breakpoint_clear( libspectrum_word address )
     found++;
 
     ptr_data = ptr->data;
-    debugger_breakpoints = g_slist_remove( debugger_breakpoints, ptr_data );
+    debugger_breakpoint_delete( ptr_data );
     if( debugger_mode == DEBUGGER_MODE_ACTIVE && !debugger_breakpoints )
       debugger_mode = DEBUGGER_MODE_INACTIVE;
-
-    free_breakpoint( ptr_data, NULL );
   }
 
   if( !found ) {
@@ -510,6 +635,7 @@ debugger_breakpoint_remove_all( void )
 {
   g_slist_foreach( debugger_breakpoints, free_breakpoint, NULL );
   g_slist_free( debugger_breakpoints ); debugger_breakpoints = NULL;
+  breakpoint_index_changed();
 
   if( debugger_mode == DEBUGGER_MODE_ACTIVE )
     debugger_mode = DEBUGGER_MODE_INACTIVE;
@@ -544,6 +670,7 @@ free_breakpoint( gpointer data, gpointer user_data GCC_UNUSED )
   }
 
   if( bp->condition ) debugger_expression_delete( bp->condition );
+  if( bp->program ) debugger_bytecode_delete( bp->program );
   if( bp->commands ) libspectrum_free( bp->commands );
 
   libspectrum_free( bp );
@@ -571,10 +698,13 @@ debugger_breakpoint_set_condition( size_t id, debugger_expression *condition )
   bp = get_breakpoint_by_id( id ); if( !bp ) return 1;
 
   if( bp->condition ) debugger_expression_delete( bp->condition );
+  if( bp->program ) debugger_bytecode_delete( bp->program );
+  bp->program = NULL;
 
   if( condition ) {
     bp->condition = debugger_expression_copy( condition );
     if( !bp->condition ) return 1;
+    bp->program = debugger_expression_compile( bp->condition );
   } else {
     bp->condition = NULL;
   }
@@ -26,6 +26,7 @@
 #define FUSE_DEBUGGER_BREAKPOINT_H
 
 #include "memory_pages.h"
+#include "bitmap.h"
 
 /* Types of breakpoint */
 typedef enum debugger_breakpoint_type {
@@ -94,6 +95,7 @@ typedef union debugger_breakpoint_value {
 } debugger_breakpoint_value;
 
 typedef struct debugger_expression debugger_expression;
+typedef struct debugger_bytecode debugger_bytecode;
 
 /* The breakpoint structure */
 typedef struct debugger_breakpoint {
@@ -106,6 +108,8 @@ typedef struct debugger_breakpoint {
   debugger_breakpoint_life life;
   debugger_expression *condition; /* Conditional expression to activate this
 				     breakpoint */
+  debugger_bytecode *program;	/* `condition' compiled to bytecode, or NULL
+				   if it couldn't be */
 
   char *commands;
 
@@ -116,6 +120,18 @@ extern GSList *debugger_breakpoints;
 
 int debugger_check( debugger_breakpoint_type type, libspectrum_dword value );
 
+/* The execute, read and write breakpoint types are also indexed by
+   address. debugger_breakpoint_at() is a quick test which callers can use
+   to skip debugger_check() while the debugger is active, as it can only
+   trigger if this is non-zero */
+#define DEBUGGER_BREAKPOINT_ADDRESS_TYPES ( DEBUGGER_BREAKPOINT_TYPE_WRITE + 1 )
+
+extern libspectrum_byte
+  debugger_breakpoint_map[ DEBUGGER_BREAKPOINT_ADDRESS_TYPES ][ 0x10000 / 8 ];
+
+#define debugger_breakpoint_at( type, address ) \
+  bitmap_test( debugger_breakpoint_map[ (type) ], (libspectrum_word)(address) )
+
 void
 debugger_breakpoint_reduce_tstates( libspectrum_dword tstates );
 
@@ -43,6 +43,7 @@ int debugger_breakpoint_set_condition( size_t id,
 				       debugger_expression *condition );
 int debugger_breakpoint_set_commands( size_t id, const char *commands );
 int debugger_breakpoint_trigger( debugger_breakpoint *bp );
+void debugger_breakpoint_delete( debugger_breakpoint *bp );
 
 int debugger_poke( libspectrum_word address, libspectrum_byte value );
 int debugger_port_write( libspectrum_word address, libspectrum_byte value );
@@ -93,6 +94,12 @@ void debugger_expression_delete( debugger_expression* expression );
 libspectrum_dword
 debugger_expression_evaluate( debugger_expression* expression );
 
+debugger_bytecode*
+debugger_expression_compile( const debugger_expression *expression );
+void debugger_bytecode_delete( debugger_bytecode *program );
+libspectrum_dword
+debugger_bytecode_evaluate( const debugger_bytecode *program );
+
 /* Event handling */
 
 void debugger_event_init( void );
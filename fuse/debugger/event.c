@@ -115,8 +115,7 @@ debugger_event( int event_code )
       debugger_command_evaluate( bp->commands );
 
       if( bp->life == DEBUGGER_BREAKPOINT_LIFE_ONESHOT ) {
-        debugger_breakpoints = g_slist_remove( debugger_breakpoints, bp );
-        libspectrum_free( bp );
+        debugger_breakpoint_delete( bp );
         signal_breakpoints_updated = 1;
       }
     }
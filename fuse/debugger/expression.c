@@ -92,9 +92,78 @@ struct debugger_expression {
 
 };
 
+/* Breakpoint conditions are compiled to a simple stack machine program,
+   so checking them doesn't need to recurse through the expression tree */
+
+/* Maximum stack depth a compiled expression can use; deeper expressions
+   are left to be evaluated from the tree */
+#define BYTECODE_STACK_SIZE 32
+
+typedef enum bytecode_opcode {
+
+  BYTECODE_INTEGER,
+  BYTECODE_SYSVAR,
+  BYTECODE_VARIABLE,
+
+  BYTECODE_LOGICAL_NOT,
+  BYTECODE_COMPLEMENT,
+  BYTECODE_NEGATE,
+  BYTECODE_DEREFERENCE,
+
+  BYTECODE_ADD,
+  BYTECODE_SUBTRACT,
+  BYTECODE_MULTIPLY,
+  BYTECODE_DIVIDE,
+  BYTECODE_EQUAL_TO,
+  BYTECODE_NOT_EQUAL_TO,
+  BYTECODE_LESS_THAN,
+  BYTECODE_GREATER_THAN,
+  BYTECODE_LESS_THAN_OR_EQUAL_TO,
+  BYTECODE_GREATER_THAN_OR_EQUAL_TO,
+  BYTECODE_BITWISE_AND,
+  BYTECODE_BITWISE_XOR,
+  BYTECODE_BITWISE_OR,
+
+  /* Short-circuiting for && and ||: if the top of the stack decides the
+     result, replace it with that result and jump to `target'; otherwise
+     pop it and carry on */
+  BYTECODE_JUMP_IF_FALSE,
+  BYTECODE_JUMP_IF_TRUE,
+
+  /* Replace the top of the stack with 0 or 1 */
+  BYTECODE_TRUTH,
+
+} bytecode_opcode;
+
+typedef struct bytecode_instruction {
+
+  bytecode_opcode opcode;
+
+  union {
+    libspectrum_dword integer;
+    int system_variable;
+    char *variable;
+    size_t target;
+  } data;
+
+} bytecode_instruction;
+
+struct debugger_bytecode {
+
+  bytecode_instruction *code;
+  size_t length, allocated;
+
+  /* Used only while compiling */
+  size_t depth, max_depth;
+
+};
+
 static libspectrum_dword evaluate_unaryop( struct unaryop_type *unaryop );
 static libspectrum_dword evaluate_binaryop( struct binaryop_type *binary );
 
+static int compile( debugger_bytecode *program,
+                    const debugger_expression *exp );
+
 static int deparse_unaryop( char *buffer, size_t length,
 			    const struct unaryop_type *unaryop );
 static int deparse_binaryop( char *buffer, size_t length,
@@ -426,6 +495,238 @@ evaluate_binaryop( struct binaryop_type *binary )
   fuse_abort();
 }
 
+static bytecode_instruction*
+compile_emit( debugger_bytecode *program, bytecode_opcode opcode, int push )
+{
+  bytecode_instruction *instruction;
+
+  if( program->length == program->allocated ) {
+    program->allocated = program->allocated ? 2 * program->allocated : 16;
+    program->code = libspectrum_renew( bytecode_instruction, program->code,
+                                       program->allocated );
+  }
+
+  instruction = &program->code[ program->length++ ];
+  instruction->opcode = opcode;
+
+  /* `push' is the net effect on the stack depth: +1 for operands, 0 for
+     unary operators and -1 for binary operators */
+  program->depth += push;
+  if( program->depth > program->max_depth )
+    program->max_depth = program->depth;
+
+  return instruction;
+}
+
+static int
+compile_unaryop( debugger_bytecode *program,
+                 const struct unaryop_type *unaryop )
+{
+  bytecode_opcode opcode;
+
+  switch( unaryop->operation ) {
+  case '!': opcode = BYTECODE_LOGICAL_NOT; break;
+  case '~': opcode = BYTECODE_COMPLEMENT; break;
+  case '-': opcode = BYTECODE_NEGATE; break;
+  case DEBUGGER_TOKEN_DEREFERENCE: opcode = BYTECODE_DEREFERENCE; break;
+  default: return 1;
+  }
+
+  if( compile( program, unaryop->op ) ) return 1;
+  compile_emit( program, opcode, 0 );
+
+  return 0;
+}
+
+static int
+compile_binaryop( debugger_bytecode *program,
+                  const struct binaryop_type *binaryop )
+{
+  bytecode_opcode opcode;
+  size_t jump;
+
+  switch( binaryop->operation ) {
+
+  case DEBUGGER_TOKEN_LOGICAL_AND:
+  case DEBUGGER_TOKEN_LOGICAL_OR:
+    if( compile( program, binaryop->op1 ) ) return 1;
+    jump = program->length;
+    compile_emit( program,
+                  binaryop->operation == DEBUGGER_TOKEN_LOGICAL_AND ?
+                  BYTECODE_JUMP_IF_FALSE : BYTECODE_JUMP_IF_TRUE, -1 );
+    if( compile( program, binaryop->op2 ) ) return 1;
+    compile_emit( program, BYTECODE_TRUTH, 0 );
+    program->code[ jump ].data.target = program->length;
+    return 0;
+
+  case '+': opcode = BYTECODE_ADD; break;
+  case '-': opcode = BYTECODE_SUBTRACT; break;
+  case '*': opcode = BYTECODE_MULTIPLY; break;
+  case '/': opcode = BYTECODE_DIVIDE; break;
+  case DEBUGGER_TOKEN_EQUAL_TO: opcode = BYTECODE_EQUAL_TO; break;
+  case DEBUGGER_TOKEN_NOT_EQUAL_TO: opcode = BYTECODE_NOT_EQUAL_TO; break;
+  case '<': opcode = BYTECODE_LESS_THAN; break;
+  case '>': opcode = BYTECODE_GREATER_THAN; break;
+  case DEBUGGER_TOKEN_LESS_THAN_OR_EQUAL_TO:
+    opcode = BYTECODE_LESS_THAN_OR_EQUAL_TO; break;
+  case DEBUGGER_TOKEN_GREATER_THAN_OR_EQUAL_TO:
+    opcode = BYTECODE_GREATER_THAN_OR_EQUAL_TO; break;
+  case '&': opcode = BYTECODE_BITWISE_AND; break;
+  case '^': opcode = BYTECODE_BITWISE_XOR; break;
+  case '|': opcode = BYTECODE_BITWISE_OR; break;
+
+  default: return 1;
+  }
+
+  if( compile( program, binaryop->op1 ) ) return 1;
+  if( compile( program, binaryop->op2 ) ) return 1;
+  compile_emit( program, opcode, -1 );
+
+  return 0;
+}
+
+static int
+compile( debugger_bytecode *program, const debugger_expression *exp )
+{
+  bytecode_instruction *instruction;
+
+  switch( exp->type ) {
+
+  case DEBUGGER_EXPRESSION_TYPE_INTEGER:
+    instruction = compile_emit( program, BYTECODE_INTEGER, 1 );
+    instruction->data.integer = exp->types.integer;
+    break;
+
+  case DEBUGGER_EXPRESSION_TYPE_UNARYOP:
+    if( compile_unaryop( program, &( exp->types.unaryop ) ) ) return 1;
+    break;
+
+  case DEBUGGER_EXPRESSION_TYPE_BINARYOP:
+    if( compile_binaryop( program, &( exp->types.binaryop ) ) ) return 1;
+    break;
+
+  case DEBUGGER_EXPRESSION_TYPE_SYSVAR:
+    instruction = compile_emit( program, BYTECODE_SYSVAR, 1 );
+    instruction->data.system_variable = exp->types.system_variable;
+    break;
+
+  case DEBUGGER_EXPRESSION_TYPE_VARIABLE:
+    instruction = compile_emit( program, BYTECODE_VARIABLE, 1 );
+    instruction->data.variable = utils_safe_strdup( exp->types.variable );
+    break;
+
+  default:
+    return 1;
+
+  }
+
+  return program->max_depth > BYTECODE_STACK_SIZE;
+}
+
+/* Compile `exp' to bytecode. Returns NULL if it can't be compiled, in
+   which case it should be evaluated with debugger_expression_evaluate() */
+debugger_bytecode*
+debugger_expression_compile( const debugger_expression *exp )
+{
+  debugger_bytecode *program;
+
+  program = libspectrum_new( debugger_bytecode, 1 );
+  program->code = NULL;
+  program->length = program->allocated = 0;
+  program->depth = program->max_depth = 0;
+
+  if( compile( program, exp ) ) {
+    debugger_bytecode_delete( program );
+    return NULL;
+  }
+
+  return program;
+}
+
+void
+debugger_bytecode_delete( debugger_bytecode *program )
+{
+  size_t i;
+
+  for( i = 0; i < program->length; i++ )
+    if( program->code[i].opcode == BYTECODE_VARIABLE )
+      libspectrum_free( program->code[i].data.variable );
+
+  libspectrum_free( program->code );
+  libspectrum_free( program );
+}
+
+libspectrum_dword
+debugger_bytecode_evaluate( const debugger_bytecode *program )
+{
+  libspectrum_dword stack[ BYTECODE_STACK_SIZE ], *sp = stack;
+  const bytecode_instruction *pc = program->code,
+    *end = program->code + program->length;
+
+  while( pc < end ) {
+
+    switch( pc->opcode ) {
+
+    case BYTECODE_INTEGER: *sp++ = pc->data.integer; break;
+    case BYTECODE_SYSVAR:
+      *sp++ = debugger_system_variable_get( pc->data.system_variable );
+      break;
+    case BYTECODE_VARIABLE:
+      *sp++ = debugger_variable_get( pc->data.variable );
+      break;
+
+    case BYTECODE_LOGICAL_NOT: sp[-1] = !sp[-1]; break;
+    case BYTECODE_COMPLEMENT: sp[-1] = ~sp[-1]; break;
+    case BYTECODE_NEGATE: sp[-1] = -sp[-1]; break;
+    case BYTECODE_DEREFERENCE: sp[-1] = readbyte_internal( sp[-1] ); break;
+
+    case BYTECODE_ADD: sp--; sp[-1] += sp[0]; break;
+    case BYTECODE_SUBTRACT: sp--; sp[-1] -= sp[0]; break;
+    case BYTECODE_MULTIPLY: sp--; sp[-1] *= sp[0]; break;
+    case BYTECODE_DIVIDE:
+      sp--;
+      if( sp[0] == 0 ) {
+        ui_error( UI_ERROR_ERROR, "divide by 0" );
+        sp[-1] = 0;
+      } else {
+        sp[-1] /= sp[0];
+      }
+      break;
+    case BYTECODE_EQUAL_TO: sp--; sp[-1] = sp[-1] == sp[0]; break;
+    case BYTECODE_NOT_EQUAL_TO: sp--; sp[-1] = sp[-1] != sp[0]; break;
+    case BYTECODE_LESS_THAN: sp--; sp[-1] = sp[-1] < sp[0]; break;
+    case BYTECODE_GREATER_THAN: sp--; sp[-1] = sp[-1] > sp[0]; break;
+    case BYTECODE_LESS_THAN_OR_EQUAL_TO: sp--; sp[-1] = sp[-1] <= sp[0]; break;
+    case BYTECODE_GREATER_THAN_OR_EQUAL_TO:
+      sp--; sp[-1] = sp[-1] >= sp[0]; break;
+    case BYTECODE_BITWISE_AND: sp--; sp[-1] &= sp[0]; break;
+    case BYTECODE_BITWISE_XOR: sp--; sp[-1] ^= sp[0]; break;
+    case BYTECODE_BITWISE_OR: sp--; sp[-1] |= sp[0]; break;
+
+    case BYTECODE_JUMP_IF_FALSE:
+      if( !sp[-1] ) { pc = program->code + pc->data.target; continue; }
+      sp--;
+      break;
+
+    case BYTECODE_JUMP_IF_TRUE:
+      if( sp[-1] ) {
+        sp[-1] = 1;
+        pc = program->code + pc->data.target;
+        continue;
+      }
+      sp--;
+      break;
+
+    case BYTECODE_TRUTH: sp[-1] = !!sp[-1]; break;
+
+    }
+
+    pc++;
+  }
+
+  return stack[0];
+}
+
 int
 debugger_expression_deparse( char *buffer, size_t length,
 			     const debugger_expression *exp )
@@ -101,6 +101,43 @@ static int display_redraw_all;
 /* The last point at which we updated the screen display */
 int critical_region_x = 0, critical_region_y = 0;
 
+/* If set, don't rasterise this frame: chunks stay marked in
+   display_maybe_dirty and are plotted during the next frame which is
+   drawn, and border changes are dropped as each drawn frame repaints
+   the whole border from its own start-of-frame sentinel */
+int display_frame_skip = 0;
+
+/* If set, Sinclair screens are drawn by the batched renderer (see
+   display_dirty_sinclair_batched()) rather than by copying the critical
+   region on every write behind the beam */
+int display_batched = 0;
+
+/* A write to the screen logged by the batched renderer: the offset
+   written, the value it overwrote and the beam position at the time, as
+   y * ( DISPLAY_WIDTH_COLS + 1 ) + x in the same coordinates as the
+   critical region */
+struct display_write_t {
+  libspectrum_word offset;
+  libspectrum_word beam;
+  libspectrum_byte old;
+};
+
+/* Enough for a frame of back-to-back PUSHes to the screen; if it does
+   fill up, the critical region is just copied early */
+#define DISPLAY_WRITE_LOG_SIZE 16384
+
+static struct display_write_t display_write_log[ DISPLAY_WRITE_LOG_SIZE ];
+static size_t display_write_log_count = 0;
+
+/* The pixel and attribute bytes each chunk held when the beam passed it,
+   rebuilt by batch_copy_critical_region() */
+static libspectrum_byte display_batch_data[ DISPLAY_HEIGHT ][ DISPLAY_WIDTH_COLS ];
+static libspectrum_byte display_batch_attr[ DISPLAY_HEIGHT ][ DISPLAY_WIDTH_COLS ];
+
+/* Chunks whose displayed value is older than what is in memory now, and so
+   must be redrawn next frame */
+static libspectrum_dword display_batch_stale[ DISPLAY_HEIGHT ];
+
 /* The border colour changes which have occurred in this frame */
 struct border_change_t {
   int x, y;
@@ -607,10 +644,17 @@ copy_critical_region_line( int y, int x, int end )
   
 }
 
+static void batch_copy_critical_region( int beam_x, int beam_y );
+
 /* Copy any dirty data from the critical region to the drawing region */
 static void
 copy_critical_region( int beam_x, int beam_y )
 {
+  if( display_dirty == display_dirty_sinclair_batched ) {
+    batch_copy_critical_region( beam_x, beam_y );
+    return;
+  }
+
   if( critical_region_y == beam_y ) {
 
     copy_critical_region_line( critical_region_y, critical_region_x, beam_x );
@@ -650,28 +694,38 @@ get_beam_position( int *x, int *y )
   else *x = 0;
 }
 
-void
-display_update_critical( int x, int y )
+/* Get the beam position in main screen chunks, clamped to the main
+   screen: everything before it has already been displayed */
+static void
+get_critical_beam_position( int *beam_x, int *beam_y )
 {
-  int beam_x, beam_y;
-
-  get_beam_position( &beam_x, &beam_y );
+  get_beam_position( beam_x, beam_y );
 
-  beam_x -= DISPLAY_BORDER_WIDTH_COLS;
-  beam_y -= DISPLAY_BORDER_HEIGHT;
+  *beam_x -= DISPLAY_BORDER_WIDTH_COLS;
+  *beam_y -= DISPLAY_BORDER_HEIGHT;
 
-  if( beam_y < 0 ) {
-    beam_x = beam_y = 0;
-  } else if( beam_y >= DISPLAY_HEIGHT ) {
-    beam_x = DISPLAY_WIDTH_COLS;
-    beam_y = DISPLAY_HEIGHT - 1;
+  if( *beam_y < 0 ) {
+    *beam_x = *beam_y = 0;
+  } else if( *beam_y >= DISPLAY_HEIGHT ) {
+    *beam_x = DISPLAY_WIDTH_COLS;
+    *beam_y = DISPLAY_HEIGHT - 1;
   }
 
-  if( beam_x < 0 ) {
-    beam_x = 0;
-  } else if( beam_x > DISPLAY_WIDTH_COLS ) {
-    beam_x = DISPLAY_WIDTH_COLS;
+  if( *beam_x < 0 ) {
+    *beam_x = 0;
+  } else if( *beam_x > DISPLAY_WIDTH_COLS ) {
+    *beam_x = DISPLAY_WIDTH_COLS;
   }
+}
+
+void
+display_update_critical( int x, int y )
+{
+  int beam_x, beam_y;
+
+  if( display_frame_skip ) return;
+
+  get_critical_beam_position( &beam_x, &beam_y );
 
   if(   y <  beam_y                 ||
       ( y == beam_y && x < beam_x )    )
@@ -716,6 +770,185 @@ display_dirty64( libspectrum_word offset )
   for( i = 0; i < 8; i++ ) display_dirty_chunk( x, y + i );
 }
 
+/* The batched renderer. Writes to the screen are logged along with the
+   byte they overwrote and the beam position, and nothing is drawn until
+   the critical region has to be copied: at the end of the frame, when the
+   screen is paged or the log fills up. Then the lines concerned are
+   fetched a row at a time and the log is replayed backwards, which leaves
+   each chunk holding what was in memory when the beam passed it - exactly
+   what copying the critical region on every write would have drawn */
+void
+display_dirty_sinclair_batched( libspectrum_word offset )
+{
+  struct display_write_t *write;
+  int beam_x, beam_y, x, y, i;
+
+  if( offset >= 0x1b00 ) return;
+
+  /* A skipped frame is never drawn, so there is nothing to log */
+  if( !display_frame_skip ) {
+
+    get_critical_beam_position( &beam_x, &beam_y );
+
+    if( display_write_log_count == DISPLAY_WRITE_LOG_SIZE )
+      batch_copy_critical_region( beam_x, beam_y );
+
+    write = &display_write_log[ display_write_log_count++ ];
+    write->offset = offset;
+    write->beam = beam_y * ( DISPLAY_WIDTH_COLS + 1 ) + beam_x;
+    write->old = RAM[ memory_current_screen ][ offset ];
+  }
+
+  if( offset < 0x1800 ) {
+    x = display_dirty_xtable[ offset ];
+    y = display_dirty_ytable[ offset ];
+    display_maybe_dirty[y] |= ( (libspectrum_dword)1 << x );
+  } else {
+    x = display_dirty_xtable2[ offset - 0x1800 ];
+    y = display_dirty_ytable2[ offset - 0x1800 ];
+    for( i = 0; i < 8; i++ )
+      display_maybe_dirty[ y + i ] |= ( (libspectrum_dword)1 << x );
+  }
+}
+
+/* Draw the dirty chunks from ( x, y ) to ( end, y ) from the batch
+   buffers */
+static void
+batch_copy_critical_region_line( int y, int x, int end )
+{
+  libspectrum_dword bit_mask, dirty;
+  libspectrum_dword detail[ DISPLAY_WIDTH_COLS ];
+  libspectrum_dword *last;
+  const libspectrum_byte *data, *attr;
+  int beam_y, i;
+
+  if( end > DISPLAY_WIDTH_COLS ) end = DISPLAY_WIDTH_COLS;
+  if( x >= end ) return;
+
+  bit_mask = end == DISPLAY_WIDTH_COLS ? 0xffffffff :
+                                         ( (libspectrum_dword)1 << end ) - 1;
+  bit_mask &= ~( ( (libspectrum_dword)1 << x ) - 1 );
+
+  dirty = display_maybe_dirty[y] & bit_mask;
+  if( !dirty ) return;
+
+  /* Chunks drawn with an old value stay dirty for next frame */
+  display_maybe_dirty[y] &= ~bit_mask | display_batch_stale[y];
+
+  data = display_batch_data[y];
+  attr = display_batch_attr[y];
+  for( i = 0; i < DISPLAY_WIDTH_COLS; i++ )
+    detail[i] = ( display_flash_reversed << 24 ) | ( attr[i] << 8 ) | data[i];
+
+  beam_y = y + DISPLAY_BORDER_HEIGHT;
+  last = &display_last_screen[ DISPLAY_BORDER_WIDTH_COLS +
+                               beam_y * DISPLAY_SCREEN_WIDTH_COLS ];
+
+  for( i = x, dirty >>= x; dirty; i++, dirty >>= 1 ) {
+    libspectrum_byte ink, paper;
+
+    if( !( dirty & 0x01 ) || last[i] == detail[i] ) continue;
+
+    display_parse_attr( attr[i], &ink, &paper );
+    uidisplay_plot8( i + DISPLAY_BORDER_WIDTH_COLS, beam_y, data[i], ink,
+                     paper );
+
+    last[i] = detail[i];
+    display_is_dirty[ beam_y ] |=
+      ( (libspectrum_qword)1 << ( i + DISPLAY_BORDER_WIDTH_COLS ) );
+  }
+}
+
+static void
+batch_copy_critical_region( int beam_x, int beam_y )
+{
+  const libspectrum_byte *screen = RAM[ memory_current_screen ];
+  const struct display_write_t *write;
+  size_t i;
+  int x, y, j;
+
+  /* Fetch the current contents of every line with something to draw */
+  for( y = critical_region_y; y <= beam_y; y++ ) {
+    display_batch_stale[y] = 0;
+    if( !display_maybe_dirty[y] ) continue;
+    memcpy( display_batch_data[y], screen + display_line_start[y],
+            DISPLAY_WIDTH_COLS );
+    memcpy( display_batch_attr[y], screen + display_attr_start[y],
+            DISPLAY_WIDTH_COLS );
+  }
+
+  /* Undo, newest first, every write made after the beam had passed the
+     chunk; what's left is the value each chunk had when it was passed */
+  for( i = display_write_log_count, write = display_write_log + i;
+       i--; ) {
+    write--;
+
+    if( write->offset < 0x1800 ) {
+      x = display_dirty_xtable[ write->offset ];
+      y = display_dirty_ytable[ write->offset ];
+      if( y * ( DISPLAY_WIDTH_COLS + 1 ) + x < write->beam ) {
+        display_batch_data[y][x] = write->old;
+        display_batch_stale[y] |= ( (libspectrum_dword)1 << x );
+      }
+    } else {
+      x = display_dirty_xtable2[ write->offset - 0x1800 ];
+      y = display_dirty_ytable2[ write->offset - 0x1800 ];
+      for( j = 0; j < 8; j++, y++ ) {
+        if( y * ( DISPLAY_WIDTH_COLS + 1 ) + x >= write->beam ) break;
+        display_batch_attr[y][x] = write->old;
+        display_batch_stale[y] |= ( (libspectrum_dword)1 << x );
+      }
+    }
+  }
+
+  display_write_log_count = 0;
+
+  if( critical_region_y == beam_y ) {
+
+    batch_copy_critical_region_line( critical_region_y, critical_region_x,
+                                     beam_x );
+
+  } else {
+
+    batch_copy_critical_region_line( critical_region_y++, critical_region_x,
+                                     DISPLAY_WIDTH_COLS );
+
+    for( ; critical_region_y < beam_y; critical_region_y++ )
+      batch_copy_critical_region_line( critical_region_y, 0,
+                                       DISPLAY_WIDTH_COLS );
+
+    batch_copy_critical_region_line( critical_region_y, 0, beam_x );
+  }
+
+  critical_region_x = beam_x;
+}
+
+void
+display_set_batched( int batched )
+{
+  int beam_x, beam_y;
+
+  /* The log only makes sense to the batched renderer which made it, so
+     draw up to the beam with it before switching away, and never start
+     again from entries left over from before */
+  if( batched != display_batched ) {
+    if( display_dirty == display_dirty_sinclair_batched &&
+        display_write_log_count ) {
+      get_critical_beam_position( &beam_x, &beam_y );
+      batch_copy_critical_region( beam_x, beam_y );
+    }
+
+    display_write_log_count = 0;
+  }
+
+  display_batched = batched;
+
+  if( display_dirty == display_dirty_sinclair ||
+      display_dirty == display_dirty_sinclair_batched )
+    display_dirty = batched ? display_dirty_sinclair_batched :
+                              display_dirty_sinclair;
+}
+
 /* Get the attributes for the eight pixels starting at
    ( (8*x) , y ) */
 static void
@@ -947,16 +1180,31 @@ update_ui_screen( void )
   }
 }
 
+/* Forget this frame's border changes without drawing them */
+static void
+skip_border( void )
+{
+  border_changes_last = 0;
+
+  add_border_sentinel();
+}
+
 int
 display_frame( void )
 {
-  /* Copy all the critical region to the display */
-  copy_critical_region( DISPLAY_WIDTH_COLS, DISPLAY_HEIGHT - 1 );
-  critical_region_x = critical_region_y = 0;
+  if( display_frame_skip ) {
+    critical_region_x = critical_region_y = 0;
+    display_write_log_count = 0;
+    skip_border();
+  } else {
+    /* Copy all the critical region to the display */
+    copy_critical_region( DISPLAY_WIDTH_COLS, DISPLAY_HEIGHT - 1 );
+    critical_region_x = critical_region_y = 0;
 
-  update_border();
-  update_dirty_rects();
-  update_ui_screen();
+    update_border();
+    update_dirty_rects();
+    update_ui_screen();
+  }
 
   display_frame_count++;
   if(display_frame_count==16) {
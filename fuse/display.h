@@ -89,6 +89,7 @@ extern display_dirty_fn display_dirty;
 void display_dirty_timex( libspectrum_word offset );
 void display_dirty_pentagon_16_col( libspectrum_word offset );
 void display_dirty_sinclair( libspectrum_word offset );
+void display_dirty_sinclair_batched( libspectrum_word offset );
 
 typedef void (*display_write_if_dirty_fn)( int x, int y );
 /* Function to write a dirty 8x1 chunk of pixels to the display */
@@ -112,6 +113,11 @@ void display_set_lores_border(int colour);
 void display_set_hires_border(int colour);
 int display_dirty_border(void);
 
+extern int display_frame_skip;
+extern int display_batched;
+
+void display_set_batched( int batched );
+
 int display_frame(void);
 void display_refresh_main_screen(void);
 void display_refresh_all(void);
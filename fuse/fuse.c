@@ -102,6 +102,7 @@
 #include "sound.h"
 #include "spectrum.h"
 #include "tape.h"
+#include "trace.h"
 #include "timer/timer.h"
 #include "ui/scaler/scaler.h"
 #include "ui/ui.h"
@@ -155,6 +156,11 @@ typedef struct start_files_t {
 /* Context for the display startup routine */
 static display_startup_context display_context;
 
+/* The state of fuse_rand(). Not using rand() itself means several copies of
+   the emulator loaded into one process each get their own sequence rather
+   than sharing, and racing on, the C library's */
+static libspectrum_qword rand_state = 0x9e3779b97f4a7c15ULL;
+
 static int fuse_init(int argc, char **argv);
 
 static void creator_register_startup( void );
@@ -339,6 +345,7 @@ run_startup_manager( int *argc, char ***argv )
   spectranet_register_startup();
   spectrum_register_startup();
   tape_register_startup();
+  trace_register_startup();
   ttx2000s_register_startup();
   timer_register_startup();
   ula_register_startup();
@@ -357,9 +364,8 @@ static int fuse_init(int argc, char **argv)
   char *start_scaler;
   start_files_t start_files;
 
-  /* Seed the bad but widely-available random number
-     generator with the current time */
-  srand( (unsigned)time( NULL ) );
+  /* Seed the random number generator with the current time */
+  rand_state = (libspectrum_qword)time( NULL ) ^ 0x9e3779b97f4a7c15ULL;
 
   /* Some platforms (e.g. Wii) do not have argc/argv */
   if(argc > 0)
@@ -367,7 +373,11 @@ static int fuse_init(int argc, char **argv)
   else
     fuse_progname = "fuse";
   
+#ifndef __LIBRETRO__
+  /* The core installs this itself, as it may be inflating the content on
+     another thread at this point */
   libspectrum_error_function = ui_libspectrum_error;
+#endif
 
 #ifdef GEKKO
   /* On the Wii, init the display first so we have a way of outputting
@@ -975,3 +985,15 @@ fuse_abort( void )
   fuse_end();
   abort();
 }
+
+/* xorshift64*, scaled to rand()'s range */
+int
+fuse_rand( void )
+{
+  rand_state ^= rand_state >> 12;
+  rand_state ^= rand_state << 25;
+  rand_state ^= rand_state >> 27;
+
+  return ( ( rand_state * 0x2545f4914f6cdd1dULL ) >> 33 ) %
+         ( (libspectrum_qword)RAND_MAX + 1 );
+}
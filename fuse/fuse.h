@@ -44,6 +44,8 @@ int fuse_main(int argc, char **argv);
 
 void fuse_abort( void ) GCC_NORETURN;	/* Emergency shutdown */
 
+int fuse_rand( void );			/* rand() replacement, 0 to RAND_MAX */
+
 extern libspectrum_creator *fuse_creator; /* Creator information for file
 					     formats which support this */
 
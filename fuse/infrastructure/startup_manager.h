@@ -72,6 +72,7 @@ typedef enum startup_manager_module {
   STARTUP_MANAGER_MODULE_SPECTRANET,
   STARTUP_MANAGER_MODULE_SPECTRUM,
   STARTUP_MANAGER_MODULE_TAPE,
+  STARTUP_MANAGER_MODULE_TRACE,
   STARTUP_MANAGER_MODULE_TTX2000S,
   STARTUP_MANAGER_MODULE_TIMER,
   STARTUP_MANAGER_MODULE_ULA,
@@ -62,6 +62,32 @@ static int machine_add_machine( int (*init_function)(fuse_machine_info *machine)
 static int machine_select_machine( fuse_machine_info *machine );
 static void machine_set_const_timings( fuse_machine_info *machine );
 static void machine_set_variable_timings( fuse_machine_info *machine );
+static void machine_set_contention( fuse_machine_info *machine );
+
+/* The contention tables depend only on the machine's contention functions
+   and its frame timings (including the late timings adjustment), so keep
+   the tables for the last few combinations seen rather than rebuilding
+   them from scratch on every reset and snapshot load */
+#define MACHINE_CONTENTION_CACHE_SIZE 8
+
+typedef struct machine_contention_t {
+  spectrum_contention_delay_function contend_delay;
+  spectrum_contention_delay_function contend_delay_no_mreq;
+  libspectrum_dword first_line_time;
+  libspectrum_dword tstates_per_frame;
+  libspectrum_word tstates_per_line;
+  libspectrum_word left_border;
+  libspectrum_word horizontal_screen;
+
+  libspectrum_byte *contention;
+  libspectrum_byte *contention_no_mreq;
+} machine_contention_t;
+
+static machine_contention_t contention_cache[ MACHINE_CONTENTION_CACHE_SIZE ];
+static size_t contention_cache_next = 0;
+
+/* The entry currently copied into ula_contention[], if any */
+static machine_contention_t *contention_current = NULL;
 
 static int
 machine_init_machines( void *context )
@@ -331,7 +357,6 @@ machine_load_rom( int page_num, const char *filename, const char *fallback,
 int
 machine_reset( int hard_reset )
 {
-  size_t i;
   int error;
 
   /* Clear poke list (undoes effects of active pokes on Spectrum memory) */
@@ -357,10 +382,7 @@ machine_reset( int hard_reset )
   error = machine_current->memory_map(); if( error ) return error;
 
   /* Set up the contention array */
-  for( i = 0; i < machine_current->timings.tstates_per_frame; i++ ) {
-    ula_contention[ i ] = machine_current->ram.contend_delay( i );
-    ula_contention_no_mreq[ i ] = machine_current->ram.contend_delay_no_mreq( i );
-  }
+  machine_set_contention( machine_current );
 
   /* Update the disk menu items */
   ui_menu_disk_update();
@@ -424,11 +446,85 @@ machine_set_variable_timings( fuse_machine_info *machine )
   }
 }
 
+static int
+machine_contention_matches( const machine_contention_t *entry,
+                            const fuse_machine_info *machine )
+{
+  return entry->contention &&
+         entry->contend_delay == machine->ram.contend_delay &&
+         entry->contend_delay_no_mreq == machine->ram.contend_delay_no_mreq &&
+         entry->first_line_time == machine->line_times[0] &&
+         entry->tstates_per_frame == machine->timings.tstates_per_frame &&
+         entry->tstates_per_line == machine->timings.tstates_per_line &&
+         entry->left_border == machine->timings.left_border &&
+         entry->horizontal_screen == machine->timings.horizontal_screen;
+}
+
+static void
+machine_set_contention( fuse_machine_info *machine )
+{
+  machine_contention_t *entry = NULL;
+  libspectrum_dword frame_length = machine->timings.tstates_per_frame;
+  size_t i;
+
+  /* Nothing to do if the tables already hold this machine's contention */
+  if( contention_current &&
+      machine_contention_matches( contention_current, machine ) )
+    return;
+
+  for( i = 0; i < MACHINE_CONTENTION_CACHE_SIZE; i++ ) {
+    if( machine_contention_matches( &contention_cache[i], machine ) ) {
+      entry = &contention_cache[i];
+      break;
+    }
+  }
+
+  if( !entry ) {
+    entry = &contention_cache[ contention_cache_next ];
+    contention_cache_next =
+      ( contention_cache_next + 1 ) % MACHINE_CONTENTION_CACHE_SIZE;
+
+    libspectrum_free( entry->contention );
+    libspectrum_free( entry->contention_no_mreq );
+
+    entry->contend_delay = machine->ram.contend_delay;
+    entry->contend_delay_no_mreq = machine->ram.contend_delay_no_mreq;
+    entry->first_line_time = machine->line_times[0];
+    entry->tstates_per_frame = frame_length;
+    entry->tstates_per_line = machine->timings.tstates_per_line;
+    entry->left_border = machine->timings.left_border;
+    entry->horizontal_screen = machine->timings.horizontal_screen;
+
+    entry->contention = libspectrum_new( libspectrum_byte, frame_length );
+    entry->contention_no_mreq = libspectrum_new( libspectrum_byte,
+                                                 frame_length );
+
+    for( i = 0; i < frame_length; i++ ) {
+      entry->contention[ i ] = machine->ram.contend_delay( i );
+      entry->contention_no_mreq[ i ] = machine->ram.contend_delay_no_mreq( i );
+    }
+  }
+
+  memcpy( ula_contention, entry->contention, frame_length );
+  memcpy( ula_contention_no_mreq, entry->contention_no_mreq, frame_length );
+
+  contention_current = entry;
+}
+
 static void
 machine_end( void )
 {
   int i;
 
+  for( i=0; i<MACHINE_CONTENTION_CACHE_SIZE; i++ ) {
+    libspectrum_free( contention_cache[i].contention );
+    libspectrum_free( contention_cache[i].contention_no_mreq );
+    contention_cache[i].contention = NULL;
+    contention_cache[i].contention_no_mreq = NULL;
+  }
+  contention_cache_next = 0;
+  contention_current = NULL;
+
   for( i=0; i<machine_count; i++ ) {
     if( machine_types[i]->shutdown ) machine_types[i]->shutdown();
     libspectrum_free( machine_types[i] );
@@ -94,7 +94,8 @@ spec48_reset( void )
 void
 spec48_common_display_setup( void )
 {
-  display_dirty = display_dirty_sinclair;
+  display_dirty = display_batched ? display_dirty_sinclair_batched :
+                                   display_dirty_sinclair;
   display_write_if_dirty = display_write_if_dirty_sinclair;
   display_dirty_flashing = display_dirty_flashing_sinclair;
 
@@ -71,14 +71,27 @@ memory_page memory_map_ram[SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K];
 /* Standard mappings for the ROMs */
 memory_page memory_map_rom[SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K];
 
-/* Some allocated memory */
-typedef struct memory_pool_entry_t {
-  int persistent;
-  libspectrum_byte *memory;
-} memory_pool_entry_t;
-
-/* All the memory we've allocated for this machine */
-static GSList *pool;
+/* Memory handed out by memory_pool_allocate_persistent() comes from two
+   arenas: one for chunks which last only until the next machine reset (ROMs,
+   Timex dock and EXROM, SLT data) and one for persistent chunks (peripheral
+   RAM and ROM). An arena is a list of page-aligned blocks which are carved
+   up in order; system RAM is the statically allocated RAM[] array and never
+   comes from here. */
+typedef struct memory_arena_t {
+  GSList *blocks;		/* All the blocks, newest first */
+  libspectrum_byte *next;	/* Next free byte in the newest block */
+  size_t size;			/* Usable size of the newest block */
+  size_t left;			/* Bytes left in the newest block */
+  size_t used;			/* Bytes handed out since the last reset */
+  size_t block_size;		/* Size of new blocks */
+} memory_arena_t;
+
+/* Alignment of the start of each block, and of each chunk within it */
+#define MEMORY_ARENA_BLOCK_ALIGN 4096
+#define MEMORY_ARENA_CHUNK_ALIGN 64
+
+static memory_arena_t machine_arena = { NULL, NULL, 0, 0, 0, 0x20000 };
+static memory_arena_t persistent_arena = { NULL, NULL, 0, 0, 0, 0x40000 };
 
 /* Which RAM page contains the current screen */
 int memory_current_screen;
@@ -86,6 +99,7 @@ int memory_current_screen;
 /* Which bits to look at when working out where the screen is */
 libspectrum_word memory_screen_mask;
 
+static void memory_arena_free( memory_arena_t *arena );
 static void memory_from_snapshot( libspectrum_snap *snap );
 static void memory_to_snapshot( libspectrum_snap *snap );
 
@@ -117,7 +131,8 @@ memory_init( void *context )
   memory_source_none = memory_source_register( "None" );
 
   /* Nothing in the memory pool as yet */
-  pool = NULL;
+  memory_arena_free( &machine_arena );
+  memory_arena_free( &persistent_arena );
 
   for( i = 0; i < SPECTRUM_ROM_PAGES; i++ )
     for( j = 0; j < MEMORY_PAGES_IN_16K; j++ ) {
@@ -143,11 +158,86 @@ memory_init( void *context )
 }
 
 static void
-memory_pool_free_entry( gpointer data, gpointer user_data GCC_UNUSED )
+memory_arena_free_block( gpointer data, gpointer user_data GCC_UNUSED )
+{
+  libspectrum_free( data );
+}
+
+/* Release every block in an arena */
+static void
+memory_arena_free( memory_arena_t *arena )
+{
+  g_slist_foreach( arena->blocks, memory_arena_free_block, NULL );
+  g_slist_free( arena->blocks );
+  arena->blocks = NULL;
+  arena->next = NULL;
+  arena->size = arena->left = 0;
+  arena->used = 0;
+}
+
+/* Point the arena at the start of its newest block */
+static void
+memory_arena_rewind( memory_arena_t *arena )
+{
+  libspectrum_byte *block = arena->blocks->data;
+  size_t misalign = (size_t)block % MEMORY_ARENA_BLOCK_ALIGN;
+
+  arena->next = misalign ? block + MEMORY_ARENA_BLOCK_ALIGN - misalign : block;
+  arena->left = arena->size;
+}
+
+/* Start a new block of at least 'length' bytes */
+static void
+memory_arena_add_block( memory_arena_t *arena, size_t length )
 {
-  memory_pool_entry_t *entry = data;
-  libspectrum_free( entry->memory );
-  libspectrum_free( entry );
+  size_t size = length > arena->block_size ? length : arena->block_size;
+
+  arena->blocks =
+    g_slist_prepend( arena->blocks,
+                     libspectrum_new( libspectrum_byte,
+                                      size + MEMORY_ARENA_BLOCK_ALIGN ) );
+  arena->size = size;
+  memory_arena_rewind( arena );
+}
+
+static libspectrum_byte*
+memory_arena_allocate( memory_arena_t *arena, size_t length )
+{
+  libspectrum_byte *memory;
+
+  length = ( length + MEMORY_ARENA_CHUNK_ALIGN - 1 ) &
+           ~(size_t)( MEMORY_ARENA_CHUNK_ALIGN - 1 );
+  if( !length ) length = MEMORY_ARENA_CHUNK_ALIGN;
+
+  if( length > arena->left ) memory_arena_add_block( arena, length );
+
+  memory = arena->next;
+  arena->next += length;
+  arena->left -= length;
+  arena->used += length;
+
+  return memory;
+}
+
+/* Make everything in an arena available again. If the last round of
+   allocations needed more than one block, replace them with a single block
+   big enough for all of it, so the next round is contiguous */
+static void
+memory_arena_reset( memory_arena_t *arena )
+{
+  size_t used = arena->used;
+
+  if( !arena->blocks ) return;
+
+  if( arena->blocks->next ) {
+    memory_arena_free( arena );
+    if( used > arena->block_size ) arena->block_size = used;
+    memory_arena_add_block( arena, arena->block_size );
+  } else {
+    memory_arena_rewind( arena );
+  }
+
+  arena->used = 0;
 }
 
 /* Tidy-up function called at end of emulation */
@@ -158,11 +248,8 @@ memory_end( void )
   char *description;
 
   /* Free all the memory we've allocated for this machine */
-  if( pool ) {
-    g_slist_foreach( pool, memory_pool_free_entry, NULL );
-    g_slist_free( pool );
-    pool = NULL;
-  }
+  memory_arena_free( &machine_arena );
+  memory_arena_free( &persistent_arena );
 
   /* Free memory source types */
   if( memory_sources ) {
@@ -227,41 +314,15 @@ memory_pool_allocate( size_t length )
 libspectrum_byte*
 memory_pool_allocate_persistent( size_t length, int persistent )
 {
-  memory_pool_entry_t *entry;
-  libspectrum_byte *memory;
-
-  memory = libspectrum_new( libspectrum_byte, length );
-
-  entry = libspectrum_new( memory_pool_entry_t, 1 );
-
-  entry->persistent = persistent;
-  entry->memory = memory;
-
-  pool = g_slist_prepend( pool, entry );
-
-  return memory;
-}
-
-static gint
-find_non_persistent( gconstpointer data, gconstpointer user_data GCC_UNUSED )
-{
-  const memory_pool_entry_t *entry = data;
-  return entry->persistent;
+  return memory_arena_allocate( persistent ? &persistent_arena :
+                                             &machine_arena, length );
 }
 
 /* Free all non-persistent memory in the pool */
 void
 memory_pool_free( void )
 {
-  GSList *ptr;
-
-  while( ( ptr = g_slist_find_custom( pool, NULL, find_non_persistent ) ) != NULL )
-  {
-    memory_pool_entry_t *entry = ptr->data;
-    libspectrum_free( entry->memory );
-    pool = g_slist_remove( pool, entry );
-    libspectrum_free( entry );
-  }
+  memory_arena_reset( &machine_arena );
 }
 
 /* Set contention for 16K of RAM */
@@ -379,7 +440,8 @@ readbyte( libspectrum_word address )
   bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
   mapping = &memory_map_read[ bank ];
 
-  if( debugger_mode != DEBUGGER_MODE_INACTIVE )
+  if( debugger_mode == DEBUGGER_MODE_ACTIVE &&
+      debugger_breakpoint_at( DEBUGGER_BREAKPOINT_TYPE_READ, address ) )
     debugger_check( DEBUGGER_BREAKPOINT_TYPE_READ, address );
 
   if( mapping->contended ) tstates += ula_contention[ tstates ];
@@ -412,7 +474,8 @@ writebyte( libspectrum_word address, libspectrum_byte b )
   bank = address >> MEMORY_PAGE_SIZE_LOGARITHM;
   mapping = &memory_map_write[ bank ];
 
-  if( debugger_mode != DEBUGGER_MODE_INACTIVE )
+  if( debugger_mode == DEBUGGER_MODE_ACTIVE &&
+      debugger_breakpoint_at( DEBUGGER_BREAKPOINT_TYPE_WRITE, address ) )
     debugger_check( DEBUGGER_BREAKPOINT_TYPE_WRITE, address );
 
   if( mapping->contended ) tstates += ula_contention[ tstates ];
@@ -38,6 +38,7 @@
 #include <zlib.h>
 #endif
 
+#include "compat.h"
 #include "display.h"
 #include "fuse.h"
 #include "machine.h"
@@ -139,8 +140,59 @@ static unsigned char zbuf_o[ ZBUF_SIZE ];
 
 static unsigned char alaw_table[2048 + 1] = { ALAW_ENC_TAB };
 
+/*
+  Screen areas and sound are handed over to a worker thread, which does the
+  run length encoding, compression and file writing, so recording costs the
+  emulation little more than a copy of the changed data. Messages go through
+  a lock-free single producer/single consumer ring; each is a header
+  followed by its payload, and never wraps around the end of the ring.
+
+  When no worker thread can be started, each message is processed as soon
+  as it is queued.
+*/
+
+#define MOVIE_QUEUE_SIZE ( 1 << 22 )
+
+/* Once the queue is this full, screen areas are dropped rather than waited
+   for, and the whole screen is sent again with the next frame. Everything
+   else waits for space, so sound and frame timing are never lost */
+#define MOVIE_QUEUE_HIGH_WATER ( MOVIE_QUEUE_SIZE / 4 * 3 )
+
+#define MOVIE_ALIGN( n ) ( ( (n) + 7 ) & ~(size_t)7 )
+#define MOVIE_HEADER_SIZE MOVIE_ALIGN( sizeof( movie_message ) )
+
+typedef enum movie_message_type {
+  MOVIE_MESSAGE_DATA,		/* Just the header bytes */
+  MOVIE_MESSAGE_AREA,		/* Screen area from display_last_screen */
+  MOVIE_MESSAGE_SOUND,		/* Sound samples */
+  MOVIE_MESSAGE_WRAP,		/* Continue from the start of the queue */
+  MOVIE_MESSAGE_STOP,		/* Finish the file */
+} movie_message_type;
+
+typedef struct movie_message {
+  movie_message_type type;
+  libspectrum_byte head[8];	/* Written before the payload */
+  size_t head_length;
+  size_t length;		/* Payload length in bytes */
+  int w, h, planes;		/* MOVIE_MESSAGE_AREA */
+  char format;			/* MOVIE_MESSAGE_SOUND */
+} movie_message;
+
+static libspectrum_byte *queue = NULL;
+static size_t queue_head, queue_tail;	/* Total bytes written and read */
+static size_t queue_advance;		/* Bytes taken by the reserved message */
+static int queue_threaded = 0;
+static compat_thread queue_thread;
+static compat_mutex queue_mutex;
+static compat_cond queue_data_cond, queue_space_cond;
+
+/* Set when a screen area had to be dropped */
+static int movie_resync = 0;
+
 void movie_start_frame( void );
 void movie_init_sound( int f, int s );
+static void write_alaw( libspectrum_signed_word *buff, int len );
+static int queue_process( void );
 
 static char
 get_timing( void )
@@ -214,18 +266,18 @@ fwrite_compr( const void *b, size_t n, size_t m, RFILE *f )
 #endif	/* HAVE_ZLIB_H */
 
 static void
-movie_compress_area( int x, int y, int w, int h, int s )
+movie_compress_area( const libspectrum_dword *area, int w, int h, int s )
 {
-  libspectrum_dword *dpoint, *dline;
+  const libspectrum_dword *dpoint, *dline;
   libspectrum_byte d, d1, *b;
   libspectrum_byte buff[ 960 ];
   int w0, h0, l;
 
-  dline = &display_last_screen[x + 40 * y];
+  dline = area;
   b = buff; l = -1;
   d1 = ( ( *dline >> s ) & 0xff ) + 1;		/* *d1 != dpoint :-) */
 
-  for( h0 = h; h0 > 0; h0--, dline += 40 ) {
+  for( h0 = h; h0 > 0; h0--, dline += w ) {
     dpoint = dline;
     for( w0 = w; w0 > 0; w0--, dpoint++) {
       d = ( *dpoint >> s ) & 0xff;	/* bitmask1 */
@@ -260,6 +312,215 @@ movie_compress_area( int x, int y, int w, int h, int s )
   }
 }
 
+static void
+movie_finish_fmf( void )
+{
+#ifdef HAVE_ZLIB_H
+  if( fmf_compr != 0 ) {		/* close zlib */
+    zstream.avail_in = 0;
+    do {
+      zstream.avail_out = ZBUF_SIZE;
+      zstream.next_out = zbuf_o;
+      deflate( &zstream, Z_SYNC_FLUSH );
+      if( zstream.avail_out != ZBUF_SIZE )
+        filestream_write( of, zbuf_o, (int64_t)( ZBUF_SIZE - zstream.avail_out ) * ( 1 ) );
+    } while ( zstream.avail_out != ZBUF_SIZE );
+    deflateEnd( &zstream );
+    fmf_compr = -1;
+  }
+#endif	/* HAVE_ZLIB_H */
+  if( of ) {
+    filestream_close( of );
+    of = NULL;
+  }
+}
+
+static void *
+movie_payload( movie_message *message )
+{
+  return (libspectrum_byte*)message + MOVIE_HEADER_SIZE;
+}
+
+/* Write out one message; returns 0 once the file has been finished */
+static int
+movie_process_message( movie_message *message )
+{
+  void *payload = movie_payload( message );
+  int plane;
+
+  if( message->head_length )
+    fwrite_compr( message->head, message->head_length, 1, of );
+
+  switch( message->type ) {
+
+  case MOVIE_MESSAGE_AREA:
+    /* Bitmap1, Attrib/B2 and HiRes attrib */
+    for( plane = 0; plane < message->planes; plane++ )
+      movie_compress_area( payload, message->w, message->h, plane * 8 );
+    break;
+
+  case MOVIE_MESSAGE_SOUND:
+    if( message->format == 'P' )
+      fwrite_compr( payload, message->length, 1, of );
+    else if( message->format == 'A' )
+      write_alaw( payload, message->length / 2 );
+    break;
+
+  case MOVIE_MESSAGE_STOP:
+    movie_finish_fmf();
+    return 0;
+
+  default:
+    break;
+
+  }
+
+  return 1;
+}
+
+static void
+queue_thread_main( void *data )
+{
+  do {
+    compat_mutex_lock( queue_mutex );
+    while( compat_atomic_load( &queue_head ) == queue_tail )
+      compat_cond_wait( queue_data_cond, queue_mutex );
+    compat_mutex_unlock( queue_mutex );
+  } while( queue_process() );
+}
+
+/* Process everything currently queued; returns 0 after the stop message */
+static int
+queue_process( void )
+{
+  size_t head = compat_atomic_load( &queue_head );
+  int running = 1;
+
+  while( running && queue_tail != head ) {
+    size_t offset = queue_tail % MOVIE_QUEUE_SIZE;
+    size_t contiguous = MOVIE_QUEUE_SIZE - offset;
+    movie_message *message = (movie_message*)( queue + offset );
+    size_t advance;
+
+    if( contiguous < MOVIE_HEADER_SIZE ||
+        message->type == MOVIE_MESSAGE_WRAP ) {
+      advance = contiguous;
+    } else {
+      running = movie_process_message( message );
+      advance = MOVIE_HEADER_SIZE + MOVIE_ALIGN( message->length );
+    }
+
+    compat_atomic_store( &queue_tail, queue_tail + advance );
+
+    if( queue_threaded ) {
+      compat_mutex_lock( queue_mutex );
+      compat_cond_signal( queue_space_cond );
+      compat_mutex_unlock( queue_mutex );
+    }
+  }
+
+  return running;
+}
+
+/* Wake the worker to deal with what's been queued so far */
+static void
+queue_signal( void )
+{
+  if( !queue_threaded ) return;
+
+  compat_mutex_lock( queue_mutex );
+  compat_cond_signal( queue_data_cond );
+  compat_mutex_unlock( queue_mutex );
+}
+
+/* Reserve space for a message with the given payload length. If may_drop
+   is set, returns NULL rather than waiting when the queue is nearly full */
+static movie_message*
+queue_reserve( size_t length, int may_drop )
+{
+  size_t offset = queue_head % MOVIE_QUEUE_SIZE;
+  size_t contiguous = MOVIE_QUEUE_SIZE - offset;
+  size_t needed = MOVIE_HEADER_SIZE + MOVIE_ALIGN( length );
+  movie_message *message;
+
+  /* Skip the rest of the ring if the message won't fit before the end */
+  queue_advance = needed;
+  if( contiguous < needed ) queue_advance += contiguous;
+
+  if( queue_threaded ) {
+    size_t used = queue_head - compat_atomic_load( &queue_tail );
+
+    if( may_drop && used + queue_advance > MOVIE_QUEUE_HIGH_WATER )
+      return NULL;
+
+    if( MOVIE_QUEUE_SIZE - used < queue_advance ) {
+      compat_mutex_lock( queue_mutex );
+      compat_cond_signal( queue_data_cond );
+      while( MOVIE_QUEUE_SIZE - ( queue_head - compat_atomic_load( &queue_tail ) )
+             < queue_advance )
+        compat_cond_wait( queue_space_cond, queue_mutex );
+      compat_mutex_unlock( queue_mutex );
+    }
+  }
+
+  if( contiguous < needed ) {
+    if( contiguous >= MOVIE_HEADER_SIZE )
+      ( (movie_message*)( queue + offset ) )->type = MOVIE_MESSAGE_WRAP;
+    offset = 0;
+  }
+
+  message = (movie_message*)( queue + offset );
+  memset( message, 0, sizeof( *message ) );
+  message->length = length;
+
+  return message;
+}
+
+static void
+queue_commit( void )
+{
+  compat_atomic_store( &queue_head, queue_head + queue_advance );
+
+  if( !queue_threaded ) queue_process();
+}
+
+static void
+queue_start( void )
+{
+  queue = libspectrum_new( libspectrum_byte, MOVIE_QUEUE_SIZE );
+  queue_head = queue_tail = 0;
+  movie_resync = 0;
+
+  queue_mutex = compat_mutex_create();
+  queue_data_cond = compat_cond_create();
+  queue_space_cond = compat_cond_create();
+
+  queue_threaded = queue_mutex && queue_data_cond && queue_space_cond;
+  if( queue_threaded ) {
+    queue_thread = compat_thread_create( queue_thread_main, NULL );
+    if( !queue_thread ) queue_threaded = 0;
+  }
+}
+
+static void
+queue_end( void )
+{
+  if( queue_threaded ) {
+    queue_signal();
+    compat_thread_join( queue_thread );
+    queue_threaded = 0;
+  }
+
+  if( queue_mutex ) compat_mutex_destroy( queue_mutex );
+  if( queue_data_cond ) compat_cond_destroy( queue_data_cond );
+  if( queue_space_cond ) compat_cond_destroy( queue_space_cond );
+  queue_mutex = NULL;
+  queue_data_cond = queue_space_cond = NULL;
+
+  libspectrum_free( queue );
+  queue = NULL;
+}
+
 /* Fetch pixel (x, y). On a Timex this will be a point on a 640x480 canvas,
    on a Sinclair/Amstrad/Russian clone this will be a point on a 320x240
    canvas */
@@ -271,33 +532,50 @@ movie_compress_area( int x, int y, int w, int h, int s )
 void
 movie_add_area( int x, int y, int w, int h )
 {
+  movie_message *message;
+  libspectrum_dword *area;
+  int row;
+
   if( movie_paused ) {
     movie_start_frame();
     return;
   }
-  head[0] = '$';			/* RLE compressed data... */
-  head[1] = x;
-  head[2] = y & 0xff;
-  head[3] = y >> 8;
-  head[4] = w;
-  head[5] = h & 0xff;
-  head[6] = h >> 8;
-  fwrite_compr( head, 7, 1, of );
-  movie_compress_area( x, y, w, h, 0 );	/* Bitmap1 */
-  movie_compress_area( x, y, w, h, 8 );	/* Attrib/B2 */
-  if( fmf_screen == 'R' ) {
-    movie_compress_area( x, y, w, h, 16 );	/* HiRes attrib */
+
+  message = queue_reserve( w * h * sizeof( libspectrum_dword ), 1 );
+  if( !message ) {
+    movie_resync = 1;
+    return;
   }
+
+  message->type = MOVIE_MESSAGE_AREA;
+  message->head[0] = '$';		/* RLE compressed data... */
+  message->head[1] = x;
+  message->head[2] = y & 0xff;
+  message->head[3] = y >> 8;
+  message->head[4] = w;
+  message->head[5] = h & 0xff;
+  message->head[6] = h >> 8;
+  message->head_length = 7;
+  message->w = w;
+  message->h = h;
+  message->planes = fmf_screen == 'R' ? 3 : 2;
+
+  area = movie_payload( message );
+  for( row = 0; row < h; row++ )
+    memcpy( area + row * w, &display_last_screen[ x + 40 * ( y + row ) ],
+            w * sizeof( libspectrum_dword ) );
+
+  queue_commit();
   slice_no++;
 }
 
-static void
+static int
 movie_start_fmf( const char *name )
 {
   if( ( of = filestream_open( name, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE ) ) == NULL ) {  /* trunc old file ? or append ? */
     ui_error( UI_ERROR_ERROR, "error opening movie file '%s': %s", name,
               strerror( errno ) );
-    return;
+    return 1;
   }
 #ifdef WORDS_BIGENDIAN
   filestream_write( of, "FMF_V1E", (int64_t)( 7 ) * ( 1 ) );	/* write magic header Fuse Movie File */
@@ -334,7 +612,10 @@ movie_start_fmf( const char *name )
   head[6] = stereo;
   head[7] = '\n';	/* padding */
   filestream_write( of, head, (int64_t)( 8 ) * ( 1 ) );		/* write initial params */
+  queue_start();
   movie_add_area( 0, 0, 40, 240 );
+
+  return 0;
 }
 
 void
@@ -344,7 +625,7 @@ movie_start( const char *name )	/* some init, open file (name)*/
   if( name == NULL || *name == '\0' )
     name = "fuse.fmf";			/* fuse movie file */
 
-  movie_start_fmf( name );
+  if( movie_start_fmf( name ) ) return;
   movie_recording = 1;
   ui_menu_activate( UI_MENU_ITEM_FILE_MOVIE_RECORDING, 1 );
   ui_menu_activate( UI_MENU_ITEM_FILE_MOVIE_PAUSE, 1 );
@@ -353,30 +634,22 @@ movie_start( const char *name )	/* some init, open file (name)*/
 void
 movie_stop( void )
 {
+  movie_message *message;
+
   if( !movie_paused && !movie_recording ) return;
 
-  fwrite_compr( "X", 1, 1, of );	/* End of Recording! */
-#ifdef HAVE_ZLIB_H
-  {
-    if( fmf_compr != 0 ) {		/* close zlib */
-      zstream.avail_in = 0;
-      do {
-        zstream.avail_out = ZBUF_SIZE;
-        zstream.next_out = zbuf_o;
-        deflate( &zstream, Z_SYNC_FLUSH );
-        if( zstream.avail_out != ZBUF_SIZE )
-          filestream_write( of, zbuf_o, (int64_t)( ZBUF_SIZE - zstream.avail_out ) * ( 1 ) );
-      } while ( zstream.avail_out != ZBUF_SIZE );
-      deflateEnd( &zstream );
-      fmf_compr = -1;
-    }
-  }
-#endif	/* HAVE_ZLIB_H */
+  message = queue_reserve( 0, 0 );
+  message->head[0] = 'X';		/* End of Recording! */
+  message->head_length = 1;
+  queue_commit();
+
+  message = queue_reserve( 0, 0 );
+  message->type = MOVIE_MESSAGE_STOP;
+  queue_commit();
+
+  queue_end();
+
   format = '?';
-  if( of ) {
-    filestream_close( of );
-    of = NULL;
-  }
 #ifdef MOVIE_DEBUG_PRINT
   filestream_printf( stderr, "Debug movie: saved %d.%d frame(.slice)\n", frame_no, slice_no );
 #endif 	/* MOVIE_DEBUG_PRINT */
@@ -433,20 +706,23 @@ write_alaw( libspectrum_signed_word *buff, int len )
 static void
 add_sound( libspectrum_signed_word *buff, int len )
 {
-  head[0] = 'S';	/* sound frame */
-  head[1] = format;	/* sound format */
-  head[2] = freq & 0xff;
-  head[3] = freq >> 8;
-  head[4] = stereo;
+  movie_message *message;
+  size_t samples = len * ( stereo == 'S' ? 2 : 1 );
+
+  message = queue_reserve( samples * sizeof( *buff ), 0 );
+  message->type = MOVIE_MESSAGE_SOUND;
+  message->format = format;
+  message->head[0] = 'S';	/* sound frame */
+  message->head[1] = format;	/* sound format */
+  message->head[2] = freq & 0xff;
+  message->head[3] = freq >> 8;
+  message->head[4] = stereo;
   len--;		/*len - 1*/
-  head[5] = len & 0xff;
-  head[6] = len >> 8;
-  len++;		/* len :-) */
-  fwrite_compr( head, 7, 1, of );	/* Sound frame */
-  if( format == 'P' )
-    fwrite_compr( buff, len * framesiz , 1, of );	/* write frame */
-  else if( format == 'A' )
-    write_alaw( buff, len * framesiz );
+  message->head[5] = len & 0xff;
+  message->head[6] = len >> 8;
+  message->head_length = 7;
+  memcpy( movie_payload( message ), buff, message->length );
+  queue_commit();
 }
 
 void
@@ -468,17 +744,24 @@ movie_add_sound( libspectrum_signed_word *buff, int len )
 void
 movie_start_frame( void )
 {
+  movie_message *message;
+
   /* $ - ZX$, T - TX$, C - HiCol, R - HiRes */
-  head[0] = 'N';
-  head[1] = settings_current.frame_rate;
-  head[2] = get_screentype();
-  head[3] = get_timing();
-  fwrite_compr( head, 4, 1, of );	/* New frame! */
+  message = queue_reserve( 0, 0 );
+  message->head[0] = 'N';
+  message->head[1] = settings_current.frame_rate;
+  message->head[2] = get_screentype();
+  message->head[3] = get_timing();
+  message->head_length = 4;
+  queue_commit();			/* New frame! */
   frame_no++;
-  if( movie_paused ) {
+  if( movie_paused || movie_resync ) {
     movie_paused = 0;
-    movie_add_area( 0, 0, 40, 240 );
+    movie_resync = 0;
+    movie_add_area( 0, 0, DISPLAY_ASPECT_WIDTH >> 3, DISPLAY_SCREEN_HEIGHT );
   }
+
+  queue_signal();
 }
 
 void
@@ -515,6 +515,34 @@ periph_postcheck( void )
   return needs_hard_reset;
 }
 
+/* Work out whether a peripheral would be (de)activated */
+static void
+get_changed( gpointer key, gpointer value, gpointer user_data )
+{
+  periph_private_t *private = value;
+  int active = 0;
+  int *changed = (int *)user_data;
+
+  switch ( private->present ) {
+  case PERIPH_PRESENT_NEVER: active = 0; break;
+  case PERIPH_PRESENT_OPTIONAL:
+    active = private->periph->option ? *(private->periph->option) : 0; break;
+  case PERIPH_PRESENT_ALWAYS: active = 1; break;
+  }
+
+  if( private->active != active ) *changed = 1;
+}
+
+int
+periph_update_changes( void )
+{
+  int changed = 0;
+
+  g_hash_table_foreach( peripherals, get_changed, &changed );
+
+  return changed;
+}
+
 /* Register debugger page/unpage events for a peripheral */
 void
 periph_register_paging_events( const char *type_string, int *page_event,
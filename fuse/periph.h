@@ -165,6 +165,9 @@ void periph_posthook( void );
 
 int periph_postcheck( void );
 
+/* Would periph_update() (de)activate any peripheral? */
+int periph_update_changes( void );
+
 void periph_disable_optional( void );
 
 /* Register debugger page/unpage events for a peripheral */
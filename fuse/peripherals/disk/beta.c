@@ -252,7 +252,7 @@ static void
 beta_end( void )
 {
   beta_available = 0;
-  libspectrum_free( beta_fdc );
+  wd_fdc_free_fdc( beta_fdc );
 }
 
 void
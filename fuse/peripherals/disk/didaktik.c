@@ -277,7 +277,7 @@ static void
 didaktik80_end( void )
 {
   didaktik80_available = 0;
-  libspectrum_free( didaktik_fdc );
+  wd_fdc_free_fdc( didaktik_fdc );
 }
 
 void
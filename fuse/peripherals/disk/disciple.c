@@ -246,7 +246,7 @@ static void
 disciple_end( void )
 {
   disciple_available = 0;
-  libspectrum_free( disciple_fdc );
+  wd_fdc_free_fdc( disciple_fdc );
 }
 
 void
@@ -31,6 +31,7 @@
 #include "compat.h"
 #include "event.h"
 #include "fdd.h"
+#include "fuse.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
 #include "spectrum.h"
@@ -59,6 +60,13 @@ static const char * const fdd_error[] = {
   "unknown error code"			/* will be the last */
 };
 
+/* If set, mechanical and rotational delays are cut short, see fdd_delay() */
+int fdd_turbo = 0;
+
+/* Shortest delay used in turbo mode, in microseconds. Long enough for the
+   busy state of a command to be seen by software polling the FDC */
+#define FDD_TURBO_DELAY 100
+
 const fdd_params_t fdd_params[] = {
   { 0, 0, 0 },		/* Disabled */
   { 1, 1, 40 },		/* Single-sided 40 track */
@@ -136,11 +144,11 @@ fdd_set_data( fdd_t *d, int fact )
   d->c_bpt = d->disk.track[-3] + 256 * d->disk.track[-2];
   if( fact > 0 ) {
     /* this generate a bpt/fact +-10% triangular distribution skip in bytes 
-       i know, we should use the higher bits of rand(), but we not
+       i know, we should use the higher bits of fuse_rand(), but we not
        keen on _real_ (pseudo)random numbers... ;)
     */
     d->disk.i += d->c_bpt / fact + d->c_bpt *
-		  ( rand() % 10 + rand() % 10 - 9 ) / fact / 100;
+		  ( fuse_rand() % 10 + fuse_rand() % 10 - 9 ) / fact / 100;
     while( d->disk.i >= d->c_bpt )
       d->disk.i -= d->c_bpt;
   }
@@ -194,6 +202,22 @@ fdd_init( fdd_t *d, fdd_type_t type, const fdd_params_t *dt, int reinit )
   return d->status = FDD_OK;
 }
 
+libspectrum_dword
+fdd_delay( fdd_t *d, libspectrum_dword delay )
+{
+  libspectrum_dword turbo_delay;
+
+  /* Weak sectors are used by copy protection schemes, which may well time
+     how long the drive takes too */
+  if( !fdd_turbo || !d || d->disk.have_weak )
+    return delay;
+
+  turbo_delay = FDD_TURBO_DELAY *
+                machine_current->timings.processor_speed / 1000000;
+
+  return delay < turbo_delay ? delay : turbo_delay;
+}
+
 void
 fdd_motoron( fdd_t *d, int on )
 {
@@ -221,8 +245,8 @@ fdd_motoron( fdd_t *d, int on )
   */
   event_remove_type_user_data( motor_event, d );		/* remove pending motor-on event for *this* drive */
   if( on ) {
-    event_add_with_data( tstates + 4 *			/* 2 revolution: 2 * 200 / 1000 */
-			 machine_current->timings.processor_speed / 10,
+    event_add_with_data( tstates + fdd_delay( d, 4 *	/* 2 revolution: 2 * 200 / 1000 */
+			 machine_current->timings.processor_speed / 10 ),
 			 motor_event, d );
     if( d->loaded ) /* index rotating */
       event_add_with_data( tstates + ( d->index_pulse ? 10 : 190 ) *
@@ -402,7 +426,7 @@ fdd_read_write_data( fdd_t *d, fdd_write_t write )
     if( bitmap_test( d->disk.weak, d->disk.i ) ) {
       d->marks |= 0x02;
       /* mess up data byte */
-      d->data &= rand() % 0xff, d->data |= rand() % 0xff;
+      d->data &= fuse_rand() % 0xff, d->data |= fuse_rand() % 0xff;
     }
   }
   d->disk.i++;
@@ -115,6 +115,10 @@ typedef struct fdd_params_t {
 
 extern const fdd_params_t fdd_params[];
 
+/* Non-zero to complete seeks, head loads, spin-ups and sector searches in
+   minimal emulated time */
+extern int fdd_turbo;
+
 void fdd_register_startup( void );
 
 const char *fdd_strerror( int error );
@@ -151,6 +155,10 @@ int fdd_write_data( fdd_t *d );
 void fdd_wrprot( fdd_t *d, int wrprot );
 /* to reach index hole */
 void fdd_wait_index_hole( fdd_t *d );
+/* Return the delay (in tstates) to use for a mechanical or rotational wait
+   of the drive, shortened if turbo mode is on and the disk has no weak
+   sectors */
+libspectrum_dword fdd_delay( fdd_t *d, libspectrum_dword delay );
 /* set floppy position ( upsidedown or not )*/
 void fdd_flip( fdd_t *d, int upsidedown );
 
@@ -178,7 +178,7 @@ static void
 opus_end( void )
 {
   opus_available = 0;
-  libspectrum_free( opus_fdc );
+  wd_fdc_free_fdc( opus_fdc );
 }
 
 void
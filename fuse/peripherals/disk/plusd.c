@@ -207,7 +207,7 @@ static void
 plusd_end( void )
 {
   plusd_available = 0;
-  libspectrum_free( plusd_fdc );
+  wd_fdc_free_fdc( plusd_fdc );
 }
 
 void
@@ -50,6 +50,9 @@ static void wd_fdc_wait_index ( void *fdc );
 
 static int fdc_event, motor_off_event, timeout_event;
 
+/* Every FDC allocated, so that they can all be found for the state hash */
+static wd_fdc *fdc_list = NULL;
+
 void
 wd_fdc_init_events( void )
 {
@@ -122,9 +125,34 @@ wd_fdc_alloc_fdc( wd_type_t type, int hlt_time, unsigned int flags )
   fdc->hlt_time = hlt_time;
   fdc->flags = flags;			/* Beta128 connect HLD out to READY in and MOTOR ON */
   wd_fdc_master_reset( fdc );
+
+  fdc->next = fdc_list;
+  fdc_list = fdc;
+
   return fdc;
 }
 
+void
+wd_fdc_free_fdc( wd_fdc *f )
+{
+  wd_fdc **link;
+
+  for( link = &fdc_list; *link; link = &(*link)->next ) {
+    if( *link == f ) {
+      *link = f->next;
+      break;
+    }
+  }
+
+  libspectrum_free( f );
+}
+
+wd_fdc *
+wd_fdc_first( void )
+{
+  return fdc_list;
+}
+
 void
 wd_fdc_set_intrq( wd_fdc *f )
 {
@@ -413,8 +441,8 @@ wd_fdc_seek_verify_read_id( wd_fdc *f )
         f->id_mark = WD_FDC_AM_NONE;
       i = d->disk.bpt ? ( d->disk.i - i ) * 200 / d->disk.bpt : 200;
       if( i > 0 ) {
-        event_add_with_data( tstates + i *		/* i * 1/20 revolution */
-			   machine_current->timings.processor_speed / 1000,
+        event_add_with_data( tstates + fdd_delay( f->current_drive, i *		/* i * 1/20 revolution */
+			   machine_current->timings.processor_speed / 1000 ),
 			   fdc_event, f );
         return;
       } else if( f->id_mark != WD_FDC_AM_NONE )
@@ -437,8 +465,8 @@ wd_fdc_seek_verify( wd_fdc *f )
   event_remove_type( fdc_event );
   if( f->type == WD1773 || f->type == FD1793 || f->type == WD2797 ) {
     if( !f->hlt ) {
-      event_add_with_data( tstates + 5 * 			/* sample every 5 ms */
-		    machine_current->timings.processor_speed / 1000,
+      event_add_with_data( tstates + fdd_delay( f->current_drive, 5 * 			/* sample every 5 ms */
+		    machine_current->timings.processor_speed / 1000 ),
 			fdc_event, f );
       return;
     }
@@ -500,8 +528,8 @@ type_i_noupdate:
       fdd_step( d, f->direction );
       f->state = WD_FDC_STATE_SEEK_DELAY;
       event_remove_type( fdc_event );
-      event_add_with_data( tstates + f->rates[ b & 0x03 ] *
-			   machine_current->timings.processor_speed / 1000,
+      event_add_with_data( tstates + fdd_delay( f->current_drive, f->rates[ b & 0x03 ] *
+			   machine_current->timings.processor_speed / 1000 ),
 			   fdc_event, f );
       return;
     }
@@ -518,8 +546,8 @@ type_i_verify:
       else
         fdd_head_load( d, 1 );
       event_remove_type( fdc_event );
-      event_add_with_data( tstates + 15 * 				/* 15ms */
-		    machine_current->timings.processor_speed / 1000,
+      event_add_with_data( tstates + fdd_delay( f->current_drive, 15 * 				/* 15ms */
+		    machine_current->timings.processor_speed / 1000 ),
 			fdc_event, f );
     }
 
@@ -530,8 +558,8 @@ type_i_verify:
       f->status_register |= WD_FDC_SR_MOTORON;
       fdd_motoron( f->current_drive, 1 );
       event_remove_type( fdc_event );
-      event_add_with_data( tstates + 12 * 		/* 6 revolution 6 * 200 / 1000 */
-		    machine_current->timings.processor_speed / 10,
+      event_add_with_data( tstates + fdd_delay( f->current_drive, 12 * 		/* 6 revolution 6 * 200 / 1000 */
+		    machine_current->timings.processor_speed / 10 ),
 			fdc_event, f );
       return;
     }
@@ -573,8 +601,8 @@ wd_fdc_type_ii_seek( wd_fdc *f )
       i = d->disk.bpt ?
 	( d->disk.i - i ) * 200 / d->disk.bpt : 200;
       if( i > 0 ) {
-        event_add_with_data( tstates + i *		/* i * 1/20 revolution */
-			     machine_current->timings.processor_speed / 1000,
+        event_add_with_data( tstates + fdd_delay( f->current_drive, i *		/* i * 1/20 revolution */
+			     machine_current->timings.processor_speed / 1000 ),
 			     fdc_event, f );
         return;
       } else if( f->id_mark != WD_FDC_AM_NONE ) {
@@ -654,8 +682,8 @@ wd_fdc_type_ii( wd_fdc *f )
       return;
     }
     if( !f->hlt ) {
-      event_add_with_data( tstates + 5 *
-    		    machine_current->timings.processor_speed / 1000,
+      event_add_with_data( tstates + fdd_delay( f->current_drive, 5 *
+    		    machine_current->timings.processor_speed / 1000 ),
 			fdc_event, f );
       return;
     }
@@ -693,8 +721,8 @@ wd_fdc_type_iii( wd_fdc *f )
       return;
     }
     if( !f->hlt ) {
-      event_add_with_data( tstates + 5 *
-    		    machine_current->timings.processor_speed / 1000,
+      event_add_with_data( tstates + fdd_delay( f->current_drive, 5 *
+    		    machine_current->timings.processor_speed / 1000 ),
 			fdc_event, f );
       return;
     }
@@ -728,8 +756,8 @@ wd_fdc_type_iii( wd_fdc *f )
         i = d->disk.bpt ?
 	    ( d->disk.i - i ) * 200 / d->disk.bpt : 200;
 	if( i > 0 ) {
-          event_add_with_data( tstates + i *		/* i * 1/20 revolution */
-			       machine_current->timings.processor_speed / 1000,
+          event_add_with_data( tstates + fdd_delay( f->current_drive, i *		/* i * 1/20 revolution */
+			       machine_current->timings.processor_speed / 1000 ),
 			       fdc_event, f );
           return;
 	} else if( f->id_mark != WD_FDC_AM_NONE )
@@ -912,8 +940,8 @@ wd_fdc_spinup( wd_fdc *f, libspectrum_byte b )
 
   if( delay ) {
     event_remove_type( fdc_event );
-    event_add_with_data( tstates + delay *
-    		    machine_current->timings.processor_speed / 1000,
+    event_add_with_data( tstates + fdd_delay( f->current_drive, delay *
+    		    machine_current->timings.processor_speed / 1000 ),
 			fdc_event, f );
     return 1;
   }
@@ -1087,8 +1115,8 @@ wd_fdc_dr_read( wd_fdc *f )
 	  event_add_with_data( tstates +	 	/* 5 revolutions: 5 * 200 / 1000 */
 			       machine_current->timings.processor_speed,
 			       timeout_event, f );
-	  event_add_with_data( tstates + 2 * 		/* 20 ms delay */
-			       machine_current->timings.processor_speed / 100,
+	  event_add_with_data( tstates + fdd_delay( f->current_drive, 2 * 		/* 20 ms delay */
+			       machine_current->timings.processor_speed / 100 ),
 			       fdc_event, f );
 	} else {
 	  f->status_register &= ~WD_FDC_SR_BUSY;
@@ -1183,8 +1211,8 @@ wd_fdc_dr_write( wd_fdc *f, libspectrum_byte b )
 	event_add_with_data( tstates +		/* 5 revolutions: 5 * 200 / 1000 */
 			     machine_current->timings.processor_speed,
 			     timeout_event, f );
-	event_add_with_data( tstates + 2 * 		/* 20ms delay */
-			     machine_current->timings.processor_speed / 100,
+	event_add_with_data( tstates + fdd_delay( f->current_drive, 2 * 		/* 20ms delay */
+			     machine_current->timings.processor_speed / 100 ),
 			     fdc_event, f );
       } else {
 	f->status_register &= ~WD_FDC_SR_BUSY;
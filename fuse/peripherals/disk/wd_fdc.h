@@ -143,12 +143,17 @@ typedef struct wd_fdc {
   void ( *set_datarq ) ( struct wd_fdc *f );
   void ( *reset_datarq ) ( struct wd_fdc *f );
 
+  struct wd_fdc *next;		/* Next FDC allocated, see wd_fdc_first() */
+
 } wd_fdc;
 
 void wd_fdc_init_events( void );
 
 /* allocate an fdc */
 wd_fdc *wd_fdc_alloc_fdc( wd_type_t type, int hlt_time, unsigned int flags );
+void wd_fdc_free_fdc( wd_fdc *f );
+/* The FDCs allocated, followed through wd_fdc.next */
+wd_fdc *wd_fdc_first( void );
 void wd_fdc_master_reset( wd_fdc *f );
 
 libspectrum_byte wd_fdc_sr_read( wd_fdc *f );
@@ -35,6 +35,7 @@
 
 #include "compat.h"
 #include "debugger/debugger.h"
+#include "fuse.h"
 #include "if1.h"
 #include "infrastructure/startup_manager.h"
 #include "machine.h"
@@ -1083,8 +1084,8 @@ if1_mdr_new( microdrive_t *mdr )
 
   mdr->filename = NULL;
   if( settings_current.mdr_random_len ) {	/* Random length */
-    len = 171 + ( ( rand() >> 2 ) + ( rand() >> 2 ) +
-                  ( rand() >> 2 ) + ( rand() >> 2 ) )
+    len = 171 + ( ( fuse_rand() >> 2 ) + ( fuse_rand() >> 2 ) +
+                  ( fuse_rand() >> 2 ) + ( fuse_rand() >> 2 ) )
 		  / rnd_factor;
   } else
     len = settings_current.mdr_len = settings_current.mdr_len < 10 ? 10 : 
@@ -243,12 +243,14 @@ libspectrum_byte
 joystick_kempston_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff; /* TODO: check this */
+  ui_input_latch();
   return kempston_value;
 }
 
 libspectrum_byte
 joystick_timex_read( libspectrum_word port GCC_UNUSED, libspectrum_byte which )
 {
+  ui_input_latch();
   return which ? timex2_value : timex1_value;
 }
 
@@ -256,6 +258,7 @@ libspectrum_byte
 joystick_fuller_read( libspectrum_word port GCC_UNUSED, libspectrum_byte *attached )
 {
   *attached = 0xff; /* TODO: check this */
+  ui_input_latch();
   return fuller_value;
 }
 
@@ -43,6 +43,7 @@
 #include "spectrum.h"
 #include "tape.h"
 #include "ula.h"
+#include "ui/ui.h"
 
 static libspectrum_byte last_byte;
 
@@ -188,6 +189,7 @@ ula_read( libspectrum_word port, libspectrum_byte *attached )
 
   r &= phantom_typist_ula_read( port );
 
+  ui_input_latch();
   r &= keyboard_read( port >> 8 );
   if( tape_microphone ) r ^= 0x40;
 
@@ -207,6 +207,7 @@ static phantom_typist_state_t next_phantom_typist_state = PHANTOM_TYPIST_STATE_I
 static int delay = 0;
 static libspectrum_byte keyboard_ports_read = 0x00;
 static int command_count;
+static int booted = 0;
 
 static module_info_t phantom_typist_module_info = {
   phantom_typist_reset,
@@ -237,6 +238,7 @@ phantom_typist_reset( int hard_reset )
 {
   phantom_typist_state = PHANTOM_TYPIST_STATE_INACTIVE;
   next_phantom_typist_state = PHANTOM_TYPIST_STATE_INACTIVE;
+  booted = 0;
 }
 
 static phantom_typist_highlevel_mode_t
@@ -369,6 +371,37 @@ phantom_typist_deactivate( void )
   }
 }
 
+/* The state to move to once the machine has booted and is reading the
+   whole keyboard */
+static phantom_typist_state_t
+first_typing_state( void )
+{
+  switch( phantom_typist_mode ) {
+    case PHANTOM_TYPIST_MODE_JPP:
+    case PHANTOM_TYPIST_MODE_JPPI:
+      return PHANTOM_TYPIST_STATE_LOAD;
+
+    case PHANTOM_TYPIST_MODE_ENTER:
+      return PHANTOM_TYPIST_STATE_ENTER_ONLY;
+
+    case PHANTOM_TYPIST_MODE_DOWN_LOADPPCODE:
+      return PHANTOM_TYPIST_STATE_DOWN;
+
+    case PHANTOM_TYPIST_MODE_WAIT_DOWN_LOADPPCODE:
+      return PHANTOM_TYPIST_STATE_WAIT_DOWN;
+
+    case PHANTOM_TYPIST_MODE_PLUS3_CODE_BLOCK:
+      return PHANTOM_TYPIST_STATE_LONG_WAIT_DOWN;
+
+    case PHANTOM_TYPIST_MODE_LOADPP:
+    case PHANTOM_TYPIST_MODE_LOADPPCODE:
+      return PHANTOM_TYPIST_STATE_LOAD_L;
+
+    default:
+      return PHANTOM_TYPIST_STATE_INACTIVE;
+  }
+}
+
 static void
 process_waiting_state( libspectrum_byte high_byte )
 {
@@ -386,37 +419,7 @@ process_waiting_state( libspectrum_byte high_byte )
   }
 
   if( keyboard_ports_read == 0xff ) {
-    switch( phantom_typist_mode ) {
-      case PHANTOM_TYPIST_MODE_JPP:
-      case PHANTOM_TYPIST_MODE_JPPI:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_LOAD;
-        break;
-
-      case PHANTOM_TYPIST_MODE_ENTER:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_ENTER_ONLY;
-        break;
-
-      case PHANTOM_TYPIST_MODE_DOWN_LOADPPCODE:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_DOWN;
-        break;
-
-      case PHANTOM_TYPIST_MODE_WAIT_DOWN_LOADPPCODE:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_WAIT_DOWN;
-        break;
-
-      case PHANTOM_TYPIST_MODE_PLUS3_CODE_BLOCK:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_LONG_WAIT_DOWN;
-        break;
-
-      case PHANTOM_TYPIST_MODE_LOADPP:
-      case PHANTOM_TYPIST_MODE_LOADPPCODE:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_LOAD_L;
-        break;
-
-      default:
-        next_phantom_typist_state = PHANTOM_TYPIST_STATE_INACTIVE;
-        break;
-    }
+    next_phantom_typist_state = first_typing_state();
   }
 }
 
@@ -529,9 +532,34 @@ phantom_typist_is_active( void )
   return phantom_typist_state != PHANTOM_TYPIST_STATE_INACTIVE;
 }
 
+int
+phantom_typist_is_waiting( void )
+{
+  return phantom_typist_state == PHANTOM_TYPIST_STATE_WAITING &&
+         next_phantom_typist_state == PHANTOM_TYPIST_STATE_WAITING;
+}
+
+int
+phantom_typist_booted( void )
+{
+  return booted;
+}
+
+void
+phantom_typist_skip_wait( void )
+{
+  set_state_waiting();
+  next_phantom_typist_state = first_typing_state();
+  phantom_typist_frame();
+}
+
 void
 phantom_typist_frame( void )
 {
+  booted = phantom_typist_state == PHANTOM_TYPIST_STATE_WAITING &&
+           next_phantom_typist_state != PHANTOM_TYPIST_STATE_WAITING &&
+           next_phantom_typist_state != PHANTOM_TYPIST_STATE_INACTIVE;
+
   keyboard_ports_read = 0x00;
   if( next_phantom_typist_state != phantom_typist_state ) {
     if( phantom_typist_mode == PHANTOM_TYPIST_MODE_PLUS3_CODE_BLOCK &&
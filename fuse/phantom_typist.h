@@ -48,6 +48,21 @@ phantom_typist_ula_read( libspectrum_word port );
 int
 phantom_typist_is_active( void );
 
+/* Returns non-zero if the phantom typist is waiting for the machine to
+   boot before it starts typing */
+int
+phantom_typist_is_waiting( void );
+
+/* Returns non-zero if the machine finished booting in the last frame */
+int
+phantom_typist_booted( void );
+
+/* Start typing straight away, for when the booted machine has been
+   restored from a snapshot taken at the end of the frame in which
+   phantom_typist_booted() became true */
+void
+phantom_typist_skip_wait( void );
+
 /* Called each frame to update the phantom typist state */
 void
 phantom_typist_frame( void );
@@ -32,10 +32,154 @@
 #include "pokefinder.h"
 #include "spectrum.h"
 
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#define POKEFINDER_SIMD_SSE2
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+#include <arm_neon.h>
+#define POKEFINDER_SIMD_NEON
+#endif
+
+#define POKEFINDER_PAGES ( MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES )
+
+/* Bytes tested at once; each block covers two bytes of the bitmap */
+#define POKEFINDER_BLOCK 16
+
 libspectrum_byte pokefinder_possible[ MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES ][ MEMORY_PAGE_SIZE ];
 libspectrum_byte pokefinder_impossible[ MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES ][ MEMORY_PAGE_SIZE / 8 ];
 size_t pokefinder_count;
 
+/* Number of candidates left in each page, so pages with nothing left to
+   find can be skipped entirely */
+static size_t pokefinder_page_count[ POKEFINDER_PAGES ];
+
+typedef enum pokefinder_test_t {
+  POKEFINDER_TEST_SEARCH,
+  POKEFINDER_TEST_INCREMENTED,
+  POKEFINDER_TEST_DECREMENTED,
+} pokefinder_test_t;
+
+static inline int
+pokefinder_popcount( libspectrum_word bits )
+{
+#ifdef __GNUC__
+  return __builtin_popcount( bits );
+#else
+  bits = bits - ( ( bits >> 1 ) & 0x5555 );
+  bits = ( bits & 0x3333 ) + ( ( bits >> 2 ) & 0x3333 );
+  bits = ( bits + ( bits >> 4 ) ) & 0x0f0f;
+  return ( bits + ( bits >> 8 ) ) & 0x1f;
+#endif
+}
+
+/* Test one block of memory, returning a bitmap of the bytes which are no
+   longer candidates. For the incremented and decremented tests, the
+   remembered value of every byte which passes is updated; that includes
+   bytes which were already ruled out, whose remembered value is never
+   looked at again */
+static inline libspectrum_word
+pokefinder_test( pokefinder_test_t test, const libspectrum_byte *memory,
+                 libspectrum_byte *possible, libspectrum_byte value )
+{
+#if defined( POKEFINDER_SIMD_SSE2 )
+  __m128i now = _mm_loadu_si128( ( const __m128i * )memory ), before, fail;
+
+  if( test == POKEFINDER_TEST_SEARCH )
+    return ~_mm_movemask_epi8( _mm_cmpeq_epi8( now,
+                                               _mm_set1_epi8( value ) ) );
+
+  before = _mm_loadu_si128( ( const __m128i * )possible );
+  fail = _mm_cmpeq_epi8( _mm_max_epu8( now, before ),
+                         test == POKEFINDER_TEST_INCREMENTED ? before : now );
+  _mm_storeu_si128( ( __m128i * )possible,
+                    _mm_or_si128( _mm_and_si128( fail, before ),
+                                  _mm_andnot_si128( fail, now ) ) );
+
+  return _mm_movemask_epi8( fail );
+#elif defined( POKEFINDER_SIMD_NEON )
+  static const uint8_t weights[ POKEFINDER_BLOCK ] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+  };
+  uint8x16_t now = vld1q_u8( memory ), fail;
+  uint8x8_t bits;
+
+  if( test == POKEFINDER_TEST_SEARCH ) {
+    fail = vmvnq_u8( vceqq_u8( now, vdupq_n_u8( value ) ) );
+  } else {
+    uint8x16_t before = vld1q_u8( possible );
+
+    fail = test == POKEFINDER_TEST_INCREMENTED ? vcleq_u8( now, before ) :
+                                                 vcgeq_u8( now, before );
+    vst1q_u8( possible, vbslq_u8( fail, before, now ) );
+  }
+
+  /* Gather the top bit of each byte into a 16-bit mask */
+  fail = vandq_u8( fail, vld1q_u8( weights ) );
+  bits = vpadd_u8( vget_low_u8( fail ), vget_high_u8( fail ) );
+  bits = vpadd_u8( bits, bits );
+  bits = vpadd_u8( bits, bits );
+
+  return vget_lane_u8( bits, 0 ) | vget_lane_u8( bits, 1 ) << 8;
+#else
+  libspectrum_word fail = 0;
+  int i;
+
+  for( i = 0; i < POKEFINDER_BLOCK; i++ ) {
+    int passed;
+
+    switch( test ) {
+    case POKEFINDER_TEST_SEARCH:
+      passed = memory[i] == value; break;
+    case POKEFINDER_TEST_INCREMENTED:
+      passed = memory[i] > possible[i]; break;
+    default:
+      passed = memory[i] < possible[i]; break;
+    }
+
+    if( !passed ) {
+      fail |= 1 << i;
+    } else if( test != POKEFINDER_TEST_SEARCH ) {
+      possible[i] = memory[i];
+    }
+  }
+
+  return fail;
+#endif
+}
+
+static inline void
+pokefinder_filter( pokefinder_test_t test, libspectrum_byte value )
+{
+  size_t page, offset;
+
+  for( page = 0; page < POKEFINDER_PAGES; page++ ) {
+    const libspectrum_byte *memory = memory_map_ram[ page ].page;
+    libspectrum_byte *possible = pokefinder_possible[ page ];
+    libspectrum_byte *impossible = pokefinder_impossible[ page ];
+    size_t eliminated = 0;
+
+    if( !pokefinder_page_count[ page ] ) continue;
+
+    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset += POKEFINDER_BLOCK ) {
+      libspectrum_byte *bitmap = &impossible[ offset / 8 ];
+      libspectrum_word before = bitmap[0] | bitmap[1] << 8, after;
+
+      if( before == 0xffff ) continue;
+
+      after = before | pokefinder_test( test, memory + offset,
+                                        possible + offset, value );
+      if( after == before ) continue;
+
+      bitmap[0] = after & 0xff;
+      bitmap[1] = after >> 8;
+      eliminated += pokefinder_popcount( after & ~before );
+    }
+
+    pokefinder_page_count[ page ] -= eliminated;
+    pokefinder_count -= eliminated;
+  }
+}
+
 void
 pokefinder_clear( void )
 {
@@ -46,29 +190,19 @@ pokefinder_clear( void )
   for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; ++page )
     if( page < max_page && memory_map_ram[page].writable ) {
       pokefinder_count += MEMORY_PAGE_SIZE;
+      pokefinder_page_count[page] = MEMORY_PAGE_SIZE;
       memcpy( pokefinder_possible[page], memory_map_ram[page].page, MEMORY_PAGE_SIZE );
       memset( pokefinder_impossible[page], 0, MEMORY_PAGE_SIZE / 8 );
-    } else
+    } else {
+      pokefinder_page_count[page] = 0;
       memset( pokefinder_impossible[page], 255, MEMORY_PAGE_SIZE / 8 );
+    }
 }
 
 int
 pokefinder_search( libspectrum_byte value )
 {
-  size_t page, offset;
-
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
-
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
-
-      if( mapping->page[offset] != value ) {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
-      }
-    }
-  }
+  pokefinder_filter( POKEFINDER_TEST_SEARCH, value );
 
   return 0;
 }
@@ -76,23 +210,7 @@ pokefinder_search( libspectrum_byte value )
 int
 pokefinder_incremented( void )
 {
-  size_t page, offset;
-
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
-
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
-
-      if( mapping->page[offset] > pokefinder_possible[page][offset] ) {
-        pokefinder_possible[page][offset] = mapping->page[offset];
-      } else {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
-      }
-
-    }
-  }
+  pokefinder_filter( POKEFINDER_TEST_INCREMENTED, 0 );
 
   return 0;
 }
@@ -100,23 +218,7 @@ pokefinder_incremented( void )
 int
 pokefinder_decremented( void )
 {
-  size_t page, offset;
-
-  for( page = 0; page < MEMORY_PAGES_IN_16K * SPECTRUM_RAM_PAGES; page++ ) {
-    memory_page *mapping = &memory_map_ram[ page ];
-
-    for( offset = 0; offset < MEMORY_PAGE_SIZE; offset++ ) {
-      if( pokefinder_impossible[page][offset/8] & 1 << (offset & 7) ) continue;
-
-      if( mapping->page[offset] < pokefinder_possible[page][offset] ) {
-        pokefinder_possible[page][offset] = mapping->page[offset];
-      } else {
-	pokefinder_impossible[page][offset/8] |= 1 << (offset & 7);
-	pokefinder_count--;
-      }
-
-    }
-  }
+  pokefinder_filter( POKEFINDER_TEST_DECREMENTED, 0 );
 
   return 0;
 }
@@ -31,22 +31,89 @@
 
 #include "event.h"
 #include "infrastructure/startup_manager.h"
+#include "memory_pages.h"
 #include "module.h"
 #include "profile.h"
 #include "ui/ui.h"
 #include "z80/z80.h"
 
+/* Instructions are identified by memory source, page and the offset into
+   that page rather than by address, so time spent in paged ROMs and RAM
+   banks isn't conflated. They are packed into a key as source (8 bits),
+   page (10 bits) and offset (14 bits) */
+#define PROFILE_KEY( source, page, offset ) \
+  ( ( (libspectrum_dword)(source) << 24 ) | \
+    ( ( (libspectrum_dword)(page) & 0x3ff ) << 14 ) | ( (offset) & 0x3fff ) )
+#define PROFILE_KEY_SOURCE( key ) ( (key) >> 24 )
+#define PROFILE_KEY_PAGE( key ) ( ( (key) >> 14 ) & 0x3ff )
+#define PROFILE_KEY_OFFSET( key ) ( (key) & 0x3fff )
+
+/* The key used for the code running when profiling started */
+#define PROFILE_ROOT 0xffffffff
+
+#define PROFILE_BANK_SIZE 0x4000
+
+/* How deep the call stack is tracked, and the most calling contexts
+   recorded; calls beyond either are treated as part of their caller */
+#define PROFILE_STACK_DEPTH 1024
+#define PROFILE_MAX_NODES 0x100000
+
 int profile_active = 0;
 
-static int total_tstates[ 0x10000 ];
+/* Tstates spent on each instruction in one page of one memory source */
+typedef struct profile_bank_t {
+  libspectrum_dword key;
+  libspectrum_dword tstates[ PROFILE_BANK_SIZE ];
+} profile_bank_t;
+
+/* A node in the calling context tree: one routine reached through one
+   particular chain of calls. Node 0 is the root */
+typedef struct profile_node_t {
+  libspectrum_dword function;	/* Key of the routine's entry point */
+  libspectrum_dword call_site;	/* Key of the instruction which called it */
+  size_t parent, first_child, next_sibling;
+  libspectrum_qword self, inclusive, calls;
+} profile_node_t;
+
+typedef struct profile_stack_entry_t {
+  size_t node;
+  libspectrum_word sp;		/* SP with the return address pushed */
+  libspectrum_qword start;	/* profile_clock on entry */
+} profile_stack_entry_t;
+
+static GHashTable *profile_banks = NULL;
+
+/* The bank and offset for each 2K slot of the current memory map, looked
+   up again whenever the slot's page changes */
+static const libspectrum_byte *profile_slot_page[ MEMORY_PAGES_IN_64K ];
+static profile_bank_t *profile_slot_bank[ MEMORY_PAGES_IN_64K ];
+static libspectrum_word profile_slot_offset[ MEMORY_PAGES_IN_64K ];
+
+static profile_node_t *profile_nodes = NULL;
+static size_t profile_node_count, profile_node_allocated;
+
+static profile_stack_entry_t profile_stack[ PROFILE_STACK_DEPTH ];
+static size_t profile_depth;
+static size_t profile_current;
+
+/* The previous instruction: where its time goes, and the state it was
+   started in, used to spot calls */
+static libspectrum_dword profile_discard;
+static libspectrum_dword *profile_last_counter;
+static libspectrum_dword profile_last_key;
 static libspectrum_word profile_last_pc;
+static libspectrum_word profile_last_sp;
 static libspectrum_dword profile_last_tstates;
 
+/* Total tstates since profiling started */
+static libspectrum_qword profile_clock;
+
+static void profile_reset( int hard_reset GCC_UNUSED );
 static void profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED );
 
 static module_info_t profile_module_info = {
 
-  NULL,
+  profile_reset,
   NULL,
   NULL,
   profile_from_snapshot,
@@ -62,26 +129,86 @@ profile_init( void *context )
   return 0;
 }
 
+static void profile_free( void );
+
 void
 profile_register_startup( void )
 {
   startup_manager_module dependencies[] = { STARTUP_MANAGER_MODULE_SETUID };
   startup_manager_register( STARTUP_MANAGER_MODULE_PROFILE, dependencies,
                             ARRAY_SIZE( dependencies ), profile_init, NULL,
-                            NULL );
+                            profile_free );
 }
 
 static void
 init_profiling_counters( void )
 {
+  profile_last_counter = &profile_discard;
+  profile_last_key = PROFILE_ROOT;
   profile_last_pc = z80.pc.w;
+  profile_last_sp = z80.sp.w;
   profile_last_tstates = tstates;
 }
 
+static void
+free_bank( gpointer key GCC_UNUSED, gpointer value, gpointer user_data GCC_UNUSED )
+{
+  libspectrum_free( value );
+}
+
+static void
+profile_free( void )
+{
+  if( profile_banks ) {
+    g_hash_table_foreach( profile_banks, free_bank, NULL );
+    g_hash_table_destroy( profile_banks );
+    profile_banks = NULL;
+  }
+
+  libspectrum_free( profile_nodes );
+  profile_nodes = NULL;
+}
+
+static size_t
+new_node( size_t parent, libspectrum_dword call_site,
+          libspectrum_dword function )
+{
+  profile_node_t *node;
+
+  if( profile_node_count == profile_node_allocated ) {
+    profile_node_allocated = profile_node_allocated ?
+                             2 * profile_node_allocated : 1024;
+    profile_nodes = libspectrum_renew( profile_node_t, profile_nodes,
+                                       profile_node_allocated );
+  }
+
+  node = &profile_nodes[ profile_node_count ];
+  memset( node, 0, sizeof( *node ) );
+  node->function = function;
+  node->call_site = call_site;
+  node->parent = parent;
+
+  if( profile_node_count ) {
+    node->next_sibling = profile_nodes[ parent ].first_child;
+    profile_nodes[ parent ].first_child = profile_node_count;
+  }
+
+  return profile_node_count++;
+}
+
 void
 profile_start( void )
 {
-  memset( total_tstates, 0, sizeof( total_tstates ) );
+  profile_free();
+
+  profile_banks = g_hash_table_new( NULL, NULL );
+  memset( profile_slot_page, 0, sizeof( profile_slot_page ) );
+
+  profile_node_count = profile_node_allocated = 0;
+  new_node( 0, PROFILE_ROOT, PROFILE_ROOT );
+  profile_depth = 0;
+  profile_current = 0;
+  profile_clock = 0;
 
   profile_active = 1;
   init_profiling_counters();
@@ -94,12 +221,103 @@ profile_start( void )
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 1 );
 }
 
+static void
+fill_slot( size_t slot )
+{
+  const memory_page *page = &memory_map_read[ slot ];
+  libspectrum_dword key = PROFILE_KEY( page->source, page->page_num, 0 );
+  profile_bank_t *bank;
+
+  bank = g_hash_table_lookup( profile_banks, GINT_TO_POINTER( key ) );
+  if( !bank ) {
+    bank = libspectrum_new0( profile_bank_t, 1 );
+    bank->key = key;
+    g_hash_table_insert( profile_banks, GINT_TO_POINTER( key ), bank );
+  }
+
+  profile_slot_page[ slot ] = page->page;
+  profile_slot_bank[ slot ] = bank;
+  profile_slot_offset[ slot ] = page->offset;
+}
+
+static void
+profile_call( libspectrum_dword function, libspectrum_word sp )
+{
+  profile_stack_entry_t *entry;
+  size_t node;
+
+  if( profile_depth == PROFILE_STACK_DEPTH ) return;
+
+  for( node = profile_nodes[ profile_current ].first_child; node;
+       node = profile_nodes[ node ].next_sibling ) {
+    if( profile_nodes[ node ].function == function &&
+        profile_nodes[ node ].call_site == profile_last_key ) break;
+  }
+
+  if( !node ) {
+    if( profile_node_count == PROFILE_MAX_NODES ) return;
+    node = new_node( profile_current, profile_last_key, function );
+  }
+
+  entry = &profile_stack[ profile_depth++ ];
+  entry->node = node;
+  entry->sp = sp;
+  entry->start = profile_clock;
+
+  profile_current = node;
+}
+
+static void
+profile_return( void )
+{
+  profile_stack_entry_t *entry = &profile_stack[ --profile_depth ];
+  profile_node_t *node = &profile_nodes[ entry->node ];
+
+  node->calls++;
+  node->inclusive += profile_clock - entry->start;
+
+  profile_current = profile_depth ?
+                    profile_stack[ profile_depth - 1 ].node : 0;
+}
+
 void
 profile_map( libspectrum_word pc )
 {
-  total_tstates[ profile_last_pc ] += tstates - profile_last_tstates;
+  libspectrum_dword delta = tstates - profile_last_tstates;
+  libspectrum_word sp = z80.sp.w, offset;
+  libspectrum_dword key;
+  size_t slot;
+
+  *profile_last_counter += delta;
+  profile_nodes[ profile_current ].self += delta;
+  profile_clock += delta;
+
+  slot = pc >> MEMORY_PAGE_SIZE_LOGARITHM;
+  if( memory_map_read[ slot ].page != profile_slot_page[ slot ] )
+    fill_slot( slot );
+  offset = profile_slot_offset[ slot ] + ( pc & MEMORY_PAGE_SIZE_MASK );
+  key = profile_slot_bank[ slot ]->key | offset;
+
+  /* A routine has returned once its return address is above the stack
+     pointer, however it got there */
+  while( profile_depth &&
+         (libspectrum_word)( sp - profile_stack[ profile_depth - 1 ].sp - 1 )
+           < 0x7fff )
+    profile_return();
+
+  /* A call (CALL, RST or an interrupt) pushed the address of the
+     instruction following the previous one and jumped elsewhere */
+  if( sp == (libspectrum_word)( profile_last_sp - 2 ) ) {
+    libspectrum_word ret = readbyte_internal( sp ) |
+                           readbyte_internal( sp + 1 ) << 8;
+    libspectrum_word length = ret - profile_last_pc;
+    if( length >= 1 && length <= 4 && pc != ret ) profile_call( key, sp );
+  }
 
-  profile_last_pc = z80.pc.w;
+  profile_last_counter = &profile_slot_bank[ slot ]->tstates[ offset ];
+  profile_last_key = key;
+  profile_last_pc = pc;
+  profile_last_sp = sp;
   profile_last_tstates = tstates;
 }
 
@@ -109,38 +327,277 @@ profile_frame( libspectrum_dword frame_length )
   profile_last_tstates -= frame_length;
 }
 
+/* After a reset or snapshot load the call stack means nothing, so unwind
+   it back to the root */
+static void
+profile_unwind( void )
+{
+  while( profile_depth ) profile_return();
+}
+
+static void
+profile_reset( int hard_reset GCC_UNUSED )
+{
+  if( !profile_active ) return;
+
+  profile_unwind();
+  init_profiling_counters();
+}
+
 /* On snapshot load, PC and the tstate counter will jump so reset our
    current views of these */
 static void
 profile_from_snapshot( libspectrum_snap *snap GCC_UNUSED )
 {
+  if( !profile_active ) return;
+
+  profile_unwind();
   init_profiling_counters();
 }
 
-void
-profile_finish( const char *filename )
+static void
+key_name( char *buffer, size_t length, libspectrum_dword key, int folded )
 {
-  RFILE *f;
-  size_t i;
+  char *p;
 
-  f = filestream_open( filename, RETRO_VFS_FILE_ACCESS_WRITE,
-                    RETRO_VFS_FILE_ACCESS_HINT_NONE );
-  if( !f ) {
-    ui_error( UI_ERROR_ERROR, "unable to open profile map '%s' for writing",
-	      filename );
+  if( key == PROFILE_ROOT ) {
+    snprintf( buffer, length, "(root)" );
     return;
   }
 
-  for( i = 0; i < 0x10000; i++ ) {
+  snprintf( buffer, length, "%s:%lu:0x%04lx",
+            memory_source_description( PROFILE_KEY_SOURCE( key ) ),
+            (unsigned long)PROFILE_KEY_PAGE( key ),
+            (unsigned long)PROFILE_KEY_OFFSET( key ) );
+
+  /* Spaces separate the count in folded stacks */
+  if( folded )
+    for( p = buffer; *p; p++ ) if( *p == ' ' ) *p = '_';
+}
 
-    if( !total_tstates[ i ] ) continue;
+static int
+compare_banks( const void *a, const void *b )
+{
+  libspectrum_dword key_a = (*(const profile_bank_t* const*)a)->key;
+  libspectrum_dword key_b = (*(const profile_bank_t* const*)b)->key;
 
-    filestream_printf( f, "0x%04lx,%d\n", (unsigned long)i, total_tstates[ i ] );
+  return key_a < key_b ? -1 : key_a > key_b;
+}
 
+static void
+collect_bank( gpointer key GCC_UNUSED, gpointer value, gpointer user_data )
+{
+  profile_bank_t ***next = user_data;
+
+  *(*next)++ = value;
+}
+
+static void
+write_flat( RFILE *f )
+{
+  profile_bank_t **banks, **next;
+  size_t i, j, count = g_hash_table_size( profile_banks );
+  char name[64];
+
+  banks = next = libspectrum_new( profile_bank_t*, count ? count : 1 );
+  g_hash_table_foreach( profile_banks, collect_bank, &next );
+  qsort( banks, count, sizeof( *banks ), compare_banks );
+
+  for( i = 0; i < count; i++ ) {
+    for( j = 0; j < PROFILE_BANK_SIZE; j++ ) {
+
+      if( !banks[i]->tstates[ j ] ) continue;
+
+      key_name( name, sizeof( name ), banks[i]->key | j, 0 );
+      filestream_printf( f, "%s,%lu\n", name,
+                         (unsigned long)banks[i]->tstates[ j ] );
+
+    }
+  }
+
+  libspectrum_free( banks );
+}
+
+static void
+write_folded( RFILE *f )
+{
+  size_t *path = libspectrum_new( size_t, PROFILE_STACK_DEPTH + 1 );
+  size_t i, depth, node;
+  char name[64];
+
+  for( i = 0; i < profile_node_count; i++ ) {
+
+    if( !profile_nodes[i].self ) continue;
+
+    depth = 0;
+    for( node = i; node; node = profile_nodes[ node ].parent )
+      path[ depth++ ] = node;
+    path[ depth++ ] = 0;
+
+    while( depth-- ) {
+      key_name( name, sizeof( name ),
+                profile_nodes[ path[ depth ] ].function, 1 );
+      filestream_printf( f, "%s%c", name, depth ? ';' : ' ' );
+    }
+    filestream_printf( f, "%lu\n", (unsigned long)profile_nodes[i].self );
+
+  }
+
+  libspectrum_free( path );
+}
+
+/* Per-routine totals for the callgrind output, merged over all the calling
+   contexts the routine was seen in */
+typedef struct profile_edge_t {
+  libspectrum_dword call_site, callee;
+  libspectrum_qword calls, inclusive;
+  struct profile_edge_t *next;
+} profile_edge_t;
+
+typedef struct profile_function_t {
+  libspectrum_dword key;
+  libspectrum_qword self, inclusive, calls;
+  profile_edge_t *edges;
+} profile_function_t;
+
+static profile_function_t*
+get_function( GHashTable *functions, libspectrum_dword key )
+{
+  profile_function_t *function =
+    g_hash_table_lookup( functions, GINT_TO_POINTER( key ) );
+
+  if( !function ) {
+    function = libspectrum_new0( profile_function_t, 1 );
+    function->key = key;
+    g_hash_table_insert( functions, GINT_TO_POINTER( key ), function );
   }
 
-  filestream_close( f );
+  return function;
+}
+
+static int
+compare_functions( const void *a, const void *b )
+{
+  libspectrum_dword key_a = (*(const profile_function_t* const*)a)->key;
+  libspectrum_dword key_b = (*(const profile_function_t* const*)b)->key;
+
+  return key_a < key_b ? -1 : key_a > key_b;
+}
+
+static void
+collect_function( gpointer key GCC_UNUSED, gpointer value, gpointer user_data )
+{
+  profile_function_t ***next = user_data;
+
+  *(*next)++ = value;
+}
 
+static void
+write_object( RFILE *f, const char *type, libspectrum_dword key )
+{
+  if( key == PROFILE_ROOT ) {
+    filestream_printf( f, "%s=(root)\n", type );
+  } else {
+    filestream_printf( f, "%s=%s:%lu\n", type,
+                       memory_source_description( PROFILE_KEY_SOURCE( key ) ),
+                       (unsigned long)PROFILE_KEY_PAGE( key ) );
+  }
+}
+
+static void
+write_callgrind( RFILE *f )
+{
+  GHashTable *functions = g_hash_table_new( NULL, NULL );
+  profile_function_t **sorted, **next;
+  profile_edge_t *edge;
+  size_t i, count, node;
+  char name[64];
+
+  for( i = 0; i < profile_node_count; i++ ) {
+    profile_node_t *n = &profile_nodes[i];
+    profile_function_t *function = get_function( functions, n->function );
+
+    function->self += n->self;
+    function->calls += n->calls;
+
+    /* Recursive calls are already included in the outermost one */
+    for( node = n->parent; i && node; node = profile_nodes[ node ].parent )
+      if( profile_nodes[ node ].function == n->function ) break;
+    if( !node ) function->inclusive += i ? n->inclusive : profile_clock;
+
+    if( !i ) continue;
+
+    function = get_function( functions, profile_nodes[ n->parent ].function );
+    for( edge = function->edges; edge; edge = edge->next )
+      if( edge->call_site == n->call_site && edge->callee == n->function )
+        break;
+    if( !edge ) {
+      edge = libspectrum_new0( profile_edge_t, 1 );
+      edge->call_site = n->call_site;
+      edge->callee = n->function;
+      edge->next = function->edges;
+      function->edges = edge;
+    }
+    edge->calls += n->calls;
+    edge->inclusive += n->inclusive;
+  }
+
+  count = g_hash_table_size( functions );
+  sorted = next = libspectrum_new( profile_function_t*, count );
+  g_hash_table_foreach( functions, collect_function, &next );
+  qsort( sorted, count, sizeof( *sorted ), compare_functions );
+
+  filestream_printf( f, "# callgrind format\nversion: 1\ncreator: Fuse\n"
+                     "positions: instr\nevents: Tstates\nsummary: %lu\n",
+                     (unsigned long)profile_clock );
+
+  for( i = 0; i < count; i++ ) {
+    profile_function_t *function = sorted[i];
+
+    filestream_printf( f, "\n" );
+    write_object( f, "ob", function->key );
+    key_name( name, sizeof( name ), function->key, 0 );
+    filestream_printf( f, "fn=%s\n0x%04lx %lu\n", name,
+                       (unsigned long)PROFILE_KEY_OFFSET( function->key ),
+                       (unsigned long)function->self );
+
+    for( edge = function->edges; edge; edge = edge->next ) {
+      write_object( f, "cob", edge->callee );
+      key_name( name, sizeof( name ), edge->callee, 0 );
+      filestream_printf( f, "cfn=%s\ncalls=%lu 0x%04lx\n0x%04lx %lu\n", name,
+                         (unsigned long)edge->calls,
+                         (unsigned long)PROFILE_KEY_OFFSET( edge->callee ),
+                         (unsigned long)PROFILE_KEY_OFFSET( edge->call_site ),
+                         (unsigned long)edge->inclusive );
+    }
+  }
+
+  for( i = 0; i < count; i++ ) {
+    while( sorted[i]->edges ) {
+      edge = sorted[i]->edges->next;
+      libspectrum_free( sorted[i]->edges );
+      sorted[i]->edges = edge;
+    }
+    libspectrum_free( sorted[i] );
+  }
+  libspectrum_free( sorted );
+  g_hash_table_destroy( functions );
+}
+
+static int
+has_suffix( const char *string, const char *suffix )
+{
+  size_t length = strlen( string ), suffix_length = strlen( suffix );
+
+  return length >= suffix_length &&
+         !strcmp( string + length - suffix_length, suffix );
+}
+
+/* Stop profiling and throw the data away */
+static void
+profile_stop( void )
+{
+  profile_free();
   profile_active = 0;
 
   /* Again, schedule an event to ensure this change is picked up by
@@ -149,3 +606,46 @@ profile_finish( const char *filename )
 
   ui_menu_activate( UI_MENU_ITEM_MACHINE_PROFILER, 0 );
 }
+
+int
+profile_finish( const char *filename )
+{
+  RFILE *f;
+  const char *basename;
+  int error;
+
+  f = filestream_open( filename, RETRO_VFS_FILE_ACCESS_WRITE,
+                    RETRO_VFS_FILE_ACCESS_HINT_NONE );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "unable to open profile map '%s' for writing",
+	      filename );
+    profile_stop();
+    return 1;
+  }
+
+  /* Account for the routines still running */
+  profile_unwind();
+
+  for( basename = filename + strlen( filename ); basename > filename;
+       basename-- )
+    if( basename[-1] == '/' || basename[-1] == '\\' ) break;
+
+  if( has_suffix( filename, ".folded" ) ) {
+    write_folded( f );
+  } else if( !strncmp( basename, "callgrind.out", 13 ) ||
+             has_suffix( filename, ".callgrind" ) ) {
+    write_callgrind( f );
+  } else {
+    write_flat( f );
+  }
+
+  error = filestream_error( f );
+  if( filestream_close( f ) ) error = 1;
+
+  if( error )
+    ui_error( UI_ERROR_ERROR, "error writing profile map '%s'", filename );
+
+  profile_stop();
+
+  return error;
+}
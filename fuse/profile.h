@@ -30,6 +30,12 @@ void profile_register_startup( void );
 void profile_start( void );
 void profile_map( libspectrum_word pc );
 void profile_frame( libspectrum_dword frame_length );
-void profile_finish( const char *filename );
+/* Writes the profile and stops profiling. The format is chosen from the
+   file name: "*.folded" gives folded stacks for flame graphs,
+   "callgrind.out*" or "*.callgrind" the callgrind format with the call
+   graph, and anything else one "source:page:offset,tstates" line per
+   instruction. Profiling stops even if the file couldn't be written, in
+   which case it returns non-zero */
+int profile_finish( const char *filename );
 
 #endif			/* #ifndef FUSE_PROFILE_H */
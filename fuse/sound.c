@@ -65,6 +65,8 @@ int sound_stereo_ay = SOUND_STEREO_AY_NONE; /* local copy of settings_current.st
 
 int sound_framesiz;
 
+int sound_frame_skip = 0;
+
 static int sound_channels;
 
 static unsigned int ay_tone_levels[16];
@@ -460,6 +462,58 @@ ay_do_tone( int chip, int level, unsigned int tone_count, int *var, int chan )
    master clock by 2 to drive the AY */
 #define AY_CLOCK_RATIO 2
 
+/* Write one of the logged changes into the AY registers */
+static void
+sound_ay_change( int chip, struct ay_change_tag *change )
+{
+  int reg, r;
+
+  sound_ay_registers[ chip ][ reg = change->reg ] = change->val;
+
+  /* fix things as needed for some register changes */
+  switch ( reg ) {
+  case 0: case 1: case 2: case 3: case 4: case 5:
+    r = reg >> 1;
+    /* a zero-len period is the same as 1 */
+    ay_tone_period[ chip ][r] = ( sound_ay_registers[ chip ][ reg & ~1 ] |
+                          ( sound_ay_registers[ chip ][ reg | 1 ] & 15 ) << 8 );
+    if( !ay_tone_period[ chip ][r] )
+      ay_tone_period[ chip ][r]++;
+
+    /* important to get this right, otherwise e.g. Ghouls 'n' Ghosts
+     * has really scratchy, horrible-sounding vibrato.
+     */
+    if( ay_tone_tick[ chip ][r] >= ay_tone_period[ chip ][r] * 2 )
+      ay_tone_tick[ chip ][r] %= ay_tone_period[ chip ][r] * 2;
+    break;
+  case 6:
+    ay_noise_tick[ chip ] = 0;
+    ay_noise_period[ chip ] = ( sound_ay_registers[ chip ][ reg ] & 31 );
+    break;
+  case 11: case 12:
+    ay_env_period[ chip ] =
+      sound_ay_registers[ chip ][11] | ( sound_ay_registers[ chip ][12] << 8 );
+    break;
+  case 13:
+    ay_env_internal_tick[ chip ] = ay_env_tick[ chip ] = ay_env_cycles[ chip ] = 0;
+    ay_env_first[ chip ] = 1;
+    ay_env_rev[ chip ] = 0;
+    ay_env_counter[ chip ] = ( sound_ay_registers[ chip ][13] & AY_ENV_ATTACK ) ? 0 : 15;
+    break;
+  }
+}
+
+/* Keep up with the register writes of a frame which isn't heard, so the
+   AY picks up from the right place */
+static void
+sound_ay_skip( int chip )
+{
+  int i;
+
+  for( i = 0; i < ay_change_count[ chip ]; i++ )
+    sound_ay_change( chip, &ay_change[ chip ][i] );
+}
+
 static void
 sound_ay_overlay( int chip )
 {
@@ -469,7 +523,6 @@ sound_ay_overlay( int chip )
   libspectrum_dword f;
   struct ay_change_tag *change_ptr = ay_change[ chip ];
   int changes_left = ay_change_count[ chip ];
-  int reg, r;
   int chan1, chan2, chan3;
   int last_chan1 = 0, last_chan2 = 0, last_chan3 = 0;
   unsigned int tone_count, noise_count;
@@ -494,41 +547,9 @@ sound_ay_overlay( int chip )
        f+= AY_CLOCK_DIVISOR * AY_CLOCK_RATIO ) {
     /* update ay registers. */
     while( changes_left && f >= change_ptr->tstates ) {
-      sound_ay_registers[ chip ][ reg = change_ptr->reg ] = change_ptr->val;
+      sound_ay_change( chip, change_ptr );
       change_ptr++;
       changes_left--;
-
-      /* fix things as needed for some register changes */
-      switch ( reg ) {
-      case 0: case 1: case 2: case 3: case 4: case 5:
-        r = reg >> 1;
-        /* a zero-len period is the same as 1 */
-        ay_tone_period[ chip ][r] = ( sound_ay_registers[ chip ][ reg & ~1 ] |
-                              ( sound_ay_registers[ chip ][ reg | 1 ] & 15 ) << 8 );
-        if( !ay_tone_period[ chip ][r] )
-          ay_tone_period[ chip ][r]++;
-
-        /* important to get this right, otherwise e.g. Ghouls 'n' Ghosts
-         * has really scratchy, horrible-sounding vibrato.
-         */
-        if( ay_tone_tick[ chip ][r] >= ay_tone_period[ chip ][r] * 2 )
-          ay_tone_tick[ chip ][r] %= ay_tone_period[ chip ][r] * 2;
-        break;
-      case 6:
-        ay_noise_tick[ chip ] = 0;
-        ay_noise_period[ chip ] = ( sound_ay_registers[ chip ][ reg ] & 31 );
-        break;
-      case 11: case 12:
-        ay_env_period[ chip ] =
-          sound_ay_registers[ chip ][11] | ( sound_ay_registers[ chip ][12] << 8 );
-        break;
-      case 13:
-        ay_env_internal_tick[ chip ] = ay_env_tick[ chip ] = ay_env_cycles[ chip ] = 0;
-        ay_env_first[ chip ] = 1;
-        ay_env_rev[ chip ] = 0;
-        ay_env_counter[ chip ] = ( sound_ay_registers[ chip ][13] & AY_ENV_ATTACK ) ? 0 : 15;
-        break;
-      }
     }
 
     /* the tone level if no enveloping is being used */
@@ -745,29 +766,46 @@ sound_frame( void )
   if( !sound_enabled )
     return;
 
-  /* overlay AY sound */
-  sound_ay_overlay( 0 );
-  if( ay_turbosound_enabled )
-    sound_ay_overlay( 1 );
+  if( sound_frame_skip ) {
 
-  blip_buffer_end_frame( left_buf, machine_current->timings.tstates_per_frame );
+    /* Nothing is heard from this frame: the AY isn't synthesised and the
+       beeper's output is thrown away */
+    sound_ay_skip( 0 );
+    if( ay_turbosound_enabled )
+      sound_ay_skip( 1 );
 
-  if( sound_stereo_ay != SOUND_STEREO_AY_NONE ) {
-    blip_buffer_end_frame( right_buf, machine_current->timings.tstates_per_frame );
+    blip_buffer_end_frame( left_buf, machine_current->timings.tstates_per_frame );
+    blip_buffer_remove_samples( left_buf, blip_buffer_samples_avail( left_buf ) );
+
+    if( sound_stereo_ay != SOUND_STEREO_AY_NONE ) {
+      blip_buffer_end_frame( right_buf, machine_current->timings.tstates_per_frame );
+      blip_buffer_remove_samples( right_buf, blip_buffer_samples_avail( right_buf ) );
+    }
+
+    count = 0;
 
-    /* Read left channel into even samples, right channel into odd samples:
-       LRLRLRLRLR... */
-    count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, 1 );
-    blip_buffer_read_samples( right_buf, samples + 1, count, 1 );
-    count <<= 1;
   } else {
-    long i;
-    count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, 1 );
-    for (i = 0; i < count; ++i)
-    {
-      samples[i*2+1] = samples[i*2];
+
+    /* overlay AY sound */
+    sound_ay_overlay( 0 );
+    if( ay_turbosound_enabled )
+      sound_ay_overlay( 1 );
+
+    blip_buffer_end_frame( left_buf, machine_current->timings.tstates_per_frame );
+
+    if( sound_stereo_ay != SOUND_STEREO_AY_NONE ) {
+      blip_buffer_end_frame( right_buf, machine_current->timings.tstates_per_frame );
+
+      /* Read left channel into even samples, right channel into odd samples:
+         LRLRLRLRLR... */
+      count = blip_buffer_read_samples( left_buf, samples, sound_framesiz, 1 );
+      blip_buffer_read_samples( right_buf, samples + 1, count, 1 );
+      count <<= 1;
+    } else {
+      /* Mono: duplicate each sample into both channels as it is read */
+      count = blip_buffer_read_samples_dup( left_buf, samples, sound_framesiz );
+      count <<= 1;
     }
-    count <<= 1;
   }
 
   if( settings_current.sound ) 
@@ -44,6 +44,10 @@ libspectrum_dword sound_get_effective_processor_speed( void );
 extern int sound_enabled;
 extern int sound_framesiz;
 
+/* Set to run the sound hardware for the next frame without producing
+   any output from it */
+extern int sound_frame_skip;
+
 /* Stereo separation types:
  *  * ACB is used in the Melodik interface.
  *  * ABC stereo is used in the Pentagon/Scorpion.
@@ -27,6 +27,14 @@ partially reimplemented in C by Gergely Szasz for FUSE
 
 #include "blipbuffer.h"
 
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#define BLIP_SIMD_SSE2
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+#include <arm_neon.h>
+#define BLIP_SIMD_NEON
+#endif
+
 
 static void _blip_synth_init( Blip_Synth_ * synth_, short *impulses );
 
@@ -560,9 +568,102 @@ _blip_synth_volume_unit( Blip_Synth_ * synth_, double new_unit )
   }
 }
 
-long
-blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * out,
-                          long max_samples, int stereo )
+/* Converts the 32-bit samples produced by the bass filter loop to 16-bit
+   output with the same clamp as the scalar code, either packed (dup == 0)
+   or with every sample written twice to give interleaved stereo
+   (dup != 0). The clamp isn't plain saturation: samples more than 2^24
+   out of range come out slightly below full scale */
+#if defined( BLIP_SIMD_SSE2 )
+static __m128i
+blip_clamp_sse2( __m128i s )
+{
+  __m128i narrow = _mm_srai_epi32( _mm_slli_epi32( s, 16 ), 16 );
+  __m128i fits = _mm_cmpeq_epi32( narrow, s );
+  __m128i clamped = _mm_sub_epi32( _mm_set1_epi32( 0x7FFF ),
+                                   _mm_srai_epi32( s, 24 ) );
+
+  /* Truncate to 16 bits as the scalar cast does, so the pack that
+     follows never saturates */
+  clamped = _mm_srai_epi32( _mm_slli_epi32( clamped, 16 ), 16 );
+
+  return _mm_or_si128( _mm_and_si128( fits, narrow ),
+                       _mm_andnot_si128( fits, clamped ) );
+}
+#elif defined( BLIP_SIMD_NEON )
+static int16x4_t
+blip_clamp_neon( int32x4_t s )
+{
+  int16x4_t narrow = vmovn_s32( s );
+  uint32x4_t fits = vceqq_s32( vmovl_s16( narrow ), s );
+  int32x4_t clamped = vsubq_s32( vdupq_n_s32( 0x7FFF ),
+                                 vshrq_n_s32( s, 24 ) );
+
+  /* vmovn_s32() truncates like the scalar cast */
+  return vmovn_s32( vbslq_s32( fits, s, clamped ) );
+}
+#endif
+
+static void
+blip_buffer_store_samples( const int *in, blip_sample_t *out, int count,
+                           int dup )
+{
+  int n = 0;
+
+#if defined( BLIP_SIMD_SSE2 )
+  for( ; n + 8 <= count; n += 8 ) {
+    __m128i lo =
+      blip_clamp_sse2( _mm_loadu_si128( ( const __m128i * )( in + n ) ) );
+    __m128i hi =
+      blip_clamp_sse2( _mm_loadu_si128( ( const __m128i * )( in + n + 4 ) ) );
+    __m128i s = _mm_packs_epi32( lo, hi );
+
+    if( dup ) {
+      _mm_storeu_si128( ( __m128i * )( out + 2 * n ),
+                        _mm_unpacklo_epi16( s, s ) );
+      _mm_storeu_si128( ( __m128i * )( out + 2 * n + 8 ),
+                        _mm_unpackhi_epi16( s, s ) );
+    } else {
+      _mm_storeu_si128( ( __m128i * )( out + n ), s );
+    }
+  }
+#elif defined( BLIP_SIMD_NEON )
+  for( ; n + 8 <= count; n += 8 ) {
+    int16x8_t s = vcombine_s16( blip_clamp_neon( vld1q_s32( in + n ) ),
+                                blip_clamp_neon( vld1q_s32( in + n + 4 ) ) );
+
+    if( dup ) {
+      int16x8x2_t pair;
+
+      pair.val[0] = s;
+      pair.val[1] = s;
+      vst2q_s16( out + 2 * n, pair );
+    } else {
+      vst1q_s16( out + n, s );
+    }
+  }
+#endif
+
+  for( ; n < count; n++ ) {
+    int s = in[n];
+
+    /* clamp sample */
+    if( ( blip_sample_t ) s != s )
+      s = 0x7FFF - ( s >> 24 );
+
+    if( dup ) {
+      out[2 * n] = out[2 * n + 1] = ( blip_sample_t ) s;
+    } else {
+      out[n] = ( blip_sample_t ) s;
+    }
+  }
+}
+
+/* Number of samples run through the bass filter before each store */
+#define BLIP_READ_CHUNK 64
+
+static long
+blip_buffer_read_samples_( Blip_Buffer * buff, blip_sample_t * out,
+                           long max_samples, int stereo, int dup )
 {
   long count = blip_buffer_samples_avail( buff );
 
@@ -579,18 +680,26 @@ blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * out,
     buf_t_ *in = buff->buffer_;
 
     if( !stereo ) {
-      int n;
-
-      for( n = count; n--; ) {
-        long s = accum >> sample_shift;
-
-        accum -= accum >> my_bass_shift;
-        accum += *in++;
-        *out++ = ( blip_sample_t ) s;
-
-        /* clamp sample */
-        if( ( blip_sample_t ) s != s )
-          out[-1] = ( blip_sample_t ) ( 0x7FFF - ( s >> 24 ) );
+      /* The high-pass filter is a recurrence, so it has to run one sample
+         at a time; the clamp and the (optionally duplicating) store do not,
+         and are done a chunk at a time. accum always fits in 32 bits, as
+         buf_t_ was a 32-bit type in the original Blip_Buffer. */
+      int chunk[ BLIP_READ_CHUNK ];
+      long left = count;
+
+      while( left ) {
+        int n, todo = left > BLIP_READ_CHUNK ? BLIP_READ_CHUNK : left;
+
+        for( n = 0; n < todo; n++ ) {
+          chunk[n] = ( int )( accum >> sample_shift );
+
+          accum -= accum >> my_bass_shift;
+          accum += *in++;
+        }
+
+        blip_buffer_store_samples( chunk, out, todo, dup );
+        out += dup ? 2 * todo : todo;
+        left -= todo;
       }
     } else {
       int n;
@@ -615,3 +724,17 @@ blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * out,
 
   return count;
 }
+
+long
+blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * out,
+                          long max_samples, int stereo )
+{
+  return blip_buffer_read_samples_( buff, out, max_samples, stereo, 0 );
+}
+
+long
+blip_buffer_read_samples_dup( Blip_Buffer * buff, blip_sample_t * out,
+                              long max_samples )
+{
+  return blip_buffer_read_samples_( buff, out, max_samples, 0, 1 );
+}
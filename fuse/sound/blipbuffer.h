@@ -100,6 +100,13 @@ void blip_buffer_end_frame( Blip_Buffer * buff, blip_time_t time );
 long blip_buffer_read_samples( Blip_Buffer * buff, blip_sample_t * dest,
                                long max_samples, int stereo );
 
+/*  Read at most 'max_samples' out of a mono buffer into 'dest', writing each
+ sample twice so that 'dest' receives 2 * (returned count) interleaved stereo
+ samples with identical left and right channels.
+*/
+long blip_buffer_read_samples_dup( Blip_Buffer * buff, blip_sample_t * dest,
+                                   long max_samples );
+
 /*  Additional optional features */
 
 /*  Set frequency high-pass filter frequency, where higher values reduce bass more */
@@ -45,6 +45,7 @@
 #include "sound.h"
 #include "spectrum.h"
 #include "tape.h"
+#include "trace.h"
 #include "timer/timer.h"
 #include "ui/ui.h"
 #include "ui/uijoystick.h"
@@ -160,6 +161,7 @@ spectrum_frame( void )
 
   if( display_frame() ) return 1;
   if( profile_active ) profile_frame( frame_length );
+  if( trace_active ) trace_frame( frame_length );
   printer_frame();
 
   /* Add an interrupt unless they're being generated by .rzx playback */
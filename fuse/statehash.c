@@ -0,0 +1,294 @@
+/* statehash.c: Per-frame digest of the machine state
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Two copies of the emulator given the same input should reach the same
+   state on every frame, so comparing these digests between them shows the
+   first frame and the part of the machine where they diverged without
+   having to compare whole snapshots.
+
+   Nothing else has to tell this code when RAM changes, as much of Fuse and
+   the frontend write RAM[] directly. Instead each 2K chunk is compared
+   with a copy taken at the previous digest and only the chunks which
+   differ are hashed again */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "machine.h"
+#include "memory_pages.h"
+#include "peripherals/disk/upd_fdc.h"
+#include "peripherals/disk/wd_fdc.h"
+#include "spectrum.h"
+#include "statehash.h"
+#include "tape.h"
+#include "z80/z80.h"
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+#define RAM_CHUNKS ( SPECTRUM_RAM_PAGES * MEMORY_PAGES_IN_16K )
+
+extern upd_fdc *specplus3_fdc;
+
+static const char * const part_names[ STATE_HASH_PARTS ] = {
+  "CPU", "paging", "AY", "FDC", "tape", "RAM",
+};
+
+/* RAM as it was at the previous digest and the hash of each chunk; only
+   the first ram_copy_chunks chunks of the copy are valid */
+static libspectrum_byte *ram_copy = NULL;
+static size_t ram_copy_chunks;
+static libspectrum_qword ram_chunk_hash[ RAM_CHUNKS ];
+
+static libspectrum_qword
+hash_word( libspectrum_qword hash, libspectrum_qword word )
+{
+  hash = ( hash ^ word ) * 0x100000001b3ULL;
+  return hash ^ ( hash >> 29 );
+}
+
+static libspectrum_qword
+pack( libspectrum_word a, libspectrum_word b, libspectrum_word c,
+      libspectrum_word d )
+{
+  return (libspectrum_qword)a << 48 | (libspectrum_qword)b << 32 |
+         (libspectrum_qword)c << 16 | d;
+}
+
+/* A chunk at a time as whole little endian words, so the result is the
+   same on every host */
+static libspectrum_qword
+hash_chunk( const libspectrum_byte *data )
+{
+  libspectrum_qword hash = HASH_SEED;
+  size_t i;
+
+  for( i = 0; i < MEMORY_PAGE_SIZE; i += 8, data += 8 )
+    hash = hash_word( hash,
+                      pack( data[7] << 8 | data[6], data[5] << 8 | data[4],
+                            data[3] << 8 | data[2], data[1] << 8 | data[0] ) );
+
+  return hash;
+}
+
+static libspectrum_qword
+hash_cpu( void )
+{
+  libspectrum_qword hash = HASH_SEED;
+
+  hash = hash_word( hash, pack( z80.af.w, z80.bc.w, z80.de.w, z80.hl.w ) );
+  hash = hash_word( hash, pack( z80.af_.w, z80.bc_.w, z80.de_.w, z80.hl_.w ) );
+  hash = hash_word( hash, pack( z80.ix.w, z80.iy.w, z80.sp.w, z80.pc.w ) );
+
+  /* Only the R register itself; the rest of z80.r counts instructions */
+  hash = hash_word( hash, pack( z80.memptr.w, z80.i,
+                                ( z80.r & 0x7f ) | ( z80.r7 & 0x80 ), z80.q ) );
+  hash = hash_word( hash, pack( z80.iff1, z80.iff2, z80.im, z80.halted ) );
+  hash = hash_word( hash, pack( z80.iff2_read, 0,
+                                z80.interrupts_enabled_at >> 16,
+                                z80.interrupts_enabled_at ) );
+
+  return hash_word( hash, tstates );
+}
+
+static libspectrum_qword
+hash_memory_page( libspectrum_qword hash, const memory_page *page )
+{
+  return hash_word( hash, pack( page->source, page->page_num, page->offset,
+                                page->writable << 1 | page->contended ) );
+}
+
+static libspectrum_qword
+hash_paging( void )
+{
+  libspectrum_qword hash = HASH_SEED;
+  spectrum_raminfo *ram = &machine_current->ram;
+  size_t i;
+
+  for( i = 0; i < MEMORY_PAGES_IN_64K; i++ ) {
+    hash = hash_memory_page( hash, &memory_map_read[i] );
+    hash = hash_memory_page( hash, &memory_map_write[i] );
+  }
+
+  hash = hash_word( hash, pack( ram->last_byte, ram->last_byte2,
+                                ram->current_page, ram->current_rom ) );
+  return hash_word( hash, pack( ram->locked, ram->special, ram->romcs,
+                                memory_current_screen ) );
+}
+
+static libspectrum_qword
+hash_ay( libspectrum_qword hash, const ayinfo *ay )
+{
+  size_t i;
+
+  for( i = 0; i < AY_REGISTERS; i += 4 )
+    hash = hash_word( hash, pack( ay->registers[i], ay->registers[i + 1],
+                                  ay->registers[i + 2],
+                                  ay->registers[i + 3] ) );
+
+  return hash_word( hash, ay->current_register );
+}
+
+static libspectrum_qword
+hash_fdc( void )
+{
+  libspectrum_qword hash = HASH_SEED;
+  const wd_fdc *wd;
+  const upd_fdc *upd = specplus3_fdc;
+  size_t i;
+
+  for( wd = wd_fdc_first(); wd; wd = wd->next ) {
+    hash = hash_word( hash, pack( wd->state, wd->status_type, wd->id_mark,
+                                  wd->direction ) );
+    hash = hash_word( hash, pack( wd->command_register, wd->status_register,
+                                  wd->track_register,
+                                  wd->sector_register ) );
+    hash = hash_word( hash, pack( wd->data_register, wd->intrq, wd->datarq,
+                                  wd->head_load ) );
+    hash = hash_word( hash, pack( wd->id_track, wd->id_head, wd->id_sector,
+                                  wd->id_length ) );
+    hash = hash_word( hash, pack( wd->data_offset, wd->data_multisector,
+                                  wd->rev, wd->crc ) );
+  }
+
+  if( upd &&
+      ( machine_current->capabilities &
+        LIBSPECTRUM_MACHINE_CAPABILITY_PLUS3_DISK ) ) {
+    hash = hash_word( hash, pack( upd->state, upd->main_status,
+                                  upd->command_register, upd->cycle ) );
+    hash = hash_word( hash, pack( upd->intrq, upd->datarq, upd->us,
+                                  upd->hd ) );
+    hash = hash_word( hash, pack( upd->data_offset, upd->rev, upd->crc,
+                                  upd->head_load ) );
+    for( i = 0; i < 4; i++ )
+      hash = hash_word( hash, pack( upd->pcn[i], upd->ncn[i], upd->seek[i],
+                                    upd->status_register[i] ) );
+    for( i = 0; i < 9; i++ )
+      hash = hash_word( hash, upd->data_register[i] );
+  }
+
+  return hash;
+}
+
+static void
+hash_tape_edge( gpointer data, gpointer user_data )
+{
+  const event_t *event = data;
+  libspectrum_qword *hash = user_data;
+
+  if( event->type == tape_edge_event )
+    *hash = hash_word( *hash, event->tstates );
+}
+
+/* Where the tape is to the block, and within the block by when the next
+   edge is due */
+static libspectrum_qword
+hash_tape( void )
+{
+  libspectrum_qword hash = HASH_SEED;
+
+  hash = hash_word( hash, pack( tape_present(), tape_playing,
+                                tape_microphone,
+                                tape_get_current_block() ) );
+  event_foreach( hash_tape_edge, &hash );
+
+  return hash;
+}
+
+/* The pages a machine uses aren't always the first valid_pages of them,
+   the 48K has 0, 2 and 5, so always take at least the 128K's eight */
+static libspectrum_qword
+hash_ram( state_hash_t *hash )
+{
+  libspectrum_qword ram_hash = HASH_SEED;
+  int pages = machine_current->ram.valid_pages;
+  size_t chunks, i;
+  int page;
+
+  if( pages < 8 ) pages = 8;
+  if( pages > SPECTRUM_RAM_PAGES ) pages = SPECTRUM_RAM_PAGES;
+  chunks = pages * MEMORY_PAGES_IN_16K;
+
+  if( !ram_copy ) {
+    ram_copy = libspectrum_new( libspectrum_byte, RAM_CHUNKS * MEMORY_PAGE_SIZE );
+    ram_copy_chunks = 0;
+  }
+
+  for( i = 0; i < chunks; i++ ) {
+    const libspectrum_byte *data = memory_map_ram[i].page;
+    libspectrum_byte *copy = ram_copy + i * MEMORY_PAGE_SIZE;
+
+    if( i >= ram_copy_chunks || memcmp( data, copy, MEMORY_PAGE_SIZE ) ) {
+      memcpy( copy, data, MEMORY_PAGE_SIZE );
+      ram_chunk_hash[i] = hash_chunk( data );
+    }
+  }
+
+  if( chunks > ram_copy_chunks ) ram_copy_chunks = chunks;
+
+  for( page = 0; page < pages; page++ ) {
+    libspectrum_qword page_hash = HASH_SEED;
+
+    for( i = 0; i < MEMORY_PAGES_IN_16K; i++ )
+      page_hash = hash_word( page_hash,
+                             ram_chunk_hash[ page * MEMORY_PAGES_IN_16K + i ] );
+
+    hash->ram_pages[ page ] = page_hash;
+    ram_hash = hash_word( ram_hash, page_hash );
+  }
+
+  hash->ram_page_count = pages;
+
+  return ram_hash;
+}
+
+const char *
+state_hash_part_name( state_hash_part part )
+{
+  return part < STATE_HASH_PARTS ? part_names[ part ] : "?";
+}
+
+void
+state_hash_compute( state_hash_t *hash )
+{
+  size_t i;
+
+  hash->parts[ STATE_HASH_CPU ] = hash_cpu();
+  hash->parts[ STATE_HASH_PAGING ] = hash_paging();
+  hash->parts[ STATE_HASH_AY ] =
+    hash_ay( hash_ay( HASH_SEED, &machine_current->ay ),
+             &machine_current->ay2 );
+  hash->parts[ STATE_HASH_FDC ] = hash_fdc();
+  hash->parts[ STATE_HASH_TAPE ] = hash_tape();
+  hash->parts[ STATE_HASH_RAM ] = hash_ram( hash );
+
+  hash->total = HASH_SEED;
+  for( i = 0; i < STATE_HASH_PARTS; i++ )
+    hash->total = hash_word( hash->total, hash->parts[i] );
+}
+
+void
+state_hash_end( void )
+{
+  libspectrum_free( ram_copy );
+  ram_copy = NULL;
+  ram_copy_chunks = 0;
+}
@@ -0,0 +1,58 @@
+/* statehash.h: Per-frame digest of the machine state
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_STATEHASH_H
+#define FUSE_STATEHASH_H
+
+#include <libspectrum.h>
+
+#include "memory_pages.h"
+
+/* The parts of the state which are hashed separately, so that when two
+   digests differ the part which diverged can be named */
+typedef enum state_hash_part {
+  STATE_HASH_CPU = 0,		/* Registers and tstates */
+  STATE_HASH_PAGING,		/* Memory map and paging ports */
+  STATE_HASH_AY,		/* Registers of both AY chips */
+  STATE_HASH_FDC,		/* Every floppy disk controller */
+  STATE_HASH_TAPE,		/* Position and the next edge */
+  STATE_HASH_RAM,		/* All of ram_pages[] */
+
+  STATE_HASH_PARTS		/* End marker; do not remove */
+} state_hash_part;
+
+typedef struct state_hash_t {
+
+  libspectrum_qword total;	/* Of all the parts */
+  libspectrum_qword parts[ STATE_HASH_PARTS ];
+
+  /* One hash for each 16K RAM page, of which there are ram_page_count */
+  libspectrum_qword ram_pages[ SPECTRUM_RAM_PAGES ];
+  int ram_page_count;
+
+} state_hash_t;
+
+const char *state_hash_part_name( state_hash_part part );
+
+/* RAM is hashed in 2K chunks and only the chunks changed since the
+   previous digest are hashed again. state_hash_end() frees the copy of
+   RAM kept to find those */
+void state_hash_compute( state_hash_t *hash );
+void state_hash_end( void );
+
+#endif			/* #ifndef FUSE_STATEHASH_H */
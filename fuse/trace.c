@@ -0,0 +1,462 @@
+/* trace.c: Z80 execution trace recorder
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#include <config.h>
+#include <streams/file_stream.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "event.h"
+#include "infrastructure/startup_manager.h"
+#include "memory_pages.h"
+#include "module.h"
+#include "trace.h"
+#include "ui/ui.h"
+#include "z80/z80.h"
+
+/* The longest record: header, absolute PC and tstates, a remapped slot
+   and four opcode bytes. A new block is started unless there is room for
+   one of these plus the end of block marker */
+#define TRACE_RECORD_MAX ( 1 + 2 + 4 + 4 + 4 )
+
+#if TRACE_SLOTS != MEMORY_PAGES_IN_64K
+#error "TRACE_SLOTS must match the number of memory pages in 64K"
+#endif
+
+int trace_active = 0;
+
+/* The ring of blocks; each starts with a header giving the decoder state,
+   so once the ring has wrapped the oldest block can be dropped whole */
+static libspectrum_byte *trace_buffer = NULL;
+static libspectrum_dword *trace_block_length = NULL;
+static size_t trace_blocks, trace_blocks_used, trace_block_current;
+
+static libspectrum_byte *trace_next, *trace_limit;
+
+/* The decoder state at trace_next */
+static libspectrum_word trace_next_pc;
+static libspectrum_dword trace_last_tstates;
+static libspectrum_dword trace_frame_count;
+static const libspectrum_byte *trace_map[ TRACE_SLOTS ];
+static libspectrum_byte trace_map_info[ TRACE_SLOTS ][ 3 ];
+static int trace_max_source;
+
+/* Set when PC and tstates have jumped (reset, snapshot load), so the next
+   record is written with absolute values */
+static int trace_resync;
+
+/* Instruction lengths for the unprefixed opcodes, without and with a
+   DD/FD prefix, as the core steps through them */
+static libspectrum_byte opcode_length[ 0x100 ];
+static libspectrum_byte indexed_length[ 0x100 ];
+
+static void trace_reset( int hard_reset GCC_UNUSED );
+static void trace_from_snapshot( libspectrum_snap *snap GCC_UNUSED );
+
+static module_info_t trace_module_info = {
+
+  trace_reset,
+  NULL,
+  NULL,
+  trace_from_snapshot,
+  NULL,
+
+};
+
+static int
+unprefixed_length( libspectrum_byte opcode )
+{
+  int y = ( opcode >> 3 ) & 0x07, z = opcode & 0x07;
+
+  switch( opcode >> 6 ) {
+
+  case 0:
+    switch( z ) {
+    case 0: return y >= 2 ? 2 : 1;		/* DJNZ, JR */
+    case 1: return y & 0x01 ? 1 : 3;		/* LD rr,nn */
+    case 2: return y >= 4 ? 3 : 1;		/* LD (nn),HL etc */
+    case 6: return 2;				/* LD r,n */
+    }
+    return 1;
+
+  case 3:
+    switch( z ) {
+    case 2: case 4: return 3;			/* JP cc,nn; CALL cc,nn */
+    case 3: return y == 0 ? 3 : y <= 3 ? 2 : 1;	/* JP nn; CB; OUT/IN (n) */
+    case 5: return y == 1 ? 3 : 1;		/* CALL nn */
+    case 6: return 2;				/* ALU n */
+    }
+    return 1;
+
+  }
+
+  return 1;
+}
+
+/* The opcodes z80_ddfd.c handles; after a DD or FD prefix anything else
+   executes the prefix on its own and then the opcode unprefixed */
+static int
+uses_index_register( libspectrum_byte opcode )
+{
+  int y = ( opcode >> 3 ) & 0x07, z = opcode & 0x07;
+
+  switch( opcode >> 6 ) {
+
+  case 0:
+    switch( opcode ) {
+    case 0x09: case 0x19: case 0x29: case 0x39:
+    case 0x21: case 0x22: case 0x2a: case 0x23: case 0x2b:
+    case 0x24: case 0x25: case 0x26: case 0x2c: case 0x2d: case 0x2e:
+    case 0x34: case 0x35: case 0x36:
+      return 1;
+    }
+    return 0;
+
+  case 1:
+    if( opcode == 0x76 ) return 0;
+    return ( y >= 4 && y <= 6 ) || ( z >= 4 && z <= 6 );
+
+  case 2:
+    return z >= 4 && z <= 6;
+
+  }
+
+  return opcode == 0xe1 || opcode == 0xe3 || opcode == 0xe5 ||
+         opcode == 0xe9 || opcode == 0xf9;
+}
+
+static int
+uses_hl_indirect( libspectrum_byte opcode )
+{
+  if( opcode == 0x34 || opcode == 0x35 || opcode == 0x36 ) return 1;
+  if( opcode < 0x40 || opcode >= 0xc0 || opcode == 0x76 ) return 0;
+  if( ( opcode & 0x07 ) == 0x06 ) return 1;
+  return opcode >= 0x70 && opcode < 0x78;
+}
+
+static int
+trace_init( void *context )
+{
+  size_t i;
+
+  for( i = 0; i < 0x100; i++ ) {
+    opcode_length[ i ] = unprefixed_length( i );
+    indexed_length[ i ] = uses_index_register( i ) ?
+                          1 + opcode_length[ i ] + uses_hl_indirect( i ) : 1;
+  }
+
+  module_register( &trace_module_info );
+
+  return 0;
+}
+
+static void
+trace_end( void )
+{
+  free( trace_buffer ); trace_buffer = NULL;
+  free( trace_block_length ); trace_block_length = NULL;
+  trace_active = 0;
+}
+
+void
+trace_register_startup( void )
+{
+  startup_manager_module dependencies[] = { STARTUP_MANAGER_MODULE_SETUID };
+  startup_manager_register( STARTUP_MANAGER_MODULE_TRACE, dependencies,
+                            ARRAY_SIZE( dependencies ), trace_init, NULL,
+                            trace_end );
+}
+
+static size_t
+trace_opcode_length( libspectrum_word pc )
+{
+  libspectrum_byte opcode = readbyte_internal( pc );
+
+  switch( opcode ) {
+
+  case 0xcb:
+    return 2;
+
+  case 0xed:
+    /* LD (nn),rr and LD rr,(nn) */
+    return ( readbyte_internal( pc + 1 ) & 0xc7 ) == 0x43 ? 4 : 2;
+
+  case 0xdd: case 0xfd:
+    opcode = readbyte_internal( pc + 1 );
+    return opcode == 0xcb ? 4 : indexed_length[ opcode ];
+
+  }
+
+  return opcode_length[ opcode ];
+}
+
+static libspectrum_byte*
+write_dword( libspectrum_byte *p, libspectrum_dword value )
+{
+  *p++ = value & 0xff; *p++ = ( value >> 8 ) & 0xff;
+  *p++ = ( value >> 16 ) & 0xff; *p++ = value >> 24;
+  return p;
+}
+
+static void
+trace_open_block( void )
+{
+  libspectrum_byte *p;
+
+  if( trace_blocks_used ) {
+    *trace_next++ = TRACE_RECORD_END;
+    trace_block_length[ trace_block_current ] =
+      trace_next - trace_buffer - trace_block_current * TRACE_BLOCK_SIZE;
+    trace_block_current = ( trace_block_current + 1 ) % trace_blocks;
+  }
+  if( trace_blocks_used < trace_blocks ) trace_blocks_used++;
+
+  p = trace_buffer + trace_block_current * TRACE_BLOCK_SIZE;
+  p = write_dword( p, trace_frame_count );
+  p = write_dword( p, trace_last_tstates );
+  *p++ = trace_next_pc & 0xff; *p++ = trace_next_pc >> 8;
+  memcpy( p, trace_map_info, sizeof( trace_map_info ) );
+  p += sizeof( trace_map_info );
+
+  trace_next = p;
+  trace_limit =
+    trace_buffer + ( trace_block_current + 1 ) * TRACE_BLOCK_SIZE -
+    TRACE_RECORD_MAX - 1;
+  trace_block_length[ trace_block_current ] = 0;
+}
+
+int
+trace_start( size_t buffer_size )
+{
+  size_t blocks = buffer_size / TRACE_BLOCK_SIZE;
+
+  if( blocks < 2 ) blocks = 2;
+
+  trace_stop();
+
+  trace_buffer = malloc( blocks * TRACE_BLOCK_SIZE );
+  trace_block_length = malloc( blocks * sizeof( *trace_block_length ) );
+  if( !trace_buffer || !trace_block_length ) {
+    free( trace_buffer ); trace_buffer = NULL;
+    free( trace_block_length ); trace_block_length = NULL;
+    ui_error( UI_ERROR_ERROR, "out of memory for a %lu byte trace buffer",
+              (unsigned long)buffer_size );
+    return 1;
+  }
+
+  trace_blocks = blocks;
+  trace_blocks_used = 0;
+  trace_block_current = 0;
+
+  trace_frame_count = 0;
+  trace_last_tstates = tstates;
+  trace_next_pc = z80.pc.w;
+  memset( trace_map, 0, sizeof( trace_map ) );
+  memset( trace_map_info, 0xff, sizeof( trace_map_info ) );
+  trace_max_source = -1;
+  trace_resync = 1;
+
+  trace_open_block();
+
+  trace_active = 1;
+
+  /* As for the profiler, make sure the main z80 emulation loop recognises
+     tracing is turned on */
+  event_add( tstates, event_type_null );
+
+  return 0;
+}
+
+void
+trace_record( libspectrum_word pc )
+{
+  libspectrum_byte *header, *p;
+  libspectrum_dword delta;
+  size_t length, slot, i;
+  const memory_page *page;
+  int flags;
+
+  if( trace_next > trace_limit ) trace_open_block();
+
+  header = trace_next;
+  p = header + 1;
+
+  length = trace_opcode_length( pc );
+  flags = length;
+
+  if( trace_resync ) {
+    *p++ = pc & 0xff; *p++ = pc >> 8;
+    flags |= TRACE_FIELD_ABSOLUTE << TRACE_PC_SHIFT;
+  } else if( pc != trace_next_pc ) {
+    int offset = (libspectrum_signed_word)( pc - trace_next_pc );
+    if( offset >= -128 && offset <= 127 ) {
+      *p++ = offset & 0xff;
+      flags |= TRACE_FIELD_MEDIUM << TRACE_PC_SHIFT;
+    } else {
+      *p++ = pc & 0xff; *p++ = pc >> 8;
+      flags |= TRACE_FIELD_ABSOLUTE << TRACE_PC_SHIFT;
+    }
+  }
+
+  delta = tstates - trace_last_tstates;
+  if( trace_resync || delta > 0xffff ) {
+    p = write_dword( p, tstates );
+    flags |= TRACE_FIELD_ABSOLUTE << TRACE_TSTATES_SHIFT;
+  } else if( delta > 0xff ) {
+    *p++ = delta & 0xff; *p++ = delta >> 8;
+    flags |= TRACE_FIELD_MEDIUM << TRACE_TSTATES_SHIFT;
+  } else {
+    *p++ = delta;
+  }
+
+  /* Only the slot the code is running from is checked, which is enough to
+     say which ROM or RAM page each instruction came from */
+  slot = pc >> MEMORY_PAGE_SIZE_LOGARITHM;
+  page = &memory_map_read[ slot ];
+  if( page->page != trace_map[ slot ] ) {
+    trace_map[ slot ] = page->page;
+    trace_map_info[ slot ][ 0 ] = page->source;
+    trace_map_info[ slot ][ 1 ] = page->page_num;
+    trace_map_info[ slot ][ 2 ] = page->offset >> MEMORY_PAGE_SIZE_LOGARITHM;
+    if( page->source > trace_max_source ) trace_max_source = page->source;
+    *p++ = slot;
+    memcpy( p, trace_map_info[ slot ], 3 ); p += 3;
+    flags |= TRACE_PAGING;
+  }
+
+  for( i = 0; i < length; i++ ) *p++ = readbyte_internal( pc + i );
+
+  *header = flags;
+  trace_next = p;
+  trace_next_pc = pc + length;
+  trace_last_tstates = tstates;
+  trace_resync = 0;
+}
+
+void
+trace_frame( libspectrum_dword frame_length )
+{
+  if( trace_next > trace_limit ) trace_open_block();
+
+  *trace_next++ = TRACE_RECORD_FRAME;
+  trace_next = write_dword( trace_next, frame_length );
+
+  trace_last_tstates -= frame_length;
+  trace_frame_count++;
+}
+
+static void
+trace_reset( int hard_reset GCC_UNUSED )
+{
+  trace_resync = 1;
+}
+
+/* On snapshot load, PC and the tstate counter will jump */
+static void
+trace_from_snapshot( libspectrum_snap *snap GCC_UNUSED )
+{
+  trace_resync = 1;
+}
+
+static int
+trace_write( RFILE *f, const void *data, size_t length )
+{
+  return filestream_write( f, data, length ) != (int64_t)length;
+}
+
+static int
+trace_write_dword( RFILE *f, libspectrum_dword value )
+{
+  libspectrum_byte buffer[4];
+
+  write_dword( buffer, value );
+  return trace_write( f, buffer, sizeof( buffer ) );
+}
+
+int
+trace_dump( const char *filename )
+{
+  RFILE *f;
+  libspectrum_byte buffer[2];
+  size_t i, block;
+  int error = 0;
+
+  if( !trace_active ) return 0;
+
+  f = filestream_open( filename, RETRO_VFS_FILE_ACCESS_WRITE,
+                       RETRO_VFS_FILE_ACCESS_HINT_NONE );
+  if( !f ) {
+    ui_error( UI_ERROR_ERROR, "unable to open trace '%s' for writing",
+	      filename );
+    return 1;
+  }
+
+  trace_block_length[ trace_block_current ] =
+    trace_next - trace_buffer - trace_block_current * TRACE_BLOCK_SIZE;
+
+  buffer[0] = TRACE_VERSION; buffer[1] = TRACE_SLOTS;
+  error |= trace_write( f, TRACE_MAGIC, 4 );
+  error |= trace_write( f, buffer, 2 );
+  error |= trace_write_dword( f, TRACE_BLOCK_SIZE );
+  error |= trace_write_dword( f, trace_blocks_used );
+
+  buffer[0] = trace_max_source + 1;
+  error |= trace_write( f, buffer, 1 );
+  for( i = 0; (int)i <= trace_max_source; i++ ) {
+    const char *name = memory_source_description( i );
+    buffer[0] = strlen( name ) > 0xff ? 0xff : strlen( name );
+    error |= trace_write( f, buffer, 1 );
+    error |= trace_write( f, name, buffer[0] );
+  }
+
+  block = trace_blocks_used < trace_blocks ?
+          0 : ( trace_block_current + 1 ) % trace_blocks;
+  for( i = 0; i < trace_blocks_used; i++ ) {
+    error |= trace_write_dword( f, trace_block_length[ block ] );
+    error |= trace_write( f, trace_buffer + block * TRACE_BLOCK_SIZE,
+                          trace_block_length[ block ] );
+    block = ( block + 1 ) % trace_blocks;
+  }
+
+  filestream_close( f );
+
+  if( error ) {
+    ui_error( UI_ERROR_ERROR, "error writing trace '%s'", filename );
+    return 1;
+  }
+
+  return 0;
+}
+
+void
+trace_stop( void )
+{
+  if( !trace_buffer ) return;
+
+  free( trace_buffer ); trace_buffer = NULL;
+  free( trace_block_length ); trace_block_length = NULL;
+
+  trace_active = 0;
+
+  /* Again, schedule an event to ensure this change is picked up by
+     the main loop */
+  event_add( tstates, event_type_null );
+}
@@ -0,0 +1,77 @@
+/* trace.h: Z80 execution trace recorder
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+#ifndef FUSE_TRACE_H
+#define FUSE_TRACE_H
+
+/* The binary trace format, shared with the offline decoder in
+   fuse/tracedump.c. All multi-byte values are little endian.
+
+   File header:
+     "FTRC", version byte, TRACE_SLOTS byte, block size (dword),
+     block count (dword), source count (byte) followed by that many
+     memory source names, each as a length byte and the characters
+
+   Each block, oldest first, is its used length (dword) followed by:
+     frame (dword), tstates of the previous instruction (dword), PC of the
+     next sequential instruction (word) and for each of the TRACE_SLOTS
+     2K slots the source, page number and 2K chunk of the last code
+     executed there (0xff if none), then a sequence of records.
+
+   Each record starts with a header byte:
+     bits 0-2: number of opcode bytes which follow the record (1-4), or 0
+               for a special record given by the whole byte:
+                 0x00: end of block
+                 0x08: end of frame, followed by the frame length (dword)
+     bits 3-4: PC: 0 = sequential, 1 = signed byte offset from the
+               sequential PC, 2 = absolute word
+     bits 5-6: tstates: 0 = byte delta, 1 = word delta, 2 = absolute dword
+     bit 7:    the code slot was remapped: slot, source, page number and
+               chunk bytes follow
+   followed by the PC, tstates and paging fields in that order and then
+   the opcode bytes */
+
+#define TRACE_MAGIC "FTRC"
+#define TRACE_VERSION 1
+#define TRACE_SLOTS 32
+#define TRACE_BLOCK_SIZE 0x10000
+
+#define TRACE_RECORD_END 0x00
+#define TRACE_RECORD_FRAME 0x08
+
+#define TRACE_LENGTH_MASK 0x07
+#define TRACE_PC_SHIFT 3
+#define TRACE_TSTATES_SHIFT 5
+#define TRACE_PAGING 0x80
+
+enum trace_field_mode {
+  TRACE_FIELD_SHORT = 0,
+  TRACE_FIELD_MEDIUM,
+  TRACE_FIELD_ABSOLUTE,
+};
+
+extern int trace_active;
+
+void trace_register_startup( void );
+int trace_start( size_t buffer_size );
+void trace_record( libspectrum_word pc );
+void trace_frame( libspectrum_dword frame_length );
+int trace_dump( const char *filename );
+void trace_stop( void );
+
+#endif			/* #ifndef FUSE_TRACE_H */
@@ -0,0 +1,297 @@
+/* tracedump.c: Decoder for Fuse's binary execution traces
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+*/
+
+/* Prints one line per traced instruction: frame, tstates within the frame,
+   the memory page the code ran from, address, opcode bytes and the
+   disassembly from debugger_disassemble(). The disassembler reads from a
+   64K image built up from the opcode bytes seen so far in the trace */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libspectrum.h>
+
+#include "debugger/debugger.h"
+#include "fuse.h"
+#include "memory_pages.h"
+#include "trace.h"
+#include "ui/ui.h"
+
+static libspectrum_byte memory[ 0x10000 ];
+
+/* Only here to satisfy the disassembler's unit test */
+memory_page memory_map_read[ MEMORY_PAGES_IN_64K ];
+
+int debugger_output_base = 16;
+
+static const char *progname;
+
+libspectrum_byte
+readbyte_internal( libspectrum_word address )
+{
+  return memory[ address ];
+}
+
+int
+ui_error( ui_error_level severity GCC_UNUSED, const char *format, ... )
+{
+  va_list ap;
+
+  va_start( ap, format );
+  fprintf( stderr, "%s: ", progname );
+  vfprintf( stderr, format, ap );
+  fprintf( stderr, "\n" );
+  va_end( ap );
+
+  return 0;
+}
+
+void
+fuse_abort( void )
+{
+  abort();
+}
+
+/* A cursor over the trace data which reports running off the end */
+typedef struct reader_t {
+  const libspectrum_byte *ptr, *end;
+  int error;
+} reader_t;
+
+static libspectrum_dword
+read_bytes( reader_t *reader, size_t count )
+{
+  libspectrum_dword value = 0;
+  size_t i;
+
+  if( reader->end - reader->ptr < (ptrdiff_t)count ) {
+    reader->error = 1;
+    reader->ptr = reader->end;
+    return 0;
+  }
+
+  for( i = 0; i < count; i++ ) value |= (libspectrum_dword)reader->ptr[i] << ( 8 * i );
+  reader->ptr += count;
+
+  return value;
+}
+
+static void
+print_instruction( libspectrum_dword frame, libspectrum_dword tstates,
+                   char sources[][32], const libspectrum_byte *info,
+                   libspectrum_word pc, size_t length )
+{
+  char page[48], bytes[16], disassembly[40];
+  size_t i, disassembled;
+
+  if( info[0] == 0xff ) {
+    snprintf( page, sizeof( page ), "?" );
+  } else {
+    snprintf( page, sizeof( page ), "%s %d", sources[ info[0] ], info[1] );
+  }
+
+  for( i = 0; i < length; i++ )
+    snprintf( bytes + 2 * i, sizeof( bytes ) - 2 * i, "%02x",
+              memory[ (libspectrum_word)( pc + i ) ] );
+
+  debugger_disassemble( disassembly, sizeof( disassembly ), &disassembled,
+                        pc );
+
+  /* A DD or FD prefix which the core executed on its own */
+  if( disassembled != length && length == 1 )
+    snprintf( disassembly, sizeof( disassembly ), "NOP" );
+
+  printf( "%8lu %6lu  %-12s %04x  %-8s  %s\n", (unsigned long)frame,
+          (unsigned long)tstates, page, pc, bytes, disassembly );
+}
+
+static int
+decode_block( reader_t *reader, char sources[][32] )
+{
+  libspectrum_byte map[ TRACE_SLOTS ][ 3 ];
+  libspectrum_dword frame, tstates;
+  libspectrum_word pc, next_pc;
+  size_t i, length;
+  int header, mode;
+
+  frame = read_bytes( reader, 4 );
+  tstates = read_bytes( reader, 4 );
+  next_pc = read_bytes( reader, 2 );
+  for( i = 0; i < TRACE_SLOTS; i++ ) {
+    map[i][0] = read_bytes( reader, 1 );
+    map[i][1] = read_bytes( reader, 1 );
+    map[i][2] = read_bytes( reader, 1 );
+  }
+
+  while( reader->ptr < reader->end ) {
+
+    header = read_bytes( reader, 1 );
+
+    if( header == TRACE_RECORD_END ) break;
+
+    if( header == TRACE_RECORD_FRAME ) {
+      tstates -= read_bytes( reader, 4 );
+      frame++;
+      continue;
+    }
+
+    length = header & TRACE_LENGTH_MASK;
+    if( !length || length > 4 ) {
+      fprintf( stderr, "%s: bad record header 0x%02x\n", progname, header );
+      return 1;
+    }
+
+    mode = ( header >> TRACE_PC_SHIFT ) & 0x03;
+    pc = next_pc;
+    if( mode == TRACE_FIELD_MEDIUM ) {
+      pc += (signed char)read_bytes( reader, 1 );
+    } else if( mode == TRACE_FIELD_ABSOLUTE ) {
+      pc = read_bytes( reader, 2 );
+    }
+
+    mode = ( header >> TRACE_TSTATES_SHIFT ) & 0x03;
+    if( mode == TRACE_FIELD_SHORT ) {
+      tstates += read_bytes( reader, 1 );
+    } else if( mode == TRACE_FIELD_MEDIUM ) {
+      tstates += read_bytes( reader, 2 );
+    } else {
+      tstates = read_bytes( reader, 4 );
+    }
+
+    if( header & TRACE_PAGING ) {
+      size_t slot = read_bytes( reader, 1 ) % TRACE_SLOTS;
+      map[ slot ][0] = read_bytes( reader, 1 );
+      map[ slot ][1] = read_bytes( reader, 1 );
+      map[ slot ][2] = read_bytes( reader, 1 );
+    }
+
+    for( i = 0; i < length; i++ )
+      memory[ (libspectrum_word)( pc + i ) ] = read_bytes( reader, 1 );
+
+    if( reader->error ) break;
+
+    print_instruction( frame, tstates, sources,
+                       map[ pc >> MEMORY_PAGE_SIZE_LOGARITHM ], pc, length );
+
+    next_pc = pc + length;
+  }
+
+  if( reader->error ) {
+    fprintf( stderr, "%s: truncated block\n", progname );
+    return 1;
+  }
+
+  return 0;
+}
+
+static int
+decode( const libspectrum_byte *data, size_t length )
+{
+  char sources[ 0x100 ][32];
+  reader_t reader = { data, data + length, 0 };
+  libspectrum_dword blocks, i;
+  size_t count;
+  int error = 0;
+
+  if( length < 4 || memcmp( data, TRACE_MAGIC, 4 ) ) {
+    fprintf( stderr, "%s: not a Fuse trace\n", progname );
+    return 1;
+  }
+  reader.ptr += 4;
+
+  if( read_bytes( &reader, 1 ) != TRACE_VERSION ||
+      read_bytes( &reader, 1 ) != TRACE_SLOTS ) {
+    fprintf( stderr, "%s: unsupported trace version\n", progname );
+    return 1;
+  }
+
+  read_bytes( &reader, 4 );		/* Block size */
+  blocks = read_bytes( &reader, 4 );
+
+  for( i = 0; i < 0x100; i++ ) snprintf( sources[i], 32, "%lu",
+                                         (unsigned long)i );
+  count = read_bytes( &reader, 1 );
+  for( i = 0; i < count; i++ ) {
+    size_t name_length = read_bytes( &reader, 1 ), j;
+    for( j = 0; j < name_length; j++ ) {
+      int c = read_bytes( &reader, 1 );
+      if( j < 31 ) { sources[i][j] = c; sources[i][j + 1] = '\0'; }
+    }
+  }
+
+  for( i = 0; i < blocks && !reader.error; i++ ) {
+    reader_t block = reader;
+    size_t block_length = read_bytes( &reader, 4 );
+
+    if( reader.end - reader.ptr < (ptrdiff_t)block_length ) {
+      fprintf( stderr, "%s: truncated trace\n", progname );
+      return 1;
+    }
+
+    block.ptr = reader.ptr;
+    block.end = reader.ptr + block_length;
+    error |= decode_block( &block, sources );
+
+    reader.ptr += block_length;
+  }
+
+  return error;
+}
+
+int
+main( int argc, char **argv )
+{
+  FILE *f;
+  libspectrum_byte *data;
+  long length;
+  int error;
+
+  progname = argv[0];
+
+  if( argc != 2 ) {
+    fprintf( stderr, "Usage: %s <trace>\n", progname );
+    return 1;
+  }
+
+  f = fopen( argv[1], "rb" );
+  if( !f ) {
+    fprintf( stderr, "%s: couldn't open '%s'\n", progname, argv[1] );
+    return 1;
+  }
+
+  fseek( f, 0, SEEK_END ); length = ftell( f ); fseek( f, 0, SEEK_SET );
+
+  data = malloc( length > 0 ? length : 1 );
+  if( !data || fread( data, 1, length, f ) != (size_t)length ) {
+    fprintf( stderr, "%s: couldn't read '%s'\n", progname, argv[1] );
+    fclose( f );
+    free( data );
+    return 1;
+  }
+  fclose( f );
+
+  error = decode( data, length );
+
+  free( data );
+
+  return error;
+}
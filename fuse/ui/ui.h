@@ -55,6 +55,10 @@ typedef enum ui_error_level {
 
 int ui_init(int *argc, char ***argv);
 int ui_event(void);
+
+/* Called on every read of the keyboard or a joystick port, so a UI can
+   leave reading its input until the emulated program first asks for it */
+void ui_input_latch( void );
 int ui_end(void);
 
 /* Error handling routines */
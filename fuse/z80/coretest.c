@@ -24,9 +24,11 @@
 #include <config.h>
 
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "fuse.h"
 #include "peripherals/disk/beta.h"
@@ -44,6 +46,7 @@
 #include "rzx.h"
 #include "slt.h"
 #include "tape.h"
+#include "trace.h"
 
 #include "event.h"
 #include "infrastructure/startup_manager.h"
@@ -56,6 +59,25 @@
 static const char *progname;		/* argv[0] */
 static const char *testsfile;		/* argv[1] */
 
+/* Where the bus activity and final state of each test goes: straight to
+   stdout, into a buffer for comparison against the expected results or
+   nowhere at all when benchmarking */
+typedef enum trace_mode_t {
+  TRACE_PRINT,
+  TRACE_BUFFER,
+  TRACE_NONE,
+} trace_mode_t;
+
+static trace_mode_t trace_mode = TRACE_PRINT;
+static char *trace_buffer;
+static size_t trace_length, trace_allocated;
+
+static void trace( const char *format, ... ) GCC_PRINTF( 1, 2 );
+
+/* Set when benchmarking: memory is then treated as ROM so the
+   instruction stream can't be overwritten */
+static int memory_readonly = 0;
+
 static int init_dummies( void );
 
 libspectrum_dword tstates;
@@ -70,8 +92,13 @@ libspectrum_byte readbyte_internal( libspectrum_word address );
 void writebyte( libspectrum_word address, libspectrum_byte b );
 void writebyte_internal( libspectrum_word address, libspectrum_byte b );
 
+static int run_tests( void );
+static int check_tests( const char *expectedfile );
 static int run_test( FILE *f );
 static int read_test( FILE *f, libspectrum_dword *end_tstates );
+static int read_expected( FILE *f, char **buffer, size_t *allocated );
+
+static int run_benchmarks( double seconds );
 
 static void dump_z80_state( void );
 static void dump_memory_state( void );
@@ -79,12 +106,35 @@ static void dump_memory_state( void );
 int
 main( int argc, char **argv )
 {
-  FILE *f;
+  const char *expectedfile = NULL;
 
   progname = argv[0];
 
+  if( argc >= 2 && !strcmp( argv[1], "--bench" ) ) {
+    double seconds = argc >= 3 ? atof( argv[2] ) : 1.0;
+
+    if( seconds <= 0 ) {
+      fprintf( stderr, "%s: invalid benchmark time `%s'\n", progname,
+               argv[2] );
+      return 1;
+    }
+
+    if( init_dummies() ) return 1;
+    z80_init( NULL );
+
+    return run_benchmarks( seconds );
+  }
+
+  if( argc >= 3 && !strcmp( argv[1], "--expected" ) ) {
+    expectedfile = argv[2];
+    argc -= 2; argv += 2;
+  }
+
   if( argc < 2 ) {
-    fprintf( stderr, "Usage: %s <testsfile>\n", progname );
+    fprintf( stderr,
+             "Usage: %s [--expected <expectedfile>] <testsfile>\n"
+             "       %s --bench [<seconds per group>]\n",
+             progname, progname );
     return 1;
   }
 
@@ -95,6 +145,48 @@ main( int argc, char **argv )
   /* Initialise the tables used by the Z80 core */
   z80_init( NULL );
 
+  return expectedfile ? check_tests( expectedfile ) : run_tests();
+}
+
+static void
+trace( const char *format, ... )
+{
+  va_list ap;
+  int length;
+
+  va_start( ap, format );
+
+  if( trace_mode == TRACE_PRINT ) {
+    vprintf( format, ap );
+    va_end( ap );
+    return;
+  }
+
+  length = vsnprintf( trace_buffer + trace_length,
+                      trace_allocated - trace_length, format, ap );
+  va_end( ap );
+
+  if( length < 0 ) return;
+
+  if( trace_length + length >= trace_allocated ) {
+    while( trace_length + length >= trace_allocated )
+      trace_allocated = trace_allocated ? trace_allocated * 2 : 0x10000;
+    trace_buffer = libspectrum_renew( char, trace_buffer, trace_allocated );
+
+    va_start( ap, format );
+    vsnprintf( trace_buffer + trace_length, trace_allocated - trace_length,
+               format, ap );
+    va_end( ap );
+  }
+
+  trace_length += length;
+}
+
+static int
+run_tests( void )
+{
+  FILE *f;
+
   f = fopen( testsfile, "r" );
   if( !f ) {
     fprintf( stderr, "%s: couldn't open tests file `%s': %s\n", progname,
@@ -115,10 +207,118 @@ main( int argc, char **argv )
   return 0;
 }
 
+/* Run each test and compare its output with the corresponding entry in
+   `expectedfile', reporting the results in TAP format */
+static int
+check_tests( const char *expectedfile )
+{
+  FILE *f, *expected;
+  char *expected_buffer = NULL;
+  size_t expected_allocated = 0;
+  size_t count = 0, failed = 0;
+
+  f = fopen( testsfile, "r" );
+  if( !f ) {
+    fprintf( stderr, "%s: couldn't open tests file `%s': %s\n", progname,
+	     testsfile, strerror( errno ) );
+    return 1;
+  }
+
+  expected = fopen( expectedfile, "r" );
+  if( !expected ) {
+    fprintf( stderr, "%s: couldn't open expected results file `%s': %s\n",
+             progname, expectedfile, strerror( errno ) );
+    fclose( f );
+    return 1;
+  }
+
+  trace_mode = TRACE_BUFFER;
+
+  while( 1 ) {
+
+    char *name_end;
+    size_t i, line;
+
+    trace_length = 0;
+    if( !run_test( f ) ) break;
+
+    count++;
+    name_end = memchr( trace_buffer, '\n', trace_length );
+
+    if( read_expected( expected, &expected_buffer, &expected_allocated ) ) {
+      printf( "not ok %lu - %.*s\n# missing from `%s'\n",
+              (unsigned long)count, (int)( name_end - trace_buffer ),
+              trace_buffer, expectedfile );
+      failed++;
+      continue;
+    }
+
+    if( !strcmp( trace_buffer, expected_buffer ) ) {
+      printf( "ok %lu - %.*s\n", (unsigned long)count,
+              (int)( name_end - trace_buffer ), trace_buffer );
+      continue;
+    }
+
+    /* Report the first line which differs */
+    for( i = 0, line = 1;
+         trace_buffer[i] && trace_buffer[i] == expected_buffer[i]; i++ )
+      if( trace_buffer[i] == '\n' ) line++;
+    while( i && trace_buffer[ i - 1 ] != '\n' ) i--;
+
+    printf( "not ok %lu - %.*s\n", (unsigned long)count,
+            (int)( name_end - trace_buffer ), trace_buffer );
+    printf( "# line %lu: expected `%.*s', got `%.*s'\n", (unsigned long)line,
+            (int)strcspn( expected_buffer + i, "\n" ), expected_buffer + i,
+            (int)strcspn( trace_buffer + i, "\n" ), trace_buffer + i );
+    failed++;
+  }
+
+  printf( "1..%lu\n", (unsigned long)count );
+  if( failed ) {
+    printf( "# failed %lu of %lu tests\n", (unsigned long)failed,
+            (unsigned long)count );
+  }
+
+  fclose( expected );
+  fclose( f );
+  libspectrum_free( expected_buffer );
+  libspectrum_free( trace_buffer );
+  trace_buffer = NULL; trace_allocated = 0;
+  trace_mode = TRACE_PRINT;
+
+  return failed || !count;
+}
+
+/* Read the next test's results from `f': everything up to and including
+   the blank line which separates the tests */
+static int
+read_expected( FILE *f, char **buffer, size_t *allocated )
+{
+  size_t length = 0;
+  int c, last = 0;
+
+  while( ( c = getc( f ) ) != EOF ) {
+
+    if( length + 2 > *allocated ) {
+      *allocated = *allocated ? *allocated * 2 : 0x10000;
+      *buffer = libspectrum_renew( char, *buffer, *allocated );
+    }
+
+    ( *buffer )[ length++ ] = c;
+    if( c == '\n' && last == '\n' ) break;
+    last = c;
+  }
+
+  if( !length ) return 1;
+
+  ( *buffer )[ length ] = '\0';
+  return 0;
+}
+
 libspectrum_byte
 readbyte( libspectrum_word address )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace_mode != TRACE_NONE ) trace( "%5d MC %04x\n", tstates, address );
   tstates += 3;
   return readbyte_internal( address );
 }
@@ -126,14 +326,15 @@ readbyte( libspectrum_word address )
 libspectrum_byte
 readbyte_internal( libspectrum_word address )
 {
-  printf( "%5d MR %04x %02x\n", tstates, address, memory[ address ] );
+  if( trace_mode != TRACE_NONE )
+    trace( "%5d MR %04x %02x\n", tstates, address, memory[ address ] );
   return memory[ address ];
 }
 
 void
 writebyte( libspectrum_word address, libspectrum_byte b )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace_mode != TRACE_NONE ) trace( "%5d MC %04x\n", tstates, address );
   tstates += 3;
   writebyte_internal( address, b );
 }
@@ -141,14 +342,15 @@ writebyte( libspectrum_word address, libspectrum_byte b )
 void
 writebyte_internal( libspectrum_word address, libspectrum_byte b )
 {
-  printf( "%5d MW %04x %02x\n", tstates, address, b );
-  memory[ address ] = b;
+  if( trace_mode != TRACE_NONE )
+    trace( "%5d MW %04x %02x\n", tstates, address, b );
+  if( !memory_readonly ) memory[ address ] = b;
 }
 
 void
 contend_read( libspectrum_word address, libspectrum_dword time )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace_mode != TRACE_NONE ) trace( "%5d MC %04x\n", tstates, address );
   tstates += time;
 }
 
@@ -161,15 +363,15 @@ contend_read_no_mreq( libspectrum_word address, libspectrum_dword time )
 void
 contend_write_no_mreq( libspectrum_word address, libspectrum_dword time )
 {
-  printf( "%5d MC %04x\n", tstates, address );
+  if( trace_mode != TRACE_NONE ) trace( "%5d MC %04x\n", tstates, address );
   tstates += time;
 }
 
 static void
 contend_port_preio( libspectrum_word port )
 {
-  if( ( port & 0xc000 ) == 0x4000 ) {
-    printf( "%5d PC %04x\n", tstates, port );
+  if( ( port & 0xc000 ) == 0x4000 && trace_mode != TRACE_NONE ) {
+    trace( "%5d PC %04x\n", tstates, port );
   }
 
   tstates++;
@@ -180,17 +382,18 @@ contend_port_postio( libspectrum_word port )
 {
   if( port & 0x0001 ) {
     
-    if( ( port & 0xc000 ) == 0x4000 ) {
-      printf( "%5d PC %04x\n", tstates, port ); tstates++;
-      printf( "%5d PC %04x\n", tstates, port ); tstates++;
-      printf( "%5d PC %04x\n", tstates, port ); tstates++;
+    if( ( port & 0xc000 ) == 0x4000 && trace_mode != TRACE_NONE ) {
+      trace( "%5d PC %04x\n", tstates, port ); tstates++;
+      trace( "%5d PC %04x\n", tstates, port ); tstates++;
+      trace( "%5d PC %04x\n", tstates, port ); tstates++;
     } else {
       tstates += 3;
     }
 
   } else {
 
-    printf( "%5d PC %04x\n", tstates, port ); tstates += 3;
+    if( trace_mode != TRACE_NONE ) trace( "%5d PC %04x\n", tstates, port );
+    tstates += 3;
 
   }
 }
@@ -202,7 +405,8 @@ readport( libspectrum_word port )
 
   contend_port_preio( port );
 
-  printf( "%5d PR %04x %02x\n", tstates, port, r );
+  if( trace_mode != TRACE_NONE )
+    trace( "%5d PR %04x %02x\n", tstates, port, r );
 
   contend_port_postio( port );
 
@@ -214,7 +418,8 @@ writeport( libspectrum_word port, libspectrum_byte b )
 {
   contend_port_preio( port );
 
-  printf( "%5d PW %04x %02x\n", tstates, port, b );
+  if( trace_mode != TRACE_NONE )
+    trace( "%5d PW %04x %02x\n", tstates, port, b );
 
   contend_port_postio( port );
 }
@@ -242,7 +447,7 @@ run_test( FILE *f )
   dump_z80_state();
   dump_memory_state();
 
-  printf( "\n" );
+  trace( "\n" );
 
   return 1;
 }
@@ -319,7 +524,7 @@ read_test( FILE *f, libspectrum_dword *end_tstates )
     }
   }
 
-  printf( "%s", test_name );
+  trace( "%s", test_name );
 
   return 0;
 }
@@ -327,9 +532,9 @@ read_test( FILE *f, libspectrum_dword *end_tstates )
 static void
 dump_z80_state( void )
 {
-  printf( "%04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x\n",
+  trace( "%04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x\n",
 	  AF, BC, DE, HL, AF_, BC_, DE_, HL_, IX, IY, SP, PC, z80.memptr.w );
-  printf( "%02x %02x %d %d %d %d %d\n", I, ( R7 & 0x80 ) | ( R & 0x7f ),
+  trace( "%02x %02x %d %d %d %d %d\n", I, ( R7 & 0x80 ) | ( R & 0x7f ),
 	  IFF1, IFF2, IM, z80.halted, tstates );
 }
 
@@ -342,13 +547,240 @@ dump_memory_state( void )
 
     if( memory[ i ] == initial_memory[ i ] ) continue;
 
-    printf( "%04x ", (unsigned)i );
+    trace( "%04x ", (unsigned)i );
 
     while( i < 0x10000 && memory[ i ] != initial_memory[ i ] )
-      printf( "%02x ", memory[ i++ ] );
+      trace( "%02x ", memory[ i++ ] );
+
+    trace( "-1\n" );
+  }
+}
+
+/* Throughput benchmark. Each opcode group is laid out as straight line
+   code filling the whole of memory, so execution simply wraps around
+   from 0xffff to 0x0000; control flow, HALT and the repeating block
+   instructions are left out so that every pass takes the same time. */
+
+typedef size_t (*bench_emit_fn)( libspectrum_byte *buffer, unsigned opcode );
+
+typedef struct bench_group_t {
+  const char *name;
+  unsigned opcodes;
+  bench_emit_fn emit;
+} bench_group_t;
+
+/* Length of a benchmarked unprefixed instruction, or 0 if it is not
+   benchmarked */
+static size_t
+bench_base_length( libspectrum_byte opcode )
+{
+  switch( opcode ) {
 
-    printf( "-1\n" );
+  case 0x10: case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+  case 0x76: case 0xc3: case 0xc9: case 0xcb: case 0xcd: case 0xdd:
+  case 0xe9: case 0xed: case 0xfd:
+    return 0;
+
+  case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e:
+  case 0x36: case 0x3e: case 0xd3: case 0xdb:
+    return 2;
+
+  case 0x01: case 0x11: case 0x21: case 0x31: case 0x22: case 0x2a:
+  case 0x32: case 0x3a:
+    return 3;
+
+  }
+
+  if( opcode >= 0xc0 ) {
+    switch( opcode & 0x07 ) {
+    case 0x00: case 0x02: case 0x04: case 0x07: return 0; /* RET/JP/CALL cc, RST */
+    case 0x06: return 2;				/* ALU A,nn */
+    }
   }
+
+  return 1;
+}
+
+static size_t
+bench_base( libspectrum_byte *buffer, unsigned opcode )
+{
+  size_t length = bench_base_length( opcode );
+
+  if( length ) {
+    memset( buffer, 0, length );
+    buffer[0] = opcode;
+  }
+
+  return length;
+}
+
+static size_t
+bench_cb( libspectrum_byte *buffer, unsigned opcode )
+{
+  buffer[0] = 0xcb; buffer[1] = opcode;
+  return 2;
+}
+
+static size_t
+bench_ed( libspectrum_byte *buffer, unsigned opcode )
+{
+  size_t length;
+
+  if( opcode >= 0x40 && opcode < 0x80 ) {
+    if( ( opcode & 0x07 ) == 0x05 ) return 0;		/* RETN, RETI */
+    length = ( opcode & 0x07 ) == 0x03 ? 4 : 2;	/* LD (nnnn),rr etc */
+  } else if( ( opcode & 0xf4 ) == 0xa0 ) {
+    length = 2;				/* Non-repeating block instructions */
+  } else {
+    return 0;
+  }
+
+  memset( buffer, 0, length );
+  buffer[0] = 0xed; buffer[1] = opcode;
+  return length;
+}
+
+/* The instructions which use IX or IY; those which don't just execute
+   the unprefixed instruction and so aren't interesting here */
+static size_t
+bench_ddfd( libspectrum_byte *buffer, unsigned opcode )
+{
+  libspectrum_byte op = opcode & 0xff;
+  int low = op & 0x07, high = ( op >> 3 ) & 0x07;
+  size_t length = 0;
+
+  switch( op ) {
+  case 0x09: case 0x19: case 0x23: case 0x24: case 0x25: case 0x29:
+  case 0x2b: case 0x2c: case 0x2d: case 0x39: case 0xe1: case 0xe3:
+  case 0xe5: case 0xf9:
+    length = 2; break;
+  case 0x26: case 0x2e: case 0x34: case 0x35:
+    length = 3; break;
+  case 0x21: case 0x22: case 0x2a: case 0x36:
+    length = 4; break;
+  default:
+    if( op < 0x40 || op >= 0xc0 || op == 0x76 ) return 0;
+    if( low == 6 || ( op >= 0x70 && op < 0x78 ) ) {
+      length = 3;			/* (REGISTER+dd) */
+    } else if( low == 4 || low == 5 ||
+               ( op < 0x80 && ( high == 4 || high == 5 ) ) ) {
+      length = 2;			/* REGISTERH, REGISTERL */
+    } else {
+      return 0;
+    }
+  }
+
+  memset( buffer, 0, length );
+  buffer[0] = opcode & 0x100 ? 0xfd : 0xdd; buffer[1] = op;
+  return length;
+}
+
+static size_t
+bench_ddfdcb( libspectrum_byte *buffer, unsigned opcode )
+{
+  buffer[0] = opcode & 0x100 ? 0xfd : 0xdd; buffer[1] = 0xcb;
+  buffer[2] = 0x00; buffer[3] = opcode & 0xff;
+  return 4;
+}
+
+static const bench_group_t bench_groups[] = {
+  { "base",   0x100, bench_base   },
+  { "cb",     0x100, bench_cb     },
+  { "ed",     0x100, bench_ed     },
+  { "ddfd",   0x200, bench_ddfd   },
+  { "ddfdcb", 0x200, bench_ddfdcb },
+};
+
+/* Fill memory with the instructions from `group', padding the end with
+   NOPs; returns the number of different instructions used */
+static size_t
+bench_fill( const bench_group_t *group )
+{
+  libspectrum_byte instruction[4];
+  size_t address = 0, used = 0, length;
+  unsigned opcode;
+
+  for( opcode = 0; opcode < group->opcodes; opcode++ )
+    if( group->emit( instruction, opcode ) ) used++;
+
+  opcode = 0;
+  while( 1 ) {
+
+    do {
+      length = group->emit( instruction, opcode );
+      opcode = ( opcode + 1 ) % group->opcodes;
+    } while( !length );
+
+    if( address + length > 0x10000 ) break;
+
+    memcpy( &memory[ address ], instruction, length );
+    address += length;
+  }
+
+  memset( &memory[ address ], 0x00, 0x10000 - address );
+
+  return used;
+}
+
+static double
+bench_time( void )
+{
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static int
+run_benchmarks( double seconds )
+{
+  size_t i;
+
+  trace_mode = TRACE_NONE;
+  memory_readonly = 1;
+
+  for( i = 0; i < sizeof( bench_groups ) / sizeof( bench_groups[0] ); i++ ) {
+
+    const bench_group_t *group = &bench_groups[i];
+    libspectrum_qword instructions = 0, total_tstates = 0;
+    libspectrum_dword pass_instructions = 0, pass_tstates, chunk;
+    size_t used;
+    double start, elapsed;
+
+    used = bench_fill( group );
+
+    /* Single step one pass through memory to find out how many
+       instructions and tstates it takes */
+    z80_reset( 1 ); tstates = 0;
+    do {
+      event_next_event = tstates + 1;
+      z80_do_opcodes();
+      pass_instructions++;
+    } while( PC != 0x0000 );
+    pass_tstates = tstates;
+
+    /* Then run whole passes at full speed until the time is up */
+    chunk = 0x1000000 / pass_tstates + 1;
+    start = bench_time();
+    do {
+      tstates = 0; event_next_event = chunk * pass_tstates;
+      z80_do_opcodes();
+
+      if( PC != 0x0000 || tstates != event_next_event ) {
+        fprintf( stderr, "%s: %s benchmark lost sync at PC=0x%04x\n",
+                 progname, group->name, PC );
+        return 1;
+      }
+
+      instructions += (libspectrum_qword)chunk * pass_instructions;
+      total_tstates += tstates;
+      elapsed = bench_time() - start;
+    } while( elapsed < seconds );
+
+    printf( "group=%s opcodes=%lu instructions=%.0f tstates=%.0f "
+            "seconds=%.3f ips=%.0f\n",
+            group->name, (unsigned long)used, (double)instructions,
+            (double)total_tstates, elapsed, instructions / elapsed );
+  }
+
+  return 0;
 }
 
 /* Error 'handing': dump core as these should never be called */
@@ -405,6 +837,8 @@ int rzx_playback;
 int rzx_instructions_offset;
 
 enum debugger_mode_t debugger_mode;
+libspectrum_byte
+  debugger_breakpoint_map[ DEBUGGER_BREAKPOINT_ADDRESS_TYPES ][ 0x10000 / 8 ];
 
 libspectrum_byte **ROM = NULL;
 memory_page memory_map[8];
@@ -413,6 +847,7 @@ memory_page memory_map_rom[SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K];
 int memory_contended[8] = { 1 };
 libspectrum_byte spectrum_contention[ 80000 ] = { 0 };
 int profile_active = 0;
+int trace_active = 0;
 
 void
 profile_map( libspectrum_word pc GCC_UNUSED )
@@ -420,6 +855,12 @@ profile_map( libspectrum_word pc GCC_UNUSED )
   abort();
 }
 
+void
+trace_record( libspectrum_word pc GCC_UNUSED )
+{
+  abort();
+}
+
 int
 debugger_check( debugger_breakpoint_type type GCC_UNUSED, libspectrum_dword value GCC_UNUSED )
 {
@@ -1,4 +1,4 @@
-SETUP_CHECK( profile, profile_active )
+SETUP_CHECK( profile, profile_active || trace_active )
 SETUP_CHECK( rzx, rzx_playback )
 SETUP_CHECK( debugger, debugger_mode != DEBUGGER_MODE_INACTIVE )
 SETUP_CHECK( beta, beta_available )
@@ -51,6 +51,7 @@
 #include "slt.h"
 #include "svg.h"
 #include "tape.h"
+#include "trace.h"
 #include "z80.h"
 
 #include "z80_macros.h"
@@ -140,10 +141,11 @@ z80_do_opcodes( void )
 
   while( tstates < event_next_event ) {
 
-    /* Profiler */
-    CHECK( profile, profile_active )
+    /* Profiler and execution trace */
+    CHECK( profile, profile_active || trace_active )
 
-    profile_map( PC );
+    if( profile_active ) profile_map( PC );
+    if( trace_active ) trace_record( PC );
 
     END_CHECK
 
@@ -161,7 +163,9 @@ z80_do_opcodes( void )
     /* Check if the debugger should become active at this point */
     CHECK( debugger, debugger_mode != DEBUGGER_MODE_INACTIVE )
 
-    if( debugger_check( DEBUGGER_BREAKPOINT_TYPE_EXECUTE, PC ) )
+    if( ( debugger_mode == DEBUGGER_MODE_HALTED ||
+          debugger_breakpoint_at( DEBUGGER_BREAKPOINT_TYPE_EXECUTE, PC ) ) &&
+        debugger_check( DEBUGGER_BREAKPOINT_TYPE_EXECUTE, PC ) )
       debugger_trap();
 
     END_CHECK
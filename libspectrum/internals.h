@@ -270,6 +270,10 @@ libspectrum_csw_write( libspectrum_buffer *buffer, libspectrum_tape *tape );
 libspectrum_error
 libspectrum_wav_read( libspectrum_tape *tape, const char *filename );
 
+libspectrum_error
+internal_wav_read( libspectrum_tape *tape, const libspectrum_byte *buffer,
+                   size_t length );
+
 libspectrum_error
 internal_pzx_read( libspectrum_tape *tape, const libspectrum_byte *buffer,
                    const size_t length );
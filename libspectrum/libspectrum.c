@@ -73,6 +73,8 @@ static void
 gcrypt_log_handler( void *opaque, int level, const char *format, va_list ap );
 #endif				/* #ifdef HAVE_GCRYPT_H */
 
+static void uncompress_cache_clear( void );
+
 /* Initialise the library */
 libspectrum_error
 libspectrum_init( void )
@@ -120,6 +122,8 @@ libspectrum_init( void )
 void
 libspectrum_end( void )
 {
+  uncompress_cache_clear();
+
 #ifndef HAVE_LIB_GLIB
   libspectrum_slist_cleanup();
   libspectrum_hashtable_cleanup();
@@ -757,6 +761,181 @@ libspectrum_identify_class( libspectrum_class_t *libspectrum_class,
   return LIBSPECTRUM_ERROR_UNKNOWN;
 }
 
+libspectrum_error
+libspectrum_uncompress( libspectrum_byte **new_buffer, size_t *new_length,
+			libspectrum_id_t type,
+			const libspectrum_byte *old_buffer, size_t old_length )
+{
+  /* Tells the inflation routines to allocate memory for us */
+  *new_length = 0;
+
+  switch( type ) {
+
+#ifdef HAVE_LIBBZ2
+  case LIBSPECTRUM_ID_COMPRESSED_BZ2:
+    return libspectrum_bzip2_inflate( old_buffer, old_length,
+				      new_buffer, new_length );
+#endif				/* #ifdef HAVE_LIBBZ2 */
+
+#ifdef HAVE_ZLIB_H
+  case LIBSPECTRUM_ID_COMPRESSED_GZ:
+    return libspectrum_gzip_inflate( old_buffer, old_length,
+				     new_buffer, new_length );
+
+  case LIBSPECTRUM_ID_COMPRESSED_ZIP:
+    return libspectrum_zip_blind_read( old_buffer, old_length,
+				       new_buffer, new_length );
+#endif				/* #ifdef HAVE_ZLIB_H */
+
+  default:
+    libspectrum_print_error( LIBSPECTRUM_ERROR_UNKNOWN,
+			     "can't decompress file type %d", type );
+    return LIBSPECTRUM_ERROR_UNKNOWN;
+  }
+}
+
+/* Decompressed copies of the most recently used compressed files. Every
+   load of a compressed file decompresses it once to identify it and again
+   to read it, and the frontend reloads the same file on every reset, so
+   keep the results around; entries are matched on the full compressed
+   data, the hash just avoids comparing it against every entry */
+
+#define UNCOMPRESS_CACHE_ENTRIES 4
+
+typedef struct uncompress_cache_entry {
+
+  libspectrum_id_t type;
+  libspectrum_qword hash;
+  libspectrum_byte *compressed; size_t compressed_length;
+  libspectrum_byte *data; size_t length;
+
+  unsigned long last_used;
+
+} uncompress_cache_entry;
+
+static uncompress_cache_entry uncompress_cache[ UNCOMPRESS_CACHE_ENTRIES ];
+static unsigned long uncompress_cache_clock;
+
+/* 64-bit FNV-1a */
+static libspectrum_qword
+uncompress_cache_hash( const libspectrum_byte *buffer, size_t length )
+{
+  libspectrum_qword hash = 0xcbf29ce484222325ULL;
+
+  while( length-- ) {
+    hash ^= *buffer++;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+static void
+uncompress_cache_free_entry( uncompress_cache_entry *entry )
+{
+  libspectrum_free( entry->compressed );
+  libspectrum_free( entry->data );
+  memset( entry, 0, sizeof( *entry ) );
+}
+
+static void
+uncompress_cache_clear( void )
+{
+  size_t i;
+
+  for( i = 0; i < UNCOMPRESS_CACHE_ENTRIES; i++ )
+    uncompress_cache_free_entry( &uncompress_cache[i] );
+}
+
+static uncompress_cache_entry*
+uncompress_cache_find( libspectrum_id_t type, libspectrum_qword hash,
+		       const libspectrum_byte *buffer, size_t length )
+{
+  size_t i;
+
+  for( i = 0; i < UNCOMPRESS_CACHE_ENTRIES; i++ ) {
+    uncompress_cache_entry *entry = &uncompress_cache[i];
+
+    if( entry->compressed && entry->type == type && entry->hash == hash &&
+	entry->compressed_length == length &&
+	!memcmp( entry->compressed, buffer, length ) )
+      return entry;
+  }
+
+  return NULL;
+}
+
+libspectrum_error
+libspectrum_uncompress_cache_add( libspectrum_id_t type,
+				  const libspectrum_byte *old_buffer,
+				  size_t old_length,
+				  libspectrum_byte *new_buffer,
+				  size_t new_length )
+{
+  libspectrum_qword hash = uncompress_cache_hash( old_buffer, old_length );
+  uncompress_cache_entry *entry;
+  size_t i;
+
+  entry = uncompress_cache_find( type, hash, old_buffer, old_length );
+
+  if( !entry ) {
+    entry = &uncompress_cache[0];
+    for( i = 1; i < UNCOMPRESS_CACHE_ENTRIES; i++ )
+      if( uncompress_cache[i].last_used < entry->last_used )
+	entry = &uncompress_cache[i];
+  }
+
+  uncompress_cache_free_entry( entry );
+
+  entry->compressed = libspectrum_new( libspectrum_byte,
+				       old_length ? old_length : 1 );
+  memcpy( entry->compressed, old_buffer, old_length );
+  entry->compressed_length = old_length;
+  entry->type = type;
+  entry->hash = hash;
+  entry->data = new_buffer;
+  entry->length = new_length;
+  entry->last_used = ++uncompress_cache_clock;
+
+  return LIBSPECTRUM_ERROR_NONE;
+}
+
+/* libspectrum_uncompress(), going via the cache */
+static libspectrum_error
+uncompress_cached( libspectrum_id_t type,
+		   const libspectrum_byte *old_buffer, size_t old_length,
+		   libspectrum_byte **new_buffer, size_t *new_length )
+{
+  uncompress_cache_entry *entry;
+  libspectrum_byte *copy;
+  libspectrum_error error;
+
+  entry = uncompress_cache_find( type,
+				 uncompress_cache_hash( old_buffer, old_length ),
+				 old_buffer, old_length );
+
+  if( !entry ) {
+    error = libspectrum_uncompress( new_buffer, new_length, type,
+				    old_buffer, old_length );
+    if( error ) return error;
+
+    copy = libspectrum_new( libspectrum_byte, *new_length ? *new_length : 1 );
+    memcpy( copy, *new_buffer, *new_length );
+
+    return libspectrum_uncompress_cache_add( type, old_buffer, old_length,
+					     copy, *new_length );
+  }
+
+  entry->last_used = ++uncompress_cache_clock;
+
+  *new_length = entry->length;
+  *new_buffer = libspectrum_new( libspectrum_byte,
+				 entry->length ? entry->length : 1 );
+  memcpy( *new_buffer, entry->data, entry->length );
+
+  return LIBSPECTRUM_ERROR_NONE;
+}
+
 libspectrum_error
 libspectrum_uncompress_file( unsigned char **new_buffer, size_t *new_length,
 			     char **new_filename, libspectrum_id_t type,
@@ -800,8 +979,8 @@ libspectrum_uncompress_file( unsigned char **new_buffer, size_t *new_length,
 	(*new_filename)[ strlen( *new_filename ) - 4 ] = '\0';
     }
 
-    error = libspectrum_bzip2_inflate( old_buffer, old_length,
-				       new_buffer, new_length );
+    error = uncompress_cached( type, old_buffer, old_length,
+			       new_buffer, new_length );
     if( error ) {
       if( new_filename ) libspectrum_free( *new_filename );
       return error;
@@ -831,8 +1010,8 @@ libspectrum_uncompress_file( unsigned char **new_buffer, size_t *new_length,
 	(*new_filename)[ strlen( *new_filename ) - 3 ] = '\0';
     }
       
-    error = libspectrum_gzip_inflate( old_buffer, old_length,
-				      new_buffer, new_length );
+    error = uncompress_cached( type, old_buffer, old_length,
+			       new_buffer, new_length );
     if( error ) {
       if( new_filename ) libspectrum_free( *new_filename );
       return error;
@@ -859,8 +1038,8 @@ libspectrum_uncompress_file( unsigned char **new_buffer, size_t *new_length,
       (*new_filename)[ strlen( *new_filename ) - 4 ] = '\0';
     }
 
-    error = libspectrum_zip_blind_read( old_buffer, old_length,
-                                        new_buffer, new_length );
+    error = uncompress_cached( type, old_buffer, old_length,
+			       new_buffer, new_length );
     if( error ) {
       if( new_filename ) libspectrum_free( *new_filename );
       return error;
@@ -238,12 +238,7 @@ libspectrum_tape_read( libspectrum_tape *tape, const libspectrum_byte *buffer,
 #ifdef HAVE_LIB_AUDIOFILE
     error = libspectrum_wav_read( tape, filename ); break;
 #else     /* #ifdef HAVE_LIB_AUDIOFILE */
-    error = LIBSPECTRUM_ERROR_LOGIC;
-    libspectrum_print_error(
-      LIBSPECTRUM_ERROR_LOGIC,
-      "libspectrum_tape_read: format not supported without libaudiofile"
-    );
-    break;
+    error = internal_wav_read( tape, buffer, length ); break;
 #endif    /* #ifdef HAVE_LIB_AUDIOFILE */
 
   case LIBSPECTRUM_ID_TAPE_PZX:
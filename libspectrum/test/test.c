@@ -894,6 +894,22 @@ test_72( void )
   return r;
 }
 
+/* WAV file ending in the middle of the format chunk */
+static test_return_t
+test_80( void )
+{
+  return read_tape( STATIC_TEST_PATH( "wav-truncated-fmt.wav" ),
+                    LIBSPECTRUM_ERROR_CORRUPT );
+}
+
+/* WAV file without a data chunk */
+static test_return_t
+test_81( void )
+{
+  return read_tape( STATIC_TEST_PATH( "wav-no-data.wav" ),
+                    LIBSPECTRUM_ERROR_CORRUPT );
+}
+
 struct test_description {
 
   test_fn test;
@@ -976,7 +992,15 @@ static struct test_description tests[] = {
   { test_71, "Write RZX with incompressible snap", 0 },
   { test_72, "Tape peek next block", 0 },
   { test_73, "Read TZX RAW block edge handling", 0 },
-  { test_74, "Trailing pause block TZX file", 0 }
+  { test_74, "Trailing pause block TZX file", 0 },
+  { test_75, "8-bit mono WAV file", 0 },
+  { test_76, "16-bit mono WAV file", 0 },
+  { test_77, "16-bit stereo WAV file", 0 },
+  { test_78, "WAV file with odd length chunks", 0 },
+  { test_79, "WAV file with truncated data chunk", 0 },
+  { test_80, "WAV file with truncated format chunk", 0 },
+  { test_81, "WAV file without data chunk", 0 },
+  { test_82, "WAV file with NaN float samples", 0 }
 };
 
 static size_t test_count = ARRAY_SIZE( tests );
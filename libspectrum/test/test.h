@@ -34,6 +34,14 @@ test_return_t test_29( void );
 test_return_t test_73( void );
 test_return_t test_74( void );
 
+/* WAV tests */
+test_return_t test_75( void );
+test_return_t test_76( void );
+test_return_t test_77( void );
+test_return_t test_78( void );
+test_return_t test_79( void );
+test_return_t test_82( void );
+
 /* SZX write tests */
 test_return_t test_31( void );
 test_return_t test_32( void );
@@ -1,3 +1,8 @@
+#include "config.h"
+
+#include <string.h>
+
+#include "internals.h"
 #include "test.h"
 
 static test_edge_sequence_t
@@ -261,4 +266,84 @@ test_74( void )
                       LIBSPECTRUM_TAPE_FLAGS_NO_EDGE |
                       LIBSPECTRUM_TAPE_FLAGS_LEVEL_LOW |
                       LIBSPECTRUM_TAPE_FLAGS_LEVEL_HIGH );
-}
\ No newline at end of file
+}
+/* The built-in WAV reader. Every fixture is recorded at 35000 Hz, so each
+   sample is 100 tstates: high for 10 samples, low for 20 (with one sample
+   which doesn't leave the hysteresis band), high for 30 and low for 5 */
+static const test_edge_sequence_t
+wav_edges_list[] =
+{
+  {  1000,   1,   0 },	/* High, 10 samples */
+  {  2000,   1,   0 },	/* Low, 20 samples */
+  {  3000,   1,   0 },	/* High, 30 samples */
+  {   500,   1, 259 },	/* Low, 5 samples to the end of the file; end of
+                           block, end of tape, stop the tape */
+
+  { -1, 0, 0 }		/* End marker */
+
+};
+
+/* check_edges() counts the list down, so each test needs its own copy */
+static test_return_t
+check_wav_edges( const char *filename )
+{
+  test_edge_sequence_t edges[ ARRAY_SIZE( wav_edges_list ) ];
+
+  memcpy( edges, wav_edges_list, sizeof( edges ) );
+
+  return check_edges( filename, edges, 0x1ff );
+}
+
+test_return_t
+test_75( void )
+{
+  return check_wav_edges( STATIC_TEST_PATH( "wav-8bit-mono.wav" ) );
+}
+
+test_return_t
+test_76( void )
+{
+  return check_wav_edges( STATIC_TEST_PATH( "wav-16bit-mono.wav" ) );
+}
+
+/* The channels are averaged; the right one is silent */
+test_return_t
+test_77( void )
+{
+  return check_wav_edges( STATIC_TEST_PATH( "wav-16bit-stereo.wav" ) );
+}
+
+/* Odd length chunks are padded to an even length */
+test_return_t
+test_78( void )
+{
+  return check_wav_edges( STATIC_TEST_PATH( "wav-odd-chunks.wav" ) );
+}
+
+static test_edge_sequence_t
+wav_truncated_edges_list[] =
+{
+  {  1000,   1,   0 },	/* High, 10 samples */
+  {  2000,   1,   0 },	/* Low, 20 samples */
+  {  1000,   1, 259 },	/* High, the 10 samples left in the file; end of
+                           block, end of tape, stop the tape */
+
+  { -1, 0, 0 }		/* End marker */
+
+};
+
+/* A data chunk which claims to be longer than the file */
+test_return_t
+test_79( void )
+{
+  return check_edges( STATIC_TEST_PATH( "wav-truncated-data.wav" ),
+                      wav_truncated_edges_list, 0x1ff );
+}
+
+/* 32-bit float samples; NaNs are read as silence, which doesn't leave the
+   hysteresis band */
+test_return_t
+test_82( void )
+{
+  return check_wav_edges( STATIC_TEST_PATH( "wav-float-nan.wav" ) );
+}
@@ -24,13 +24,21 @@
 #include "config.h"
 #include <string.h>
 
+#include "internals.h"
+#include "tape_block.h"
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#define WAV_SIMD_SSE2
+#elif defined( __ARM_NEON ) || defined( __ARM_NEON__ )
+#include <arm_neon.h>
+#define WAV_SIMD_NEON
+#endif
+
 #ifdef HAVE_LIB_AUDIOFILE
 
 #include <audiofile.h>
 
-#include "internals.h"
-#include "tape_block.h"
-
 libspectrum_error
 libspectrum_wav_read( libspectrum_tape *tape, const char *filename )
 {
@@ -167,3 +175,341 @@ libspectrum_wav_read( libspectrum_tape *tape, const char *filename )
 }
 
 #endif    /* #ifdef HAVE_LIB_AUDIOFILE */
+
+/* Built-in reader for PCM WAV files, used when libaudiofile isn't
+   available. Rather than expanding the whole file into a sampled block,
+   the audio is converted to 16-bit mono a chunk at a time and run through
+   an edge detector, with the resulting pulses stored in a single RLE pulse
+   block (the same representation as a .csw file) */
+
+/* Samples must move this far past zero (in 16-bit units) before the
+   detected level changes, so noise in silent sections and on slow edges
+   doesn't turn into spurious pulses */
+#define WAV_HYSTERESIS 0x200
+
+/* Number of sample frames converted per pass */
+#define WAV_CHUNK_FRAMES 4096
+
+#define WAV_FORMAT_PCM        0x0001
+#define WAV_FORMAT_FLOAT      0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xfffe
+
+typedef struct wav_info_t {
+
+  libspectrum_word format;
+  libspectrum_word channels;
+  libspectrum_dword rate;
+  libspectrum_word block_align;
+  libspectrum_word bits;
+
+  const libspectrum_byte *data;
+  size_t frames;
+
+} wav_info_t;
+
+typedef struct wav_rle_t {
+
+  libspectrum_byte *data;
+  size_t length, allocated;
+
+  libspectrum_dword rate;
+  long scale;
+
+  /* Pulse length already emitted, in units of scale */
+  libspectrum_qword emitted;
+
+} wav_rle_t;
+
+static libspectrum_error
+wav_read_header( wav_info_t *wav, const libspectrum_byte *buffer,
+                 size_t length )
+{
+  const libspectrum_byte *ptr, *end = buffer + length;
+  int have_format = 0;
+
+  if( length < 12 || memcmp( buffer, "RIFF", 4 ) ||
+      memcmp( buffer + 8, "WAVE", 4 ) ) {
+    libspectrum_print_error( LIBSPECTRUM_ERROR_SIGNATURE,
+                             "internal_wav_read: wrong signature" );
+    return LIBSPECTRUM_ERROR_SIGNATURE;
+  }
+
+  memset( wav, 0, sizeof( *wav ) );
+  ptr = buffer + 12;
+
+  while( end - ptr >= 8 ) {
+    const libspectrum_byte *id = ptr;
+    size_t chunk_length;
+
+    ptr += 4;
+    chunk_length = libspectrum_read_dword( &ptr );
+
+    if( !memcmp( id, "data", 4 ) ) {
+      /* Captures which were still being written when copied often have a
+         bogus length here, so just take whatever is in the file */
+      if( chunk_length > (size_t)( end - ptr ) ) chunk_length = end - ptr;
+      wav->data = ptr;
+      wav->frames = chunk_length;
+      break;
+    }
+
+    if( chunk_length > (size_t)( end - ptr ) ) break;
+
+    if( !memcmp( id, "fmt ", 4 ) ) {
+      const libspectrum_byte *fmt = ptr;
+
+      if( chunk_length < 16 ) break;
+
+      wav->format = libspectrum_read_word( &fmt );
+      wav->channels = libspectrum_read_word( &fmt );
+      wav->rate = libspectrum_read_dword( &fmt );
+      fmt += 4;                 /* Bytes per second */
+      wav->block_align = libspectrum_read_word( &fmt );
+      wav->bits = libspectrum_read_word( &fmt );
+
+      /* WAVE_FORMAT_EXTENSIBLE keeps the real format in the first two
+         bytes of the sub-format GUID */
+      if( wav->format == WAV_FORMAT_EXTENSIBLE && chunk_length >= 26 ) {
+        fmt = ptr + 24;
+        wav->format = libspectrum_read_word( &fmt );
+      }
+
+      have_format = 1;
+    }
+
+    /* Chunks are padded to an even length */
+    if( ( chunk_length & 1 ) && ptr + chunk_length < end ) chunk_length++;
+    ptr += chunk_length;
+  }
+
+  if( !have_format || !wav->data ) {
+    libspectrum_print_error( LIBSPECTRUM_ERROR_CORRUPT,
+                             "internal_wav_read: missing %s chunk",
+                             have_format ? "data" : "format" );
+    return LIBSPECTRUM_ERROR_CORRUPT;
+  }
+
+  if( !( ( wav->format == WAV_FORMAT_PCM &&
+           ( wav->bits == 8 || wav->bits == 16 || wav->bits == 24 ||
+             wav->bits == 32 ) ) ||
+         ( wav->format == WAV_FORMAT_FLOAT && wav->bits == 32 ) ) ) {
+    libspectrum_print_error(
+      LIBSPECTRUM_ERROR_UNKNOWN,
+      "internal_wav_read: unsupported sample format %d with %d bits",
+      wav->format, wav->bits
+    );
+    return LIBSPECTRUM_ERROR_UNKNOWN;
+  }
+
+  if( !wav->channels || wav->block_align < wav->channels * wav->bits / 8 ) {
+    libspectrum_print_error( LIBSPECTRUM_ERROR_CORRUPT,
+                             "internal_wav_read: bad channel layout" );
+    return LIBSPECTRUM_ERROR_CORRUPT;
+  }
+
+  if( !wav->rate || wav->rate > 3500000 ) {
+    libspectrum_print_error( LIBSPECTRUM_ERROR_CORRUPT,
+                             "internal_wav_read: bad sample rate" );
+    return LIBSPECTRUM_ERROR_CORRUPT;
+  }
+
+  wav->frames /= wav->block_align;
+
+  return LIBSPECTRUM_ERROR_NONE;
+}
+
+static libspectrum_signed_dword
+wav_sample( const wav_info_t *wav, const libspectrum_byte *p )
+{
+  switch( wav->bits ) {
+
+  case 8:
+    return ( p[0] - 0x80 ) * 0x100;
+
+  case 16:
+    return (libspectrum_signed_word)( p[0] | p[1] << 8 );
+
+  case 24:
+    return (libspectrum_signed_word)( p[1] | p[2] << 8 );
+
+  default:
+    if( wav->format == WAV_FORMAT_FLOAT ) {
+      libspectrum_dword bits = p[0] | p[1] << 8 | p[2] << 16 |
+                               (libspectrum_dword)p[3] << 24;
+      float value;
+
+      memcpy( &value, &bits, sizeof( value ) );
+      /* NaN fails every comparison and can't be converted to an integer */
+      if( value != value ) return 0;
+      if( value >= 1.0f ) return 0x7fff;
+      if( value <= -1.0f ) return -0x8000;
+      return value * 0x7fff;
+    }
+    return (libspectrum_signed_word)( p[2] | p[3] << 8 );
+
+  }
+}
+
+/* Convert a run of frames to 16-bit mono by averaging the channels */
+static void
+wav_convert( const wav_info_t *wav, const libspectrum_byte *from,
+             size_t frames, libspectrum_signed_word *to )
+{
+  size_t bytes = wav->bits / 8;
+  size_t i, c;
+
+  if( wav->channels == 1 ) {
+    for( i = 0; i < frames; i++, from += wav->block_align )
+      to[i] = wav_sample( wav, from );
+    return;
+  }
+
+  for( i = 0; i < frames; i++, from += wav->block_align ) {
+    const libspectrum_byte *p = from;
+    libspectrum_signed_dword sum = 0;
+
+    for( c = 0; c < wav->channels; c++, p += bytes )
+      sum += wav_sample( wav, p );
+
+    to[i] = sum / wav->channels;
+  }
+}
+
+/* Find the first sample at or after start which takes the signal past the
+   hysteresis band on the far side from level */
+static size_t
+wav_find_edge( const libspectrum_signed_word *samples, size_t start,
+               size_t count, int level )
+{
+  size_t i = start;
+
+#if defined( WAV_SIMD_SSE2 )
+  __m128i threshold = _mm_set1_epi16( level ? -WAV_HYSTERESIS :
+                                              WAV_HYSTERESIS );
+
+  for( ; i + 8 <= count; i += 8 ) {
+    __m128i v = _mm_loadu_si128( ( const __m128i * )( samples + i ) );
+    int mask = _mm_movemask_epi8( level ? _mm_cmplt_epi16( v, threshold ) :
+                                          _mm_cmpgt_epi16( v, threshold ) );
+
+    if( mask ) {
+      while( !( mask & 1 ) ) { mask >>= 2; i++; }
+      return i;
+    }
+  }
+#elif defined( WAV_SIMD_NEON )
+  int16x8_t threshold = vdupq_n_s16( level ? -WAV_HYSTERESIS :
+                                             WAV_HYSTERESIS );
+
+  for( ; i + 8 <= count; i += 8 ) {
+    int16x8_t v = vld1q_s16( samples + i );
+    uint16x8_t hit = level ? vcltq_s16( v, threshold ) :
+                             vcgtq_s16( v, threshold );
+    uint64_t mask =
+      vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( hit, 4 ) ), 0 );
+
+    if( mask ) {
+      while( !( mask & 0xff ) ) { mask >>= 8; i++; }
+      return i;
+    }
+  }
+#endif
+
+  for( ; i < count; i++ ) {
+    if( level ? samples[i] < -WAV_HYSTERESIS :
+                samples[i] > WAV_HYSTERESIS ) return i;
+  }
+
+  return count;
+}
+
+/* Emit the pulse ending at the given sample frame. Pulse lengths are
+   rounded to units of scale against the absolute position, so rounding
+   errors don't accumulate over the length of the tape */
+static void
+wav_rle_pulse( wav_rle_t *rle, libspectrum_qword frame )
+{
+  libspectrum_qword target =
+    ( frame * 3500000 * 2 / rle->rate / rle->scale + 1 ) / 2;
+  libspectrum_qword count =
+    target > rle->emitted ? target - rle->emitted : 0;
+
+  /* Every edge must be kept to preserve the polarity of what follows */
+  if( !count ) count = 1;
+  if( count > 0xffffffff ) count = 0xffffffff;
+  rle->emitted += count;
+
+  if( rle->length + 5 > rle->allocated ) {
+    rle->allocated = rle->allocated ? 2 * rle->allocated : 4096;
+    rle->data = libspectrum_renew( libspectrum_byte, rle->data,
+                                   rle->allocated );
+  }
+
+  if( count < 0x100 ) {
+    rle->data[ rle->length++ ] = count;
+  } else {
+    rle->data[ rle->length++ ] = 0;
+    rle->data[ rle->length++ ] =   count         & 0xff;
+    rle->data[ rle->length++ ] = ( count >>  8 ) & 0xff;
+    rle->data[ rle->length++ ] = ( count >> 16 ) & 0xff;
+    rle->data[ rle->length++ ] = ( count >> 24 ) & 0xff;
+  }
+}
+
+libspectrum_error
+internal_wav_read( libspectrum_tape *tape, const libspectrum_byte *buffer,
+                   size_t length )
+{
+  libspectrum_tape_block *block;
+  libspectrum_signed_word samples[ WAV_CHUNK_FRAMES ];
+  libspectrum_qword position = 0, last_edge = 0;
+  const libspectrum_byte *from;
+  libspectrum_error error;
+  wav_info_t wav;
+  wav_rle_t rle;
+  int level = 0;
+
+  error = wav_read_header( &wav, buffer, length );
+  if( error ) return error;
+
+  if( !wav.frames ) {
+    libspectrum_print_error(
+      LIBSPECTRUM_ERROR_CORRUPT,
+      "internal_wav_read: empty audio file, nothing to load"
+    );
+    return LIBSPECTRUM_ERROR_CORRUPT;
+  }
+
+  memset( &rle, 0, sizeof( rle ) );
+  rle.rate = wav.rate;
+  rle.scale = 3500000 / wav.rate;
+
+  for( from = wav.data; position < wav.frames; ) {
+    size_t count = wav.frames - position, i = 0;
+
+    if( count > WAV_CHUNK_FRAMES ) count = WAV_CHUNK_FRAMES;
+
+    wav_convert( &wav, from, count, samples );
+    if( !position ) level = samples[0] > 0;
+
+    while( ( i = wav_find_edge( samples, i, count, level ) ) < count ) {
+      last_edge = position + i;
+      wav_rle_pulse( &rle, last_edge );
+      level = !level;
+    }
+
+    position += count;
+    from += count * wav.block_align;
+  }
+
+  if( position > last_edge ) wav_rle_pulse( &rle, position );
+
+  block = libspectrum_tape_block_alloc( LIBSPECTRUM_TAPE_BLOCK_RLE_PULSE );
+  block->types.rle_pulse.data = rle.data;
+  block->types.rle_pulse.length = rle.length;
+  block->types.rle_pulse.scale = rle.scale;
+
+  libspectrum_tape_append_block( tape, block );
+
+  return LIBSPECTRUM_ERROR_NONE;
+}
@@ -3,6 +3,7 @@
 #include <libretro.h>
 #include <externs.h>
 #include <machine.h>
+#include <string.h>
 
 int uidisplay_init(int width, int height)
 {
@@ -31,9 +32,14 @@ int uidisplay_init(int width, int height)
 void uidisplay_area(int x, int y, int w, int h)
 {
    (void)x;
-   (void)y;
    (void)w;
-   (void)h;
+
+   // Remember which lines changed, the keyboard overlay is only blended
+   // again over those
+   if (y >= 0 && h > 0 && y + h <= MAX_HEIGHT)
+   {
+      memset(image_buffer_dirty + y, 1, h);
+   }
 }
 
 void uidisplay_frame_end(void)
@@ -1,10 +1,95 @@
 // Compatibility keyboard functions
 
+#include <compat.h>
+#include <externs.h>
+
+// Key events from the frontend's keyboard callback, which may run on
+// another thread, queued in a single producer/single consumer ring until
+// read_input() in ui.c passes them to Fuse. The head and tail count the
+// events written and read so far. Without atomics the ring can't be shared
+// safely, so the callback isn't registered and ui.c polls the keyboard
+#define KEY_QUEUE_SIZE 256
+
+typedef struct
+{
+   unsigned keycode;
+   int down;
+}
+key_event_t;
+
+static key_event_t key_queue[KEY_QUEUE_SIZE];
+static size_t key_queue_head, key_queue_tail;
+static int key_queue_overflow;
+
+int ui_keyboard_events;
+
+#ifdef COMPAT_HAVE_ATOMICS
+static void RETRO_CALLCONV keyboard_event(bool down, unsigned keycode, uint32_t character, uint16_t key_modifiers)
+{
+   (void)character;
+   (void)key_modifiers;
+
+   // Character only events
+   if (keycode == RETROK_UNKNOWN || keycode >= RETROK_LAST)
+      return;
+
+   if (key_queue_head - compat_atomic_load(&key_queue_tail) == KEY_QUEUE_SIZE)
+   {
+      compat_atomic_store(&key_queue_overflow, 1);
+      return;
+   }
+
+   key_queue[key_queue_head % KEY_QUEUE_SIZE].keycode = keycode;
+   key_queue[key_queue_head % KEY_QUEUE_SIZE].down = down;
+   compat_atomic_store(&key_queue_head, key_queue_head + 1);
+}
+#endif
+
 int ui_keyboard_init(void)
 {
+   key_queue_head = key_queue_tail = 0;
+   key_queue_overflow = 0;
+
+#ifdef COMPAT_HAVE_ATOMICS
+   struct retro_keyboard_callback callback;
+
+   callback.callback = keyboard_event;
+   ui_keyboard_events = env_cb(RETRO_ENVIRONMENT_SET_KEYBOARD_CALLBACK, &callback);
+#else
+   ui_keyboard_events = 0;
+#endif
+
    return 0;
 }
 
 void ui_keyboard_end(void)
 {
 }
+
+int ui_keyboard_peek_event(unsigned* keycode, int* down)
+{
+   const key_event_t* event;
+
+   if (compat_atomic_load(&key_queue_head) == key_queue_tail)
+      return 0;
+
+   event = &key_queue[key_queue_tail % KEY_QUEUE_SIZE];
+   *keycode = event->keycode;
+   *down = event->down;
+
+   return 1;
+}
+
+void ui_keyboard_pop_event(void)
+{
+   compat_atomic_store(&key_queue_tail, key_queue_tail + 1);
+}
+
+int ui_keyboard_events_lost(void)
+{
+   if (!compat_atomic_load(&key_queue_overflow))
+      return 0;
+
+   compat_atomic_store(&key_queue_overflow, 0);
+   return 1;
+}
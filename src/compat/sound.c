@@ -6,7 +6,21 @@
 int sound_lowlevel_init(const char *device, int *freqptr, int *stereoptr)
 {
    (void)device;
-   *freqptr = 44100;
+
+   // The rate is chosen through the fuse_sample_rate core option
+   switch (*freqptr)
+   {
+      case 22050:
+      case 44100:
+      case 48000:
+      case 96000:
+         break;
+
+      default:
+         *freqptr = 44100;
+         break;
+   }
+
    return 0;
 }
 
@@ -16,6 +30,9 @@ void sound_lowlevel_end(void)
 
 void sound_lowlevel_frame(libspectrum_signed_word *data, int len)
 {
-   audio_cb( data, (size_t)len / 2 );
+   // Skipped frames produce nothing, but still end retro_run()'s wait
+   if (len)
+      audio_cb( data, (size_t)len / 2 );
+
    some_audio = 1;
 }
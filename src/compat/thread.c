@@ -0,0 +1,246 @@
+// Compatibility threading functions
+
+#include <stdlib.h>
+#include <compat.h>
+
+#if defined(HAVE_FUSE_THREADS) && defined(__GNUC__)
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+struct compat_thread_t
+{
+   void (*function)(void* data);
+   void* data;
+#ifdef _WIN32
+   HANDLE handle;
+#else
+   pthread_t handle;
+#endif
+};
+
+struct compat_mutex_t
+{
+#ifdef _WIN32
+   CRITICAL_SECTION handle;
+#else
+   pthread_mutex_t handle;
+#endif
+};
+
+struct compat_cond_t
+{
+#ifdef _WIN32
+   CONDITION_VARIABLE handle;
+#else
+   pthread_cond_t handle;
+#endif
+};
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID arg)
+{
+   compat_thread thread = (compat_thread)arg;
+   thread->function(thread->data);
+   return 0;
+}
+#else
+static void* thread_main(void* arg)
+{
+   compat_thread thread = (compat_thread)arg;
+   thread->function(thread->data);
+   return NULL;
+}
+#endif
+
+compat_thread compat_thread_create(void (*function)(void* data), void* data)
+{
+   compat_thread thread = (compat_thread)malloc(sizeof(*thread));
+
+   if (!thread)
+      return NULL;
+
+   thread->function = function;
+   thread->data = data;
+
+#ifdef _WIN32
+   thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+
+   if (thread->handle)
+      return thread;
+#else
+   if (pthread_create(&thread->handle, NULL, thread_main, thread) == 0)
+      return thread;
+#endif
+
+   free(thread);
+   return NULL;
+}
+
+void compat_thread_join(compat_thread thread)
+{
+#ifdef _WIN32
+   WaitForSingleObject(thread->handle, INFINITE);
+   CloseHandle(thread->handle);
+#else
+   pthread_join(thread->handle, NULL);
+#endif
+   free(thread);
+}
+
+compat_mutex compat_mutex_create(void)
+{
+   compat_mutex mutex = (compat_mutex)malloc(sizeof(*mutex));
+
+   if (!mutex)
+      return NULL;
+
+#ifdef _WIN32
+   InitializeCriticalSection(&mutex->handle);
+#else
+   if (pthread_mutex_init(&mutex->handle, NULL) != 0)
+   {
+      free(mutex);
+      return NULL;
+   }
+#endif
+
+   return mutex;
+}
+
+void compat_mutex_lock(compat_mutex mutex)
+{
+#ifdef _WIN32
+   EnterCriticalSection(&mutex->handle);
+#else
+   pthread_mutex_lock(&mutex->handle);
+#endif
+}
+
+void compat_mutex_unlock(compat_mutex mutex)
+{
+#ifdef _WIN32
+   LeaveCriticalSection(&mutex->handle);
+#else
+   pthread_mutex_unlock(&mutex->handle);
+#endif
+}
+
+void compat_mutex_destroy(compat_mutex mutex)
+{
+#ifdef _WIN32
+   DeleteCriticalSection(&mutex->handle);
+#else
+   pthread_mutex_destroy(&mutex->handle);
+#endif
+   free(mutex);
+}
+
+compat_cond compat_cond_create(void)
+{
+   compat_cond cond = (compat_cond)malloc(sizeof(*cond));
+
+   if (!cond)
+      return NULL;
+
+#ifdef _WIN32
+   InitializeConditionVariable(&cond->handle);
+#else
+   if (pthread_cond_init(&cond->handle, NULL) != 0)
+   {
+      free(cond);
+      return NULL;
+   }
+#endif
+
+   return cond;
+}
+
+void compat_cond_wait(compat_cond cond, compat_mutex mutex)
+{
+#ifdef _WIN32
+   SleepConditionVariableCS(&cond->handle, &mutex->handle, INFINITE);
+#else
+   pthread_cond_wait(&cond->handle, &mutex->handle);
+#endif
+}
+
+void compat_cond_signal(compat_cond cond)
+{
+#ifdef _WIN32
+   WakeConditionVariable(&cond->handle);
+#else
+   pthread_cond_signal(&cond->handle);
+#endif
+}
+
+void compat_cond_destroy(compat_cond cond)
+{
+#ifndef _WIN32
+   pthread_cond_destroy(&cond->handle);
+#endif
+   free(cond);
+}
+
+#else
+
+// No threads: creating one always fails so callers fall back to doing the
+// work inline, and the synchronisation objects are never needed
+
+compat_thread compat_thread_create(void (*function)(void* data), void* data)
+{
+   (void)function;
+   (void)data;
+   return NULL;
+}
+
+void compat_thread_join(compat_thread thread)
+{
+   (void)thread;
+}
+
+compat_mutex compat_mutex_create(void)
+{
+   return NULL;
+}
+
+void compat_mutex_lock(compat_mutex mutex)
+{
+   (void)mutex;
+}
+
+void compat_mutex_unlock(compat_mutex mutex)
+{
+   (void)mutex;
+}
+
+void compat_mutex_destroy(compat_mutex mutex)
+{
+   (void)mutex;
+}
+
+compat_cond compat_cond_create(void)
+{
+   return NULL;
+}
+
+void compat_cond_wait(compat_cond cond, compat_mutex mutex)
+{
+   (void)cond;
+   (void)mutex;
+}
+
+void compat_cond_signal(compat_cond cond)
+{
+   (void)cond;
+}
+
+void compat_cond_destroy(compat_cond cond)
+{
+   (void)cond;
+}
+
+#endif
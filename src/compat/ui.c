@@ -19,7 +19,65 @@ int ui_init(int *argc, char ***argv)
 {
    (void)argc;
    (void)argv;
-   return 0;
+   return ui_keyboard_init();
+}
+
+static void key_event(unsigned id, int down)
+{
+   input_event_t fuse_event;
+   unsigned ui = keysyms_map[id].ui;
+
+   if (keyb_state[ui] == down)
+      return;
+
+   keyb_state[ui] = down;
+
+   fuse_event.type = down ? INPUT_EVENT_KEYPRESS : INPUT_EVENT_KEYRELEASE;
+   fuse_event.types.key.native_key = keysyms_map[id].fuse;
+   fuse_event.types.key.spectrum_key = keysyms_map[id].fuse;
+
+   input_event(&fuse_event);
+}
+
+// Applies the queued key events in order, leaving any after a second change
+// to the same key for the next frame so the program can see every press
+static void read_key_events(int keyboard_connected)
+{
+   static unsigned key_generation[RETROK_LAST];
+   static unsigned generation;
+   unsigned keycode, id;
+   int down;
+
+   generation++;
+
+   while (ui_keyboard_peek_event(&keycode, &down))
+   {
+      if (keyboard_connected)
+      {
+         if (key_generation[keycode] == generation && keyb_state[keycode] != down)
+            break;
+
+         for (id = 0; keysyms_map[id].ui; id++)
+         {
+            if (keysyms_map[id].ui == keycode)
+            {
+               key_generation[keycode] = generation;
+               key_event(id, down);
+               break;
+            }
+         }
+      }
+
+      ui_keyboard_pop_event();
+   }
+}
+
+static void scan_keyboard(unsigned port)
+{
+   unsigned id;
+
+   for (id = 0; keysyms_map[id].ui; id++)
+      key_event(id, input_state_cb(port, RETRO_DEVICE_KEYBOARD, 0, keysyms_map[id].ui) != 0);
 }
 
 static input_key translate(unsigned index, int port, bool *keyboard_event)
@@ -48,7 +106,8 @@ static input_key translate(unsigned index, int port, bool *keyboard_event)
    return INPUT_KEY_NONE;
 }
 
-int ui_event(void)
+// Feeds the input the frontend returned on its last poll to Fuse
+static void read_input(void)
 {
    static const unsigned map[] = {
       RETRO_DEVICE_ID_JOYPAD_UP,
@@ -241,49 +300,30 @@ int ui_event(void)
          }
       }
       
+      // A frontend which delivers key events doesn't need polling, unless
+      // some of those events were lost, in which case the queue is stale
+      int scan = !ui_keyboard_events || ui_keyboard_events_lost();
+      int keyboard_connected = 0;
+
       for (port = 0; port < MAX_PADS; port++)
       {
-         unsigned device = input_devices[port];
-         
-         if (device == RETRO_DEVICE_SPECTRUM_KEYBOARD)
+         if (input_devices[port] == RETRO_DEVICE_SPECTRUM_KEYBOARD)
          {
-            for (id = 0; keysyms_map[id].ui; id++)
-            {
-               unsigned ui = keysyms_map[id].ui;
-               is_down = input_state_cb(port, RETRO_DEVICE_KEYBOARD, 0, ui);
-               
-               if (is_down)
-               {
-                  if (!keyb_state[ui])
-                  {
-                     keyb_state[ui] = true;
-                 
-                     fuse_event.type = INPUT_EVENT_KEYPRESS;
-                     fuse_event.types.key.native_key = keysyms_map[id].fuse;
-                     fuse_event.types.key.spectrum_key = keysyms_map[id].fuse;
-              
-                     input_event(&fuse_event);
-                  }
-               }
-               else
-               {
-                  if (keyb_state[ui])
-                  {
-                     keyb_state[ui] = false;
-                 
-                     fuse_event.type = INPUT_EVENT_KEYRELEASE;
-                     fuse_event.types.key.native_key = keysyms_map[id].fuse;
-                     fuse_event.types.key.spectrum_key = keysyms_map[id].fuse;
-              
-                     input_event(&fuse_event);
-                  }
-               }
-            }
+            keyboard_connected = 1;
+
+            if (scan)
+               scan_keyboard(port);
          }
       }
+
+      if (ui_keyboard_events)
+         read_key_events(keyboard_connected && !scan);
    }
    else
    {
+      if (ui_keyboard_events)
+         read_key_events(0);
+
       unsigned port, id;
       
       for (port = 0; port < MAX_PADS; port++)
@@ -336,7 +376,7 @@ int ui_event(void)
                                  keyb_shift = 0;
                               }
                            }
-                           return 0;
+                           return;
                      }
                   }
                }
@@ -351,10 +391,28 @@ int ui_event(void)
          }
       }
    }
-   
+}
+
+int ui_event(void)
+{
+   // With low latency input, the frame's input has already been read by
+   // ui_input_latch(), or will be at the end of retro_run()
+   if (!input_latch_lazy)
+      read_input();
+
    return 0;
 }
 
+void ui_input_latch(void)
+{
+   if (input_latched)
+      return;
+
+   input_latched = 1;
+   input_poll_cb();
+   read_input();
+}
+
 int ui_error_specific(ui_error_level severity, const char *message)
 {
    switch (severity)
@@ -37,8 +37,11 @@ extern double total_time_ms;
 extern retro_environment_t env_cb;
 extern retro_log_printf_t log_cb;
 extern retro_audio_sample_batch_t audio_cb;
+extern retro_input_poll_t input_poll_cb;
 extern retro_input_state_t input_state_cb;
+extern int input_latch_lazy, input_latched;
 extern uint16_t image_buffer[MAX_WIDTH * MAX_HEIGHT];
+extern uint8_t image_buffer_dirty[MAX_HEIGHT];
 extern unsigned hard_width, hard_height;
 extern int show_frame, some_audio;
 extern retro_log_printf_t log_cb;
@@ -62,10 +65,21 @@ extern keysyms_map_t keysyms_map[];
 extern uint16_t *palette;
 
 int update_variables(int);
+
+// From the keyboard callback
+extern int ui_keyboard_events;
+int ui_keyboard_init(void);
+int ui_keyboard_peek_event(unsigned* keycode, int* down);
+void ui_keyboard_pop_event(void);
+int ui_keyboard_events_lost(void);
 int fuse_ui_error_specific(ui_error_level, const char*);
 
 // From Fuse
 extern settings_info settings_current;
+extern int display_frame_skip;
+extern int movie_recording;
+extern int fdd_turbo;
+void display_set_batched(int batched);
 
 int fuse_init(int argc, char** argv);
 int fuse_end(void);
@@ -1,5 +1,6 @@
 #include <libretro.h>
 #include <streams/file_stream.h>
+#include <file/file_path.h>
 #include <keyboverlay.h>
 
 #include <coreopt.h>
@@ -10,11 +11,14 @@
 
 // Fuse includes
 #include <libspectrum.h>
+#include <compat.h>
+#include <fuse.h>
 #include <externs.h>
 #include <utils.h>
 #include <spectrum.h>
 #include <keyboard.h>
 #include <machines/specplus3.h>
+#include <module.h>
 #include <peripherals/ay.h>
 #include <peripherals/disk/beta.h>
 #include <peripherals/disk/didaktik.h>
@@ -24,9 +28,24 @@
 #include <peripherals/disk/disciple.h>
 #include <pokefinder/pokemem.h>
 #include <periph.h>
-
+#include <phantom_typist.h>
+#include <profile.h>
+#include <snapshot.h>
+#include <sound.h>
+#include <statehash.h>
+#include <trace.h>
+
+#include "ui/scaler/scaler.h"
 #include "ui/uimedia.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define VIDEO_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VIDEO_SIMD_NEON
+#endif
+
 static void dummy_log(enum retro_log_level level, const char *fmt, ...)
 {
    (void)level;
@@ -36,6 +55,7 @@ static void dummy_log(enum retro_log_level level, const char *fmt, ...)
 #define UPDATE_AV_INFO  1
 #define UPDATE_GEOMETRY 2
 #define UPDATE_MACHINE  4
+#define UPDATE_SOUND    8
 #define SPECTRUMKEYS "<none>|0|1|2|3|4|5|6|7|8|9|a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z|Enter|Caps|Symbol|Space"
 
 typedef struct cheat_t cheat_t;
@@ -227,31 +247,18 @@ static uint16_t palettes[PALETTE_COUNT][16] = {
    },
 };
 
-static int fuse_init_called = 0;
-static int forced_machine_at_init = 0;
-static int forced_machine_idx = 0;
-static int auto_size_savestate = 1;
-
-static unsigned msg_interface_version = 0;
-static int show_joystick_type_at_startup;
-static int show_emulation_speed_at_startup;
-static int display_joystick_type;
-static int display_emulation_speed;
-static int kempston_mouse_needs_periph_update = 0;
-static void sync_kempston_mouse_from_ports(void);
-
-static retro_video_refresh_t video_cb;
-static retro_input_poll_t input_poll_cb;
+// Frameskip. In auto mode the decision is driven by the audio buffer
+// occupancy the frontend reports, falling back to the frame time when the
+// frontend doesn't support RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK.
+// Only rasterisation is skipped (see display_frame_skip), so emulation and
+// audio are exactly the same as when every frame is drawn.
+#define FRAMESKIP_NONE  0
+#define FRAMESKIP_AUTO  1
+#define FRAMESKIP_FIXED 2
 
-static uint16_t image_buffer_2[MAX_WIDTH * MAX_HEIGHT];
-static unsigned first_pixel;
-static unsigned soft_width, soft_height;
-static int size_border;
-static int keyb_transparent;
-static const machine_t* machine;
-static double frame_time;
-static cheat_t* active_cheats;
-static int current_palette = PALETTE_FUSE;
+// Never skip more than this many frames in a row in auto mode, so the
+// screen still moves when the host can't keep up at all
+#define FRAMESKIP_AUTO_MAX 4
 
 // Multi-disk (M3U) support: a single virtual tray for drive A, swappable at
 // runtime via the libretro disk control interface. See retro_load_game()
@@ -260,24 +267,128 @@ static int current_palette = PALETTE_FUSE;
 #define MAX_DISK_IMAGES 16
 #define MAX_DISK_PATH_LEN 1024
 
-static char disk_image_paths[MAX_DISK_IMAGES][MAX_DISK_PATH_LEN];
-static unsigned num_disk_images = 0;
-static unsigned current_disk_index = 0;
-static bool disk_tray_ejected = false;
-static int content_is_m3u = 0;
+// What the frontend interface keeps between calls. It is reached only
+// through core, so that it can later be allocated per instance; the
+// machine itself and the variables shared with src/compat are still
+// global, see "Multiple instances" in README.md
+typedef struct
+{
+   int fuse_init_called;
+   int forced_machine_at_init;
+   int forced_machine_idx;
+   int auto_size_savestate;
+
+   unsigned msg_interface_version;
+   int show_joystick_type_at_startup;
+   int show_emulation_speed_at_startup;
+   int display_joystick_type;
+   int display_emulation_speed;
+   int kempston_mouse_needs_periph_update;
+
+   // Execution trace buffer size asked for by fuse_trace_buffer and the
+   // size currently recording. The trace is (re)started from retro_run(),
+   // as update_variables() also runs while Fuse is starting up
+   size_t exec_trace_requested;
+   size_t exec_trace_size;
+
+   // Same for the profiler: the output file named by fuse_profiler, which
+   // also picks the format (see profile_finish())
+   const char* profile_requested;
+   const char* profile_file;
+
+   // Frames run by each retro_run() while the frontend is fast-forwarding,
+   // 0 to run one as usual
+   int fast_forward_frames;
+
+   // Whether the keyboard overlay is asked to be and is drawn on a helper
+   // thread, see video_thread_submit()
+   int video_thread_requested;
+   int video_thread_enabled;
+
+   // The Fuse scaler picked with fuse_scaler, SCALER_NUM if none, and how
+   // much it enlarges the picture. Timex machines already draw at double
+   // size, so they are never scaled, see scaler_scale()
+   scaler_type scaler_selected;
+   unsigned scaler_factor;
+
+   // Frames between the state hashes logged for fuse_state_hash, 0 for
+   // none, and the number of frames run since the content was loaded, see
+   // state_hash_log()
+   int state_hash_interval;
+   unsigned state_hash_frame;
+
+   // Boot state cache, see boot_cache_restore()
+   int boot_cache_enabled;
+   int boot_cache_pending;
+   uint64_t boot_cache_key;
+
+   // The Z80 pages and RAM size the memory map was last published with,
+   // see update_memory_maps()
+   libspectrum_byte* memory_map_published[MEMORY_PAGES_IN_64K];
+   size_t memory_map_published_ram;
+
+   uint16_t image_buffer_2[MAX_WIDTH * MAX_HEIGHT];
+   unsigned first_pixel;
+   unsigned soft_width, soft_height;
+   int size_border;
+   int keyb_transparent;
+   double frame_time;
+   cheat_t* active_cheats;
+   int current_palette;
+
+   int frameskip_mode;
+   int frameskip_interval;
+   unsigned frameskip_threshold;
+   int frameskip_counter;
+   int frameskip_latency_changed;
+   bool audio_buffer_status_available;
+   bool audio_buffer_active;
+   unsigned audio_buffer_occupancy;
+   bool audio_buffer_underrun_likely;
+   retro_usec_t last_frame_time_usec;
+
+   char disk_image_paths[MAX_DISK_IMAGES][MAX_DISK_PATH_LEN];
+   unsigned num_disk_images;
+   unsigned current_disk_index;
+   bool disk_tray_ejected;
+   int content_is_m3u;
+
+   // Cached by set_initial_image(), called by the frontend *before*
+   // retro_load_game() - see the libretro.h doc comment on that callback.
+   int initial_disk_index_hint;
+   char initial_disk_path_hint[MAX_DISK_PATH_LEN];
+}
+core_context_t;
+
+static core_context_t core_context = {
+   .auto_size_savestate = 1,
+   .scaler_selected = SCALER_NUM,
+   .scaler_factor = 1,
+   .current_palette = PALETTE_FUSE,
+   .frameskip_mode = FRAMESKIP_NONE,
+   .frameskip_threshold = 33,
+   .initial_disk_index_hint = -1,
+};
+
+static core_context_t* const core = &core_context;
 
-// Cached by set_initial_image(), called by the frontend *before*
-// retro_load_game() - see the libretro.h doc comment on that callback.
-static int initial_disk_index_hint = -1;
-static char initial_disk_path_hint[MAX_DISK_PATH_LEN];
+static void sync_kempston_mouse_from_ports(void);
+static void boot_cache_restore(void);
+
+static retro_video_refresh_t video_cb;
+static const machine_t* machine;
 
 // allow access to variables declared here
 double total_time_ms;
 retro_environment_t env_cb;
 retro_log_printf_t log_cb = dummy_log;
 retro_audio_sample_batch_t audio_cb;
+retro_input_poll_t input_poll_cb;
 retro_input_state_t input_state_cb;
+int input_latch_lazy;
+int input_latched = 1;
 uint16_t image_buffer[MAX_WIDTH * MAX_HEIGHT];
+uint8_t image_buffer_dirty[MAX_HEIGHT];
 unsigned hard_width, hard_height;
 int show_frame, some_audio;
 unsigned input_devices[MAX_PADS];
@@ -593,6 +704,113 @@ static struct retro_core_option_v2_definition core_option_definitions[] = {
       },
       "Fuse Standard"
    },
+   {
+      "fuse_frameskip",
+      "Frameskip",
+      NULL,
+      NULL,
+      NULL,
+      "video",
+      {
+         { "disabled", NULL },
+         { "auto", NULL },
+         { "1", NULL },
+         { "2", NULL },
+         { "3", NULL },
+         { "4", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
+   {
+      "fuse_frameskip_threshold",
+      "Frameskip Threshold (%)",
+      NULL,
+      NULL,
+      NULL,
+      "video",
+      {
+         { "33", NULL },
+         { "20", NULL },
+         { "40", NULL },
+         { "50", NULL },
+         { "60", NULL },
+         { NULL, NULL }
+      },
+      "33"
+   },
+   {
+      "fuse_fast_forward",
+      "Fast-Forward Frames per Run",
+      NULL,
+      NULL,
+      NULL,
+      "video",
+      {
+         { "disabled", NULL },
+         { "5", NULL },
+         { "10", NULL },
+         { "20", NULL },
+         { "50", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
+   {
+      "fuse_batched_display",
+      "Batched Screen Rendering",
+      NULL,
+      NULL,
+      NULL,
+      "video",
+      {
+         { "disabled", NULL },
+         { "enabled", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
+   {
+      "fuse_video_thread",
+      "Draw Keyboard Overlay on a Thread",
+      NULL,
+      NULL,
+      NULL,
+      "video",
+      { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
+      "disabled"
+   },
+   {
+      "fuse_scaler",
+      "Internal Scaler",
+      NULL,
+      NULL,
+      NULL,
+      "video",
+      {
+         { "disabled", NULL },
+         { "Double size", NULL },
+         { "Triple size", NULL },
+         { "Quadruple size", NULL },
+         { "2xSaI", NULL },
+         { "Super 2xSaI", NULL },
+         { "SuperEagle", NULL },
+         { "AdvMAME 2x", NULL },
+         { "AdvMAME 3x", NULL },
+         { "TV 2x", NULL },
+         { "TV 3x", NULL },
+         { "TV 4x", NULL },
+         { "Dot Matrix", NULL },
+         { "PAL TV 2x", NULL },
+         { "PAL TV 3x", NULL },
+         { "PAL TV 4x", NULL },
+         { "HQ 2x", NULL },
+         { "HQ 3x", NULL },
+         { "HQ 4x", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
    {
       "fuse_auto_load",
       "Tape Auto Load",
@@ -603,6 +821,20 @@ static struct retro_core_option_v2_definition core_option_definitions[] = {
       { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
       "enabled"
    },
+   {
+      "fuse_boot_cache",
+      "Boot State Cache",
+      NULL,
+      NULL,
+      NULL,
+      "system",
+      {
+         { "disabled", NULL },
+         { "enabled", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
    {
       "fuse_fast_load",
       "Tape Fast Load",
@@ -613,6 +845,16 @@ static struct retro_core_option_v2_definition core_option_definitions[] = {
       { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
       "enabled"
    },
+   {
+      "fuse_fast_disk",
+      "Disk Fast Load",
+      NULL,
+      NULL,
+      NULL,
+      "advanced",
+      { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
+      "disabled"
+   },
    {
       "fuse_load_sound",
       "Tape Load Sound",
@@ -638,6 +880,22 @@ static struct retro_core_option_v2_definition core_option_definitions[] = {
       },
       "tv speaker"
    },
+   {
+      "fuse_sample_rate",
+      "Audio Sample Rate (Hz)",
+      NULL,
+      NULL,
+      NULL,
+      "audio",
+      {
+         { "22050", NULL },
+         { "44100", NULL },
+         { "48000", NULL },
+         { "96000", NULL },
+         { NULL, NULL }
+      },
+      "44100"
+   },
    {
       "fuse_ay_stereo_separation",
       "AY Stereo Separation",
@@ -699,6 +957,16 @@ static struct retro_core_option_v2_definition core_option_definitions[] = {
       { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
       "disabled"
    },
+   {
+      "fuse_low_latency_input",
+      "Low Latency Input",
+      NULL,
+      NULL,
+      NULL,
+      "input",
+      { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
+      "disabled"
+   },
    {
       "fuse_display_joystick_type",
       "Display joystick type at startup",
@@ -729,6 +997,54 @@ static struct retro_core_option_v2_definition core_option_definitions[] = {
       { CORE_OPTION_VALUE_LIST_ENABLED_DISABLED },
       "enabled"
    },
+   {
+      "fuse_trace_buffer",
+      "Instruction Trace Buffer (MB)",
+      NULL,
+      NULL,
+      NULL,
+      "advanced",
+      {
+         { "disabled", NULL },
+         { "4", NULL },
+         { "16", NULL },
+         { "64", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
+   {
+      "fuse_state_hash",
+      "State Hash Log (frames)",
+      NULL,
+      NULL,
+      NULL,
+      "advanced",
+      {
+         { "disabled", NULL },
+         { "1", NULL },
+         { "10", NULL },
+         { "50", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
+   {
+      "fuse_profiler",
+      "Profiler",
+      NULL,
+      NULL,
+      NULL,
+      "advanced",
+      {
+         { "disabled", NULL },
+         { "flat", NULL },
+         { "callgrind", NULL },
+         { "folded", NULL },
+         { NULL, NULL }
+      },
+      "disabled"
+   },
    {
       "fuse_joypad_left",
       "Joypad Left mapping",
@@ -893,10 +1209,19 @@ static const struct retro_variable core_vars[] =
    { "fuse_emulation_speed", "Emulation speed percentage (needs content load); 100|150|200|300|50"},
    { "fuse_size_border", "Size Video Border; full|medium|small|minimum|none" },
    { "fuse_palette", "Colour Palette; Fuse Standard|ZX Standard|B&W TV|Green Monochrome|Ambar Monochrome|C64|CGA 4 colours|CGA 8 colours|CGA 16 colours|Inverted colours"},
+   { "fuse_frameskip", "Frameskip; disabled|auto|1|2|3|4" },
+   { "fuse_frameskip_threshold", "Frameskip Threshold (%); 33|20|40|50|60" },
+   { "fuse_fast_forward", "Fast-Forward Frames per Run; disabled|5|10|20|50" },
+   { "fuse_batched_display", "Batched Screen Rendering; disabled|enabled" },
+   { "fuse_video_thread", "Draw Keyboard Overlay on a Thread; disabled|enabled" },
+   { "fuse_scaler", "Internal Scaler; disabled|Double size|Triple size|Quadruple size|2xSaI|Super 2xSaI|SuperEagle|AdvMAME 2x|AdvMAME 3x|TV 2x|TV 3x|TV 4x|Dot Matrix|PAL TV 2x|PAL TV 3x|PAL TV 4x|HQ 2x|HQ 3x|HQ 4x" },
    { "fuse_auto_load", "Tape Auto Load; enabled|disabled" },
+   { "fuse_boot_cache", "Boot State Cache; disabled|enabled" },
    { "fuse_fast_load", "Tape Fast Load; enabled|disabled" },
+   { "fuse_fast_disk", "Disk Fast Load; disabled|enabled" },
    { "fuse_load_sound", "Tape Load Sound; enabled|disabled" },
    { "fuse_speaker_type", "Speaker Type; tv speaker|beeper|unfiltered" },
+   { "fuse_sample_rate", "Audio Sample Rate (Hz); 44100|22050|48000|96000" },
    { "fuse_ay_stereo_separation", "AY Stereo Separation; none|acb|abc" },
    { "fuse_turbosound", "TurboSound (2x AY-8910); disabled|enabled" },
    { "fuse_key_ovrlay_transp", "Transparent Keyboard Overlay; enabled|disabled" },
@@ -905,6 +1230,10 @@ static const struct retro_variable core_vars[] =
    { "fuse_display_emulation_speed", "Display emulation speed at startup; disabled|enabled" },
    { "fuse_auto_size_savestate", "Use Auto Size for Savestates. For Netplay 'Off' is recommended; enabled|disabled" },
    { "fuse_mouse_swap_buttons", "Kempston Mouse Swap Buttons; disabled|enabled" },
+   { "fuse_low_latency_input", "Low Latency Input; disabled|enabled" },
+   { "fuse_trace_buffer", "Instruction Trace Buffer (MB); disabled|4|16|64" },
+   { "fuse_state_hash", "State Hash Log (frames); disabled|1|10|50" },
+   { "fuse_profiler", "Profiler; disabled|flat|callgrind|folded" },
    { "fuse_joypad_left",    "Joypad Left mapping; " SPECTRUMKEYS },
    { "fuse_joypad_right",   "Joypad Right mapping; " SPECTRUMKEYS },
    { "fuse_joypad_up",      "Joypad Up mapping; " SPECTRUMKEYS },
@@ -925,7 +1254,7 @@ static const struct retro_variable core_vars[] =
 
 void Retro_Msg(const char * msg_str)
 {
-   if (msg_interface_version >= 1)
+   if (core->msg_interface_version >= 1)
    {
       struct retro_message_ext msg = {
          msg_str,
@@ -948,6 +1277,92 @@ void Retro_Msg(const char * msg_str)
    }
 }
 
+static void RETRO_CALLCONV frameskip_audio_buffer_status(bool active, unsigned occupancy, bool underrun_likely)
+{
+   core->audio_buffer_active = active;
+   core->audio_buffer_occupancy = occupancy;
+   core->audio_buffer_underrun_likely = underrun_likely;
+}
+
+static void RETRO_CALLCONV frameskip_frame_time(retro_usec_t usec)
+{
+   core->last_frame_time_usec = usec;
+}
+
+// (Un)registers the audio buffer status callback for the current frameskip
+// mode; the matching audio latency request is made from retro_run(), the
+// only place the frontend accepts it
+static void update_frameskip(void)
+{
+   if (core->frameskip_mode == FRAMESKIP_AUTO)
+   {
+      struct retro_audio_buffer_status_callback callback;
+      callback.callback = frameskip_audio_buffer_status;
+      core->audio_buffer_status_available = env_cb(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, &callback);
+   }
+   else
+   {
+      env_cb(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, NULL);
+      core->audio_buffer_status_available = false;
+   }
+
+   core->audio_buffer_active = false;
+   core->audio_buffer_occupancy = 0;
+   core->audio_buffer_underrun_likely = false;
+   core->last_frame_time_usec = 0;
+   core->frameskip_counter = 0;
+   core->frameskip_latency_changed = 1;
+}
+
+// Decides whether the frame about to be emulated is drawn
+static int frameskip_this_frame(void)
+{
+   int late;
+
+   // Movies record every frame's screen
+   if (core->frameskip_mode == FRAMESKIP_NONE || movie_recording)
+   {
+      core->frameskip_counter = 0;
+      return 0;
+   }
+
+   if (core->frameskip_mode == FRAMESKIP_FIXED)
+   {
+      if (core->frameskip_counter < core->frameskip_interval)
+      {
+         core->frameskip_counter++;
+         return 1;
+      }
+
+      core->frameskip_counter = 0;
+      return 0;
+   }
+
+   if (core->audio_buffer_status_available)
+   {
+      late = core->audio_buffer_active &&
+             (core->audio_buffer_underrun_likely || core->audio_buffer_occupancy < core->frameskip_threshold);
+   }
+   else
+   {
+      // No buffer status: a frame that took noticeably longer than the
+      // machine's frame period means the host is falling behind. The
+      // frontend reports the reference time while fast-forwarding or
+      // slowing down, so those don't trigger skipping
+      retro_usec_t reference = (retro_usec_t)(core->frame_time * 1000.0);
+      late = core->last_frame_time_usec > reference + reference / 4;
+   }
+
+   if (late && core->frameskip_counter < FRAMESKIP_AUTO_MAX)
+   {
+      core->frameskip_counter++;
+      return 1;
+   }
+
+   core->frameskip_counter = 0;
+   return 0;
+}
+
 int update_variables(int force)
 {
    int flags = 0;
@@ -958,8 +1373,8 @@ int update_variables(int force)
       int option = coreopt(env_cb, core_vars, "fuse_machine", NULL);
       option += option < 0;
 
-      if (forced_machine_at_init)
-         option = forced_machine_idx;
+      if (core->forced_machine_at_init)
+         option = core->forced_machine_idx;
 
       const machine_t *new_machine = machine_list + option;
 
@@ -979,7 +1394,7 @@ int update_variables(int force)
          }
 
          machine = new_machine;
-         frame_time = 1000.0 / (machine_id_is_60hz(machine->id) ? 60.0 : 50.0);
+         core->frame_time = 1000.0 / (machine_id_is_60hz(machine->id) ? 60.0 : 50.0);
          flags |= UPDATE_MACHINE;
       }
 
@@ -994,39 +1409,39 @@ int update_variables(int force)
          hard_width = width;
          hard_height = height;
 
-         size_border = coreopt(env_cb, core_vars, "fuse_size_border", NULL);
-         size_border += size_border < 0;
+         core->size_border = coreopt(env_cb, core_vars, "fuse_size_border", NULL);
+         core->size_border += core->size_border < 0;
 
-         if (size_border == 1)
+         if (core->size_border == 1)
          {
-            soft_width = machine->is_timex ? 576 : 288;
-            soft_height = machine->is_timex ? 432 : 216;
+            core->soft_width = machine->is_timex ? 576 : 288;
+            core->soft_height = machine->is_timex ? 432 : 216;
          }
-         else if (size_border == 2)
+         else if (core->size_border == 2)
          {
-            soft_width = machine->is_timex ? 544 : 272;
-            soft_height = machine->is_timex ? 408 : 204;
+            core->soft_width = machine->is_timex ? 544 : 272;
+            core->soft_height = machine->is_timex ? 408 : 204;
          }
-         else if (size_border == 3)
+         else if (core->size_border == 3)
          {
-            soft_width = machine->is_timex ? 528 : 264;
-            soft_height = machine->is_timex ? 396 : 198;
+            core->soft_width = machine->is_timex ? 528 : 264;
+            core->soft_height = machine->is_timex ? 396 : 198;
          }
-         else if (size_border == 4)
+         else if (core->size_border == 4)
          {
-            soft_width = machine->is_timex ? 512 : 256;
-            soft_height = machine->is_timex ? 384 : 192;
+            core->soft_width = machine->is_timex ? 512 : 256;
+            core->soft_height = machine->is_timex ? 384 : 192;
          }
          else
          {
-            soft_width = hard_width;
+            core->soft_width = hard_width;
             // 60Hz machines only have ~24 border lines above and below the
             // paper area; show a 240 (480 for Timex) line window centred on
             // the canvas so the paper stays centred with real-sized borders
-            soft_height = machine_id_is_60hz(machine->id) ? (machine->is_timex ? 480 : 240) : hard_height;
+            core->soft_height = machine_id_is_60hz(machine->id) ? (machine->is_timex ? 480 : 240) : hard_height;
          }
 
-         first_pixel = (hard_height - soft_height) / 2 * hard_width + (hard_width - soft_width) / 2;
+         core->first_pixel = (hard_height - core->soft_height) / 2 * hard_width + (hard_width - core->soft_width) / 2;
          flags |= UPDATE_AV_INFO | UPDATE_GEOMETRY;
       }
    }
@@ -1036,38 +1451,38 @@ int update_variables(int force)
       int option = coreopt(env_cb, core_vars, "fuse_size_border", NULL);
       option += option < 0;
 
-      if (option != size_border || force)
+      if (option != core->size_border || force)
       {
-         size_border = option;
+         core->size_border = option;
 
-         if (size_border == 1)
+         if (core->size_border == 1)
          {
-            soft_width = machine->is_timex ? 576 : 288;
-            soft_height = machine->is_timex ? 432 : 216;
+            core->soft_width = machine->is_timex ? 576 : 288;
+            core->soft_height = machine->is_timex ? 432 : 216;
          }
-         else if (size_border == 2)
+         else if (core->size_border == 2)
          {
-            soft_width = machine->is_timex ? 544 : 272;
-            soft_height = machine->is_timex ? 408 : 204;
+            core->soft_width = machine->is_timex ? 544 : 272;
+            core->soft_height = machine->is_timex ? 408 : 204;
          }
-         else if (size_border == 3)
+         else if (core->size_border == 3)
          {
-            soft_width = machine->is_timex ? 528 : 264;
-            soft_height = machine->is_timex ? 396 : 198;
+            core->soft_width = machine->is_timex ? 528 : 264;
+            core->soft_height = machine->is_timex ? 396 : 198;
          }
-         else if (size_border == 4)
+         else if (core->size_border == 4)
          {
-            soft_width = machine->is_timex ? 512 : 256;
-            soft_height = machine->is_timex ? 384 : 192;
+            core->soft_width = machine->is_timex ? 512 : 256;
+            core->soft_height = machine->is_timex ? 384 : 192;
          }
          else
          {
-            soft_width = hard_width;
+            core->soft_width = hard_width;
             // Same 60Hz window as above
-            soft_height = machine_id_is_60hz(machine->id) ? (machine->is_timex ? 480 : 240) : hard_height;
+            core->soft_height = machine_id_is_60hz(machine->id) ? (machine->is_timex ? 480 : 240) : hard_height;
          }
 
-         first_pixel = (hard_height - soft_height) / 2 * hard_width + (hard_width - soft_width) / 2;
+         core->first_pixel = (hard_height - core->soft_height) / 2 * hard_width + (hard_width - core->soft_width) / 2;
          flags |= UPDATE_GEOMETRY;
       }
    }
@@ -1081,17 +1496,75 @@ int update_variables(int force)
    {
       int option = coreopt(env_cb, core_vars, "fuse_palette", NULL);
       option += option < 0;
-      if (option>=0 && option<=PALETTE_COUNT-1 && current_palette!=option)
+      if (option>=0 && option<=PALETTE_COUNT-1 && core->current_palette!=option)
       {
-         current_palette = option;
-         palette = palettes[current_palette];
+         core->current_palette = option;
+         palette = palettes[core->current_palette];
          display_refresh_all();
       }
          
       
    }
 
+   {
+      const char* value;
+      int option = coreopt(env_cb, core_vars, "fuse_frameskip", &value);
+      int mode = option == 1 ? FRAMESKIP_AUTO : option > 1 ? FRAMESKIP_FIXED : FRAMESKIP_NONE;
+
+      core->frameskip_interval = mode == FRAMESKIP_FIXED ? atoi(value) : 0;
+
+      option = coreopt(env_cb, core_vars, "fuse_frameskip_threshold", &value);
+      core->frameskip_threshold = option >= 0 ? (unsigned)atoi(value) : 33;
+
+      if (mode != core->frameskip_mode)
+      {
+         core->frameskip_mode = mode;
+         update_frameskip();
+      }
+   }
+
+   {
+      const char* value;
+      int option = coreopt(env_cb, core_vars, "fuse_fast_forward", &value);
+      core->fast_forward_frames = option > 0 ? atoi(value) : 0;
+   }
+
+   display_set_batched(coreopt(env_cb, core_vars, "fuse_batched_display", NULL) == 1);
+
+   core->video_thread_requested = coreopt(env_cb, core_vars, "fuse_video_thread", NULL) == 1;
+
+   {
+      const char* value;
+      int option = coreopt(env_cb, core_vars, "fuse_scaler", &value);
+      scaler_type type = SCALER_NUM;
+      unsigned factor;
+
+      if (option > 0)
+      {
+         for (type = 0; type < SCALER_NUM; type++)
+         {
+            if (!strcmp(scaler_name(type), value))
+               break;
+         }
+      }
+
+      if (type < SCALER_NUM)
+      {
+         scaler_select_bitformat(565);
+      }
+
+      core->scaler_selected = type;
+      factor = type < SCALER_NUM ? (unsigned)scaler_get_scaling_factor(type) : 1;
+
+      if (factor != core->scaler_factor)
+      {
+         core->scaler_factor = factor;
+         flags |= UPDATE_AV_INFO | UPDATE_GEOMETRY;
+      }
+   }
+
    settings_current.auto_load = coreopt(env_cb, core_vars, "fuse_auto_load", NULL) != 1;
+   core->boot_cache_enabled = coreopt(env_cb, core_vars, "fuse_boot_cache", NULL) == 1;
 
    if (coreopt(env_cb, core_vars, "fuse_fast_load", NULL) == 0)
    {
@@ -1108,8 +1581,35 @@ int update_variables(int force)
       settings_current.slt_traps = 0;
    }
 
+   // Only the drive mechanics are sped up; disks with weak sectors (copy
+   // protection) always run at real speed, see fdd_delay()
+   fdd_turbo = coreopt(env_cb, core_vars, "fuse_fast_disk", NULL) == 1;
+
    settings_current.sound_load = coreopt(env_cb, core_vars, "fuse_load_sound", NULL) != 1;
 
+   {
+      const char* value;
+      int option = coreopt(env_cb, core_vars, "fuse_trace_buffer", &value);
+      core->exec_trace_requested = option > 0 ? (size_t)atoi(value) << 20 : 0;
+   }
+
+   {
+      const char* value;
+      int option = coreopt(env_cb, core_vars, "fuse_state_hash", &value);
+      core->state_hash_interval = option > 0 ? atoi(value) : 0;
+
+      if (!core->state_hash_interval)
+         state_hash_end();
+   }
+
+   {
+      static const char* const profile_files[] = {
+         NULL, "fuse-profile.csv", "callgrind.out.fuse", "fuse-profile.folded"
+      };
+      int option = coreopt(env_cb, core_vars, "fuse_profiler", NULL);
+      core->profile_requested = option > 0 ? profile_files[option] : NULL;
+   }
+
    {
       int option = coreopt(env_cb, core_vars, "fuse_speaker_type", NULL);
 
@@ -1121,6 +1621,20 @@ int update_variables(int force)
       settings_current.speaker_type = utils_safe_strdup(option == 1 ? "Beeper" : option == 2 ? "Unfiltered" : "TV speaker");
    }
 
+   {
+      // Fuse's sound code takes the rate from settings_current.sound_freq;
+      // sound_lowlevel_init() only falls back to 44100 for unknown rates
+      const char* value;
+      int option = coreopt(env_cb, core_vars, "fuse_sample_rate", &value);
+      int sound_freq = option >= 0 ? atoi(value) : 44100;
+
+      if (sound_freq != settings_current.sound_freq)
+      {
+         settings_current.sound_freq = sound_freq;
+         flags |= UPDATE_AV_INFO | UPDATE_SOUND;
+      }
+   }
+
    {
       int option = coreopt(env_cb, core_vars, "fuse_ay_stereo_separation", NULL);
 
@@ -1132,7 +1646,7 @@ int update_variables(int force)
       settings_current.stereo_ay = utils_safe_strdup(option == 1 ? "ACB" : option == 2 ? "ABC" : "None");
    }
 
-   keyb_transparent = coreopt(env_cb, core_vars, "fuse_key_ovrlay_transp", NULL) != 1;
+   core->keyb_transparent = coreopt(env_cb, core_vars, "fuse_key_ovrlay_transp", NULL) != 1;
 
    {
       const char* value;
@@ -1143,26 +1657,28 @@ int update_variables(int force)
 
    {
       int joystick_option = coreopt(env_cb, core_vars, "fuse_display_joystick_type", NULL);
-      show_joystick_type_at_startup = joystick_option == 1;
+      core->show_joystick_type_at_startup = joystick_option == 1;
    }
 
    {
       int speed_option = coreopt(env_cb, core_vars, "fuse_display_emulation_speed", NULL);
-      show_emulation_speed_at_startup = speed_option == 1;
+      core->show_emulation_speed_at_startup = speed_option == 1;
    }
 
-   display_joystick_type = show_joystick_type_at_startup;
-   display_emulation_speed = show_emulation_speed_at_startup;
+   core->display_joystick_type = core->show_joystick_type_at_startup;
+   core->display_emulation_speed = core->show_emulation_speed_at_startup;
 
    if (coreopt(env_cb, core_vars, "fuse_auto_size_savestate", NULL) == 0)
-      auto_size_savestate = TRUE;
+      core->auto_size_savestate = TRUE;
    else
-      auto_size_savestate = FALSE;
+      core->auto_size_savestate = FALSE;
 
    ay_turbosound_enabled = coreopt(env_cb, core_vars, "fuse_turbosound", NULL) == 1;
 
    settings_current.mouse_swap_buttons = coreopt(env_cb, core_vars, "fuse_mouse_swap_buttons", NULL) == 1;
 
+   input_latch_lazy = coreopt(env_cb, core_vars, "fuse_low_latency_input", NULL) == 1;
+
    const char* value;
    int option = coreopt(env_cb, core_vars, "fuse_joypad_up", &value );
    joymap[ RETRO_DEVICE_ID_JOYPAD_UP ] = spectrum_key_from_option(option);
@@ -1244,7 +1760,7 @@ void retro_get_system_info(struct retro_system_info *info)
    info->library_version = version;
    info->need_fullpath = false;
    info->block_extract = false;
-   info->valid_extensions = "tzx|tap|z80|rzx|scl|trd|dsk|dck|sna|szx|zip|m3u";
+   info->valid_extensions = "tzx|tap|wav|z80|rzx|scl|trd|dsk|dck|sna|szx|zip|m3u";
 }
 
 // Disk control interface (see the implementations and disk_control_ext_cb
@@ -1356,12 +1872,12 @@ void retro_init(void)
       log_cb = log.log;
    }
 
-   msg_interface_version = 0;
-   env_cb(RETRO_ENVIRONMENT_GET_MESSAGE_INTERFACE_VERSION, &msg_interface_version);
+   core->msg_interface_version = 0;
+   env_cb(RETRO_ENVIRONMENT_GET_MESSAGE_INTERFACE_VERSION, &core->msg_interface_version);
 
    machine = machine_list;
    total_time_ms = 0.0;
-   active_cheats = NULL;
+   core->active_cheats = NULL;
 
    // Always report a mouse as available so Fuse auto-grabs it at startup
    // (see fuse_init() -> ui_mouse_grab()); our ui_mouse_grab() stub in
@@ -1375,10 +1891,10 @@ void retro_init(void)
    retro_set_controller_port_device( 1, RETRO_DEVICE_KEMPSTON_JOYSTICK );
    retro_set_controller_port_device( 2, RETRO_DEVICE_SPECTRUM_KEYBOARD );
 
-   show_joystick_type_at_startup = FALSE;
-   show_emulation_speed_at_startup = FALSE;
-   display_joystick_type = FALSE;
-   display_emulation_speed = FALSE;
+   core->show_joystick_type_at_startup = FALSE;
+   core->show_emulation_speed_at_startup = FALSE;
+   core->display_joystick_type = FALSE;
+   core->display_emulation_speed = FALSE;
 }
 
 static libspectrum_id_t identify_file(const char* filename, const void* data, size_t size)
@@ -1449,9 +1965,9 @@ static void parse_m3u(const char* m3u_path, const char* data, size_t size)
    memcpy(base_dir, m3u_path, base_len);
    base_dir[base_len] = 0;
 
-   num_disk_images = 0;
+   core->num_disk_images = 0;
 
-   while (p < end && num_disk_images < MAX_DISK_IMAGES)
+   while (p < end && core->num_disk_images < MAX_DISK_IMAGES)
    {
       const char* line_start = p;
       const char* newline = memchr(p, '\n', end - p);
@@ -1489,17 +2005,17 @@ static void parse_m3u(const char* m3u_path, const char* data, size_t size)
 
       if (is_absolute || base_len == 0)
       {
-         memcpy(disk_image_paths[num_disk_images], entry, copy_len + 1);
+         memcpy(core->disk_image_paths[core->num_disk_images], entry, copy_len + 1);
       }
       else
       {
          if (base_len + copy_len > MAX_DISK_PATH_LEN - 1)
             continue;
-         memcpy(disk_image_paths[num_disk_images], base_dir, base_len);
-         memcpy(disk_image_paths[num_disk_images] + base_len, entry, copy_len + 1);
+         memcpy(core->disk_image_paths[core->num_disk_images], base_dir, base_len);
+         memcpy(core->disk_image_paths[core->num_disk_images] + base_len, entry, copy_len + 1);
       }
 
-      num_disk_images++;
+      core->num_disk_images++;
    }
 }
 
@@ -1512,11 +2028,11 @@ static bool disk_control_insert_current(void)
    libspectrum_id_t type;
    int error;
 
-   if (num_disk_images == 0 || current_disk_index >= num_disk_images)
+   if (core->num_disk_images == 0 || core->current_disk_index >= core->num_disk_images)
       return true; // "no disk" is a valid state, not a failure
 
    fuse_emulation_pause();
-   error = utils_open_file(disk_image_paths[current_disk_index], 0, &type);
+   error = utils_open_file(core->disk_image_paths[core->current_disk_index], 0, &type);
    fuse_emulation_unpause();
    display_refresh_all();
 
@@ -1550,77 +2066,77 @@ static void disk_control_eject_current(void)
 
 static bool RETRO_CALLCONV disk_set_eject_state(bool ejected)
 {
-   if (ejected == disk_tray_ejected)
+   if (ejected == core->disk_tray_ejected)
       return true;
 
    if (ejected)
    {
       disk_control_eject_current();
-      disk_tray_ejected = true;
+      core->disk_tray_ejected = true;
       return true;
    }
 
-   disk_tray_ejected = false;
+   core->disk_tray_ejected = false;
    return disk_control_insert_current();
 }
 
 static bool RETRO_CALLCONV disk_get_eject_state(void)
 {
-   return disk_tray_ejected;
+   return core->disk_tray_ejected;
 }
 
 static unsigned RETRO_CALLCONV disk_get_image_index(void)
 {
-   return current_disk_index;
+   return core->current_disk_index;
 }
 
 static bool RETRO_CALLCONV disk_set_image_index(unsigned index)
 {
-   if (!disk_tray_ejected)
+   if (!core->disk_tray_ejected)
       return false;
 
    // An index >= num_disk_images means "no disk", which is valid.
-   current_disk_index = index;
+   core->current_disk_index = index;
    return true;
 }
 
 static unsigned RETRO_CALLCONV disk_get_num_images(void)
 {
-   return num_disk_images;
+   return core->num_disk_images;
 }
 
 static bool RETRO_CALLCONV disk_replace_image_index(unsigned index, const struct retro_game_info *info)
 {
-   if (!disk_tray_ejected || index >= num_disk_images)
+   if (!core->disk_tray_ejected || index >= core->num_disk_images)
       return false;
 
    if (!info)
    {
       // Remove this index, shifting later entries down.
       unsigned i;
-      for (i = index; i + 1 < num_disk_images; i++)
-         strncpy(disk_image_paths[i], disk_image_paths[i + 1], MAX_DISK_PATH_LEN);
-      num_disk_images--;
-      if (current_disk_index > index || current_disk_index >= num_disk_images)
-         current_disk_index = current_disk_index > 0 ? current_disk_index - 1 : 0;
+      for (i = index; i + 1 < core->num_disk_images; i++)
+         strncpy(core->disk_image_paths[i], core->disk_image_paths[i + 1], MAX_DISK_PATH_LEN);
+      core->num_disk_images--;
+      if (core->current_disk_index > index || core->current_disk_index >= core->num_disk_images)
+         core->current_disk_index = core->current_disk_index > 0 ? core->current_disk_index - 1 : 0;
       return true;
    }
 
    if (!info->path)
       return false;
 
-   strncpy(disk_image_paths[index], info->path, MAX_DISK_PATH_LEN - 1);
-   disk_image_paths[index][MAX_DISK_PATH_LEN - 1] = 0;
+   strncpy(core->disk_image_paths[index], info->path, MAX_DISK_PATH_LEN - 1);
+   core->disk_image_paths[index][MAX_DISK_PATH_LEN - 1] = 0;
    return true;
 }
 
 static bool RETRO_CALLCONV disk_add_image_index(void)
 {
-   if (num_disk_images >= MAX_DISK_IMAGES)
+   if (core->num_disk_images >= MAX_DISK_IMAGES)
       return false;
 
-   disk_image_paths[num_disk_images][0] = 0;
-   num_disk_images++;
+   core->disk_image_paths[core->num_disk_images][0] = 0;
+   core->num_disk_images++;
    return true;
 }
 
@@ -1629,18 +2145,18 @@ static bool RETRO_CALLCONV disk_set_initial_image(unsigned index, const char *pa
    if (!path)
       return false;
 
-   initial_disk_index_hint = (int)index;
-   strncpy(initial_disk_path_hint, path, MAX_DISK_PATH_LEN - 1);
-   initial_disk_path_hint[MAX_DISK_PATH_LEN - 1] = 0;
+   core->initial_disk_index_hint = (int)index;
+   strncpy(core->initial_disk_path_hint, path, MAX_DISK_PATH_LEN - 1);
+   core->initial_disk_path_hint[MAX_DISK_PATH_LEN - 1] = 0;
    return true;
 }
 
 static bool RETRO_CALLCONV disk_get_image_path(unsigned index, char *path, size_t len)
 {
-   if (index >= num_disk_images || disk_image_paths[index][0] == 0)
+   if (index >= core->num_disk_images || core->disk_image_paths[index][0] == 0)
       return false;
 
-   strncpy(path, disk_image_paths[index], len - 1);
+   strncpy(path, core->disk_image_paths[index], len - 1);
    path[len - 1] = 0;
    return true;
 }
@@ -1649,12 +2165,12 @@ static bool RETRO_CALLCONV disk_get_image_label(unsigned index, char *label, siz
 {
    const char *slash1, *slash2, *base;
 
-   if (index >= num_disk_images || disk_image_paths[index][0] == 0)
+   if (index >= core->num_disk_images || core->disk_image_paths[index][0] == 0)
       return false;
 
-   slash1 = strrchr(disk_image_paths[index], '/');
-   slash2 = strrchr(disk_image_paths[index], '\\');
-   base = slash1 > slash2 ? slash1 + 1 : (slash2 ? slash2 + 1 : disk_image_paths[index]);
+   slash1 = strrchr(core->disk_image_paths[index], '/');
+   slash2 = strrchr(core->disk_image_paths[index], '\\');
+   base = slash1 > slash2 ? slash1 + 1 : (slash2 ? slash2 + 1 : core->disk_image_paths[index]);
 
    strncpy(label, base, len - 1);
    label[len - 1] = 0;
@@ -1674,35 +2190,193 @@ static struct retro_disk_control_ext_callback disk_control_ext_cb = {
    disk_get_image_label,
 };
 
-#ifndef GIT_VERSION
-extern const char* fuse_gitstamp;
-#endif
-
-bool retro_load_game(const struct retro_game_info *info)
+// Number of 16K pages of RAM[] exposed as RETRO_MEMORY_SYSTEM_RAM. RAM[]
+// uses the 128K bank numbering on every model (a 48K machine lives in banks
+// 5, 2 and 0), so all machines up to 128K expose the same 8 banks.
+static size_t machine_ram_pages(void)
 {
-#ifndef GIT_VERSION
-   log_cb( RETRO_LOG_INFO, "\n%s\n", fuse_gitstamp );
-#endif
-
-   enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_RGB565;
+   libspectrum_machine id = machine_current ? machine_current->machine : machine->id;
 
-   if (!env_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+   switch (id)
    {
-      log_cb(RETRO_LOG_ERROR, "RGB565 is not supported\n");
-      return false;
+      case LIBSPECTRUM_MACHINE_SE:       return 9;
+      case LIBSPECTRUM_MACHINE_SCORP:    return 16;
+      case LIBSPECTRUM_MACHINE_PENT512:  return 32;
+      case LIBSPECTRUM_MACHINE_PENT1024: return 64;
+      default:                           return 8;
    }
+}
 
-   env_cb(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, input_descriptors);
-   memset(joyp_state, 0, sizeof(joyp_state));
-   memset(keyb_state, 0, sizeof(keyb_state));
-   hard_width = hard_height = soft_width = soft_height = 0;
-   select_pressed = keyb_overlay = 0;
-   keyb_x = keyb_y = 0;
-   keyb_send = 0;
-   snapshot_buffer = NULL;
-   snapshot_size = 0;
+// Publishes the memory map: the whole of RAM[] as a flat system RAM block
+// at MEMORY_MAP_RAM_START, which never moves, plus the Z80 view of the
+// 64K address space as currently paged in, ROM included. The Z80 view is
+// one descriptor per run of contiguous 2K pages, so it's usually one for
+// each 16K slot. retro_run() calls this once per frame, and the map is only
+// re-published when paging has changed since then.
+#define MEMORY_MAP_RAM_START 0x100000
 
-   char *argv[] = {
+static void update_memory_maps(int force)
+{
+   struct retro_memory_descriptor desc[MEMORY_PAGES_IN_64K + 1];
+   struct retro_memory_map memory_map;
+   size_t ram_pages = machine_ram_pages();
+   unsigned i, count = 0;
+
+   if (!force && ram_pages == core->memory_map_published_ram)
+   {
+      for (i = 0; i < MEMORY_PAGES_IN_64K; i++)
+      {
+         if (memory_map_read[i].page != core->memory_map_published[i])
+            break;
+      }
+
+      if (i == MEMORY_PAGES_IN_64K)
+         return;
+   }
+
+   memset(desc, 0, sizeof(desc));
+
+   for (i = 0; i < MEMORY_PAGES_IN_64K; i++)
+   {
+      memory_page *page = &memory_map_read[i];
+      uint64_t flags = page->writable ? 0 : RETRO_MEMDESC_CONST;
+
+      core->memory_map_published[i] = page->page;
+
+      // Unmapped areas (e.g. the top 32K of a 16K machine) have no data
+      if (!page->page)
+         continue;
+
+      // Grow the previous descriptor if this page follows on from it
+      if (count > 0 &&
+          desc[count - 1].flags == flags &&
+          desc[count - 1].start + desc[count - 1].len == i * MEMORY_PAGE_SIZE &&
+          (libspectrum_byte*)desc[count - 1].ptr + desc[count - 1].len == page->page)
+      {
+         desc[count - 1].len += MEMORY_PAGE_SIZE;
+         continue;
+      }
+
+      desc[count].flags = flags;
+      desc[count].ptr   = page->page;
+      desc[count].start = i * MEMORY_PAGE_SIZE;
+      desc[count].len   = MEMORY_PAGE_SIZE;
+      count++;
+   }
+
+   desc[count].flags = RETRO_MEMDESC_SYSTEM_RAM;
+   desc[count].ptr   = RAM;
+   desc[count].start = MEMORY_MAP_RAM_START;
+   desc[count].len   = ram_pages * 0x4000;
+   count++;
+
+   core->memory_map_published_ram = ram_pages;
+
+   memory_map.descriptors = desc;
+   memory_map.num_descriptors = count;
+   env_cb(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, &memory_map);
+}
+
+// Compressed content is inflated on a helper thread while fuse_init() runs
+// and the result handed to libspectrum's decompression cache, which then
+// serves the identify and load passes and every later reset. The helper
+// mustn't report errors, as the UI error code isn't thread safe, so
+// libspectrum's error callback is only installed once it has been joined;
+// a corrupt file is then reported from here, and in full when it's loaded.
+typedef struct
+{
+   compat_thread thread;
+   libspectrum_id_t type;
+   const libspectrum_byte* data;
+   size_t size;
+   libspectrum_byte* buffer;
+   size_t length;
+   libspectrum_error error;
+}
+content_inflate_t;
+
+static void inflate_content(void* data)
+{
+   content_inflate_t* inflate = (content_inflate_t*)data;
+   inflate->error = libspectrum_uncompress(&inflate->buffer, &inflate->length, inflate->type, inflate->data, inflate->size);
+}
+
+static void start_content_inflate(content_inflate_t* inflate, const struct retro_game_info* info)
+{
+   libspectrum_class_t class;
+
+   inflate->thread = NULL;
+   libspectrum_error_function = ui_libspectrum_error;
+
+   if (!info || !info->data || info->size == 0 ||
+       libspectrum_identify_file_raw(&inflate->type, info->path, (const unsigned char*)info->data, info->size) ||
+       libspectrum_identify_class(&class, inflate->type) ||
+       class != LIBSPECTRUM_CLASS_COMPRESSED)
+   {
+      return;
+   }
+
+   inflate->data = (const libspectrum_byte*)info->data;
+   inflate->size = info->size;
+   inflate->buffer = NULL;
+
+   libspectrum_error_function = NULL;
+   inflate->thread = compat_thread_create(inflate_content, inflate);
+
+   if (!inflate->thread)
+      libspectrum_error_function = ui_libspectrum_error;
+}
+
+static void finish_content_inflate(content_inflate_t* inflate, int keep)
+{
+   if (!inflate->thread)
+      return;
+
+   compat_thread_join(inflate->thread);
+   inflate->thread = NULL;
+   libspectrum_error_function = ui_libspectrum_error;
+
+   if (inflate->error)
+   {
+      log_cb(RETRO_LOG_ERROR, "Could not decompress the content (error %d)\n", inflate->error);
+      return;
+   }
+
+   if (keep)
+      libspectrum_uncompress_cache_add(inflate->type, inflate->data, inflate->size, inflate->buffer, inflate->length);
+   else
+      libspectrum_free(inflate->buffer);
+}
+
+#ifndef GIT_VERSION
+extern const char* fuse_gitstamp;
+#endif
+
+bool retro_load_game(const struct retro_game_info *info)
+{
+#ifndef GIT_VERSION
+   log_cb( RETRO_LOG_INFO, "\n%s\n", fuse_gitstamp );
+#endif
+
+   enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_RGB565;
+
+   if (!env_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+   {
+      log_cb(RETRO_LOG_ERROR, "RGB565 is not supported\n");
+      return false;
+   }
+
+   env_cb(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, input_descriptors);
+   memset(joyp_state, 0, sizeof(joyp_state));
+   memset(keyb_state, 0, sizeof(keyb_state));
+   hard_width = hard_height = core->soft_width = core->soft_height = 0;
+   select_pressed = keyb_overlay = 0;
+   keyb_x = keyb_y = 0;
+   keyb_send = 0;
+   snapshot_buffer = NULL;
+   snapshot_size = 0;
+
+   char *argv[] = {
       "fuse",
    };
 
@@ -1713,16 +2387,21 @@ bool retro_load_game(const struct retro_game_info *info)
       const char *ext_f = strrchr(info->path, '.');
       if (ext_f != NULL && strcmp(ext_f, ".dck") == 0)
       {
-         forced_machine_at_init = 1;
+         core->forced_machine_at_init = 1;
          /* LIBSPECTRUM_MACHINE_TS2068 position in machine_list */
-         forced_machine_idx = 10;
+         core->forced_machine_idx = 10;
       }
    }
    
-   fuse_init_called = 1;
+   content_inflate_t inflate;
+   start_content_inflate(&inflate, info);
+
+   core->fuse_init_called = 1;
 
    if (fuse_init(sizeof(argv) / sizeof(argv[0]), argv) == 0)
    {
+      finish_content_inflate(&inflate, 1);
+
       if (info && info->size != 0)
       {
          tape_size = info->size;
@@ -1756,10 +2435,10 @@ bool retro_load_game(const struct retro_game_info *info)
                       m3u_ext[4] == 0;
          }
 
-         num_disk_images = 0;
-         current_disk_index = 0;
-         disk_tray_ejected = false;
-         content_is_m3u = is_m3u;
+         core->num_disk_images = 0;
+         core->current_disk_index = 0;
+         core->disk_tray_ejected = false;
+         core->content_is_m3u = is_m3u;
 
          if (is_m3u)
          {
@@ -1769,19 +2448,20 @@ bool retro_load_game(const struct retro_game_info *info)
             // text for a raw TRD image, see identify_file()'s fallback).
             parse_m3u(filename_load_game, (const char*)tape_data, tape_size);
 
-            if (initial_disk_index_hint >= 0 &&
-                (unsigned)initial_disk_index_hint < num_disk_images &&
-                strcmp(disk_image_paths[initial_disk_index_hint], initial_disk_path_hint) == 0)
+            if (core->initial_disk_index_hint >= 0 &&
+                (unsigned)core->initial_disk_index_hint < core->num_disk_images &&
+                strcmp(core->disk_image_paths[core->initial_disk_index_hint], core->initial_disk_path_hint) == 0)
             {
-               current_disk_index = (unsigned)initial_disk_index_hint;
+               core->current_disk_index = (unsigned)core->initial_disk_index_hint;
             }
 
-            if (num_disk_images > 0)
+            if (core->num_disk_images > 0)
             {
                libspectrum_id_t type;
 
                fuse_emulation_pause();
-               utils_open_file(disk_image_paths[current_disk_index], settings_current.auto_load, &type);
+               utils_open_file(core->disk_image_paths[core->current_disk_index], settings_current.auto_load, &type);
+               boot_cache_restore();
                display_refresh_all();
                fuse_emulation_unpause();
             }
@@ -1792,7 +2472,7 @@ bool retro_load_game(const struct retro_game_info *info)
             libspectrum_id_t type;
             libspectrum_class_t class;
 
-            if (forced_machine_at_init && forced_machine_idx == 10)  /* LIBSPECTRUM_MACHINE_TS2068 position in machine_list */
+            if (core->forced_machine_at_init && core->forced_machine_idx == 10)  /* LIBSPECTRUM_MACHINE_TS2068 position in machine_list */
             {
                type = LIBSPECTRUM_ID_CARTRIDGE_DCK;
                class = LIBSPECTRUM_CLASS_CARTRIDGE_TIMEX;
@@ -1837,6 +2517,7 @@ bool retro_load_game(const struct retro_game_info *info)
 
             fuse_emulation_pause();
             utils_open_file(filename, autoload, &type);
+            boot_cache_restore();
             display_refresh_all();
             fuse_emulation_unpause();
 
@@ -1848,9 +2529,9 @@ bool retro_load_game(const struct retro_game_info *info)
                 class == LIBSPECTRUM_CLASS_DISK_PLUSD   || class == LIBSPECTRUM_CLASS_DISK_TRDOS     ||
                 class == LIBSPECTRUM_CLASS_DISK_OPUS    || class == LIBSPECTRUM_CLASS_DISK_GENERIC))
             {
-               strncpy(disk_image_paths[0], filename_load_game, MAX_DISK_PATH_LEN - 1);
-               disk_image_paths[0][MAX_DISK_PATH_LEN - 1] = 0;
-               num_disk_images = 1;
+               strncpy(core->disk_image_paths[0], filename_load_game, MAX_DISK_PATH_LEN - 1);
+               core->disk_image_paths[0][MAX_DISK_PATH_LEN - 1] = 0;
+               core->num_disk_images = 1;
             }
          }
       }
@@ -1859,273 +2540,1209 @@ bool retro_load_game(const struct retro_game_info *info)
          // Load the _BASIC.z80 content to boot to BASIC
          tape_data = NULL;
          tape_size = 0;
-         num_disk_images = 0;
-         current_disk_index = 0;
-         disk_tray_ejected = false;
-         content_is_m3u = 0;
+         core->num_disk_images = 0;
+         core->current_disk_index = 0;
+         core->disk_tray_ejected = false;
+         core->content_is_m3u = 0;
       }
 
-      // Enable read/write on all disk drives
-      int i;
+      // Enable read/write on all disk drives
+      int i;
+
+      for (i = 0; i < 2; i++)
+      {
+         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_PLUS3, i, 0);
+         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_PLUSD, i, 0);
+         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_OPUS, i, 0);
+         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_DISCIPLE, i, 0);
+      }
+
+      for (i = 0; i < 4; i++)
+      {
+         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_BETA, i, 0);
+      }
+
+      for (i = 0; i < 8; i++)
+      {
+         if1_mdr_writeprotect( i, 0 );
+      }
+
+      // Set up memory map interface
+      update_memory_maps(1);
+
+      // The frame time is only used as a fallback by auto frameskip, for
+      // frontends that don't report their audio buffer status
+      {
+         struct retro_frame_time_callback frame_time_callback;
+         frame_time_callback.callback = frameskip_frame_time;
+         frame_time_callback.reference = (retro_usec_t)(core->frame_time * 1000.0);
+         env_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_time_callback);
+      }
+
+      // Re-apply the live controller-port wiring: if a frontend assigned
+      // RETRO_DEVICE_KEMPSTON_MOUSE before retro_load_game(), fuse_init()'s
+      // settings_defaults() has just wiped settings_current.kempston_mouse
+      // (and the deferral flag was never armed because fuse_init_called was
+      // still 0); likewise, loading snapshot content re-derives the flag
+      // from the file via kempmouse_snapshot_enabled(). Port wiring is
+      // frontend state, not machine state - see retro_unserialize().
+      sync_kempston_mouse_from_ports();
+
+      return true;
+   }
+
+   finish_content_inflate(&inflate, 0);
+   return false;
+}
+
+size_t retro_get_memory_size(unsigned id)
+{
+   if (id == RETRO_MEMORY_SYSTEM_RAM && core->fuse_init_called)
+      return machine_ram_pages() * 0x4000;
+
+   return 0;
+}
+
+void *retro_get_memory_data(unsigned id)
+{
+   if (id == RETRO_MEMORY_SYSTEM_RAM && core->fuse_init_called)
+      return RAM;
+
+   return NULL;
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb)
+{
+   video_cb = cb;
+}
+
+void retro_set_audio_sample(retro_audio_sample_t cb)
+{
+   (void)cb;
+}
+
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb)
+{
+   audio_cb = cb;
+}
+
+void retro_set_input_state(retro_input_state_t cb)
+{
+   input_state_cb = cb;
+}
+
+void retro_set_input_poll(retro_input_poll_t cb)
+{
+   input_poll_cb = cb;
+}
+
+static unsigned scaler_scale(void)
+{
+   return core->scaler_selected < SCALER_NUM && !machine->is_timex ? core->scaler_factor : 1;
+}
+
+// The visible part of the picture and how it is scaled. The video helper
+// thread keeps the one each frame was submitted with
+typedef struct
+{
+   unsigned first_pixel, pitch, width, height, scale;
+   scaler_type scaler;
+}
+picture_layout_t;
+
+static void get_picture_layout(picture_layout_t* layout)
+{
+   layout->first_pixel = core->first_pixel;
+   layout->pitch = hard_width;
+   layout->width = core->soft_width;
+   layout->height = core->soft_height;
+   layout->scale = scaler_scale();
+   layout->scaler = core->scaler_selected;
+}
+
+static void get_geometry(struct retro_game_geometry* geometry)
+{
+   unsigned scale = scaler_scale();
+
+   // Here we use the "soft" resolution that is changed according to the
+   // fuse_size_border variable, enlarged by the scaler if there is one
+   geometry->base_width = core->soft_width * scale;
+   geometry->base_height = core->soft_height * scale;
+
+   // The unscaled Timex picture is as large as a Spectrum one scaled by 2x
+   geometry->max_width = core->scaler_factor > 2 ? MAX_WIDTH / 2 * core->scaler_factor : MAX_WIDTH;
+   geometry->max_height = core->scaler_factor > 2 ? MAX_HEIGHT / 2 * core->scaler_factor : MAX_HEIGHT;
+   geometry->aspect_ratio = 0.0f;
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+   // Report the currently visible output geometry.
+   get_geometry(&info->geometry);
+   info->timing.fps = machine_id_is_60hz(machine->id) ? 60.0 : 50.0;
+   info->timing.sample_rate = settings_current.sound_freq;
+}
+
+// What the keyboard overlay looks like in a frame, taken on the emulation
+// thread so that the overlay can be drawn on the video thread
+typedef struct
+{
+   int is_timex;
+   int transparent;
+   unsigned keyb_x, keyb_y;
+   unsigned width;
+}
+overlay_state_t;
+
+static void get_overlay_state(overlay_state_t* state)
+{
+   state->is_timex = machine->is_timex;
+   state->transparent = core->keyb_transparent;
+   state->keyb_x = keyb_x;
+   state->keyb_y = keyb_y;
+   state->width = hard_width;
+}
+
+// The keyboard overlay scaled up for the Timex modes and, when it is
+// transparent, premultiplied: masking off the two low bits of each channel
+// before dividing by four keeps every channel's sum inside its own bits, so
+// blending is a mask, a shift and an add per 16 bit pixel with the same
+// result as working out (overlay * 3 + picture) / 4 a channel at a time
+static struct
+{
+   int valid;
+   int is_timex, transparent;
+   uint16_t pixels[480 * 640];
+}
+overlay_cache;
+
+// What image_buffer_2 holds when valid: the overlay composited with the
+// picture and the highlight drawn for state. Only the lines reported by
+// uidisplay_area() have to be blended again
+static struct
+{
+   int valid;
+   overlay_state_t state;
+}
+overlay_composite;
+
+static void update_overlay_cache(const overlay_state_t* state)
+{
+   if (overlay_cache.valid && overlay_cache.is_timex == state->is_timex && overlay_cache.transparent == state->transparent)
+   {
+      return;
+   }
+
+   unsigned scale = state->is_timex ? 2 : 1;
+   unsigned width = 320 * scale;
+   unsigned x, y, i, j;
+
+   for (y = 0; y < 240; y++)
+   {
+      for (x = 0; x < 320; x++)
+      {
+         uint16_t pixel = keyboard_overlay[y * 320 + x];
+
+         if (state->transparent)
+         {
+            pixel = ((pixel & 0xe79c) >> 2) * 3;
+         }
+
+         for (j = 0; j < scale; j++)
+         {
+            for (i = 0; i < scale; i++)
+            {
+               overlay_cache.pixels[(y * scale + j) * width + x * scale + i] = pixel;
+            }
+         }
+      }
+   }
+
+   overlay_cache.is_timex = state->is_timex;
+   overlay_cache.transparent = state->transparent;
+   overlay_cache.valid = 1;
+   overlay_composite.valid = 0;
+}
+
+static void blend_overlay_line(uint16_t* dest, const uint16_t* overlay, const uint16_t* source, unsigned count)
+{
+   unsigned n = 0;
+
+#if defined(VIDEO_SIMD_SSE2)
+   const __m128i mask = _mm_set1_epi16((short)0xe79c);
+
+   for (; n + 8 <= count; n += 8)
+   {
+      __m128i pixels = _mm_and_si128(_mm_loadu_si128((const __m128i*)(source + n)), mask);
+      __m128i blended = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(overlay + n)), _mm_srli_epi16(pixels, 2));
+      _mm_storeu_si128((__m128i*)(dest + n), blended);
+   }
+#elif defined(VIDEO_SIMD_NEON)
+   const uint16x8_t mask = vdupq_n_u16(0xe79c);
+
+   for (; n + 8 <= count; n += 8)
+   {
+      uint16x8_t pixels = vandq_u16(vld1q_u16(source + n), mask);
+      vst1q_u16(dest + n, vaddq_u16(vld1q_u16(overlay + n), vshrq_n_u16(pixels, 2)));
+   }
+#endif
+
+   for (; n < count; n++)
+   {
+      dest[n] = overlay[n] + ((source[n] & 0xe79c) >> 2);
+   }
+}
+
+// Composites the overlay with the picture in source into output, only on
+// the lines flagged in dirty unless it is NULL. The opaque overlay doesn't
+// depend on the picture, so then there is nothing to do for dirty lines
+static void composite_overlay(uint16_t* output, const uint16_t* source, const overlay_state_t* state, const uint8_t* dirty)
+{
+   unsigned scale = state->is_timex ? 2 : 1;
+   unsigned width = 320 * scale;
+   unsigned top = 24 * scale; // Centre the 240px overlay in the 288px canvas
+   unsigned y;
+
+   if (dirty && !state->transparent)
+   {
+      return;
+   }
+
+   for (y = 0; y < 240 * scale; y++)
+   {
+      unsigned offset = (top + y) * state->width;
+
+      if (dirty && !dirty[top + y])
+      {
+         continue;
+      }
+
+      if (state->transparent)
+      {
+         blend_overlay_line(output + offset, overlay_cache.pixels + y * width, source + offset, width);
+      }
+      else
+      {
+         memcpy(output + offset, overlay_cache.pixels + y * width, width * sizeof(uint16_t));
+      }
+   }
+}
+
+static void invert_pixels(uint16_t* pixel, unsigned count, unsigned lines, unsigned stride)
+{
+   unsigned i;
+
+   for (; lines > 0; --lines, pixel += stride)
+   {
+      for (i = 0; i < count; i++)
+      {
+         pixel[i] = ~pixel[i];
+      }
+   }
+}
+
+// Inverts the highlighted key, a rectangle with its corners cut off.
+// Doing it twice restores what was there
+static void toggle_highlight(uint16_t* output, const overlay_state_t* state)
+{
+   unsigned x = keyb_positions[state->keyb_y].x + state->keyb_x * 24;
+   unsigned y = keyb_positions[state->keyb_y].y + 24; // Offset highlighting by 24px
+   unsigned width = 23;
+
+   if (state->keyb_y == 3)
+   {
+      if (state->keyb_x == 8)
+      {
+         width = 24;
+      }
+      else if (state->keyb_x == 9)
+      {
+         x++;
+         width = 30;
+      }
+   }
+
+   unsigned mult = state->is_timex ? 2 : 1;
+   uint16_t* pixel = output + (y * state->width + x) * mult;
+
+   invert_pixels(pixel + mult, (width - 2) * mult, mult, state->width);
+   invert_pixels(pixel + mult * state->width, width * mult, 22 * mult, state->width);
+   invert_pixels(pixel + 23 * mult * state->width + mult, (width - 2) * mult, mult, state->width);
+}
+
+// Draws the keyboard overlay over the picture in source into output
+static void draw_overlay(uint16_t* output, const uint16_t* source, const overlay_state_t* state)
+{
+   composite_overlay(output, source, state, NULL);
+   toggle_highlight(output, state);
+}
+
+// Brings the composited overlay in image_buffer_2 up to date: the old
+// highlight is inverted back, the lines that changed blended again and
+// the new highlight drawn
+static void update_overlay(const overlay_state_t* state)
+{
+   if (overlay_composite.valid && overlay_composite.state.width == state->width)
+   {
+      toggle_highlight(core->image_buffer_2, &overlay_composite.state);
+      composite_overlay(core->image_buffer_2, image_buffer, state, image_buffer_dirty);
+   }
+   else
+   {
+      composite_overlay(core->image_buffer_2, image_buffer, state, NULL);
+   }
+
+   toggle_highlight(core->image_buffer_2, state);
+
+   overlay_composite.state = *state;
+   overlay_composite.valid = 1;
+   memset(image_buffer_dirty, 0, sizeof(image_buffer_dirty));
+}
+
+// The scaler runs over a copy of the visible picture with its edges
+// repeated around it, as the scalers look at the pixels next to the ones
+// they are drawing. Timex machines aren't scaled, so this is only ever
+// a Spectrum sized picture
+#define SCALER_PAD 2
+#define SCALER_BANDS 4
+
+static uint16_t scaler_source[(320 + 2 * SCALER_PAD) * (288 + 2 * SCALER_PAD)];
+static uint16_t scaler_output[320 * 4 * 288 * 4];
+
+// The picture is split into horizontal bands that are scaled at the same
+// time, one on the calling thread and the others on helper threads. Bands
+// start on even lines, as the dot matrix pattern repeats every two lines
+static struct
+{
+   int started, running, quit, pending;
+   ScalerProc* proc;
+   uint16_t* output;
+   unsigned width, height, stride, factor;
+   compat_mutex mutex;
+   compat_cond done_cond;
+   compat_cond work_cond[SCALER_BANDS - 1];
+   compat_thread thread[SCALER_BANDS - 1];
+   int busy[SCALER_BANDS - 1];
+}
+scaler_pool;
+
+#if defined(VIDEO_SIMD_SSE2) || defined(VIDEO_SIMD_NEON)
+// Fuse's scaler_AdvMame2x eight pixels at a time: each pixel becomes four,
+// each taking the colour of the two neighbours next to it when they match
+// and the other two don't
+static void scale_advmame2x(const libspectrum_byte* src_ptr, libspectrum_dword src_pitch, libspectrum_byte* dst_ptr, libspectrum_dword dst_pitch, int width, int height)
+{
+   unsigned src_line = src_pitch / sizeof(uint16_t);
+   unsigned dst_line = dst_pitch / sizeof(uint16_t);
+   const uint16_t* p = (const uint16_t*)src_ptr;
+   uint16_t* q = (uint16_t*)dst_ptr;
+
+   for (; height > 0; height--, p += src_line, q += dst_line * 2)
+   {
+      int x = 0;
+
+#if defined(VIDEO_SIMD_SSE2)
+      for (; x + 8 <= width; x += 8)
+      {
+         __m128i b = _mm_loadu_si128((const __m128i*)(p + x - src_line));
+         __m128i d = _mm_loadu_si128((const __m128i*)(p + x - 1));
+         __m128i e = _mm_loadu_si128((const __m128i*)(p + x));
+         __m128i f = _mm_loadu_si128((const __m128i*)(p + x + 1));
+         __m128i h = _mm_loadu_si128((const __m128i*)(p + x + src_line));
+
+         __m128i db = _mm_cmpeq_epi16(d, b);
+         __m128i bf = _mm_cmpeq_epi16(b, f);
+         __m128i dh = _mm_cmpeq_epi16(d, h);
+         __m128i hf = _mm_cmpeq_epi16(h, f);
+
+         __m128i m0 = _mm_andnot_si128(_mm_or_si128(bf, dh), db);
+         __m128i m1 = _mm_andnot_si128(_mm_or_si128(db, hf), bf);
+         __m128i m2 = _mm_andnot_si128(_mm_or_si128(db, hf), dh);
+         __m128i m3 = _mm_andnot_si128(_mm_or_si128(dh, bf), hf);
+
+         __m128i e0 = _mm_or_si128(_mm_and_si128(m0, d), _mm_andnot_si128(m0, e));
+         __m128i e1 = _mm_or_si128(_mm_and_si128(m1, f), _mm_andnot_si128(m1, e));
+         __m128i e2 = _mm_or_si128(_mm_and_si128(m2, d), _mm_andnot_si128(m2, e));
+         __m128i e3 = _mm_or_si128(_mm_and_si128(m3, f), _mm_andnot_si128(m3, e));
+
+         _mm_storeu_si128((__m128i*)(q + 2 * x), _mm_unpacklo_epi16(e0, e1));
+         _mm_storeu_si128((__m128i*)(q + 2 * x + 8), _mm_unpackhi_epi16(e0, e1));
+         _mm_storeu_si128((__m128i*)(q + dst_line + 2 * x), _mm_unpacklo_epi16(e2, e3));
+         _mm_storeu_si128((__m128i*)(q + dst_line + 2 * x + 8), _mm_unpackhi_epi16(e2, e3));
+      }
+#else
+      for (; x + 8 <= width; x += 8)
+      {
+         uint16x8_t b = vld1q_u16(p + x - src_line);
+         uint16x8_t d = vld1q_u16(p + x - 1);
+         uint16x8_t e = vld1q_u16(p + x);
+         uint16x8_t f = vld1q_u16(p + x + 1);
+         uint16x8_t h = vld1q_u16(p + x + src_line);
+
+         uint16x8_t db = vceqq_u16(d, b);
+         uint16x8_t bf = vceqq_u16(b, f);
+         uint16x8_t dh = vceqq_u16(d, h);
+         uint16x8_t hf = vceqq_u16(h, f);
+
+         uint16x8x2_t top, bottom;
+
+         top.val[0] = vbslq_u16(vbicq_u16(db, vorrq_u16(bf, dh)), d, e);
+         top.val[1] = vbslq_u16(vbicq_u16(bf, vorrq_u16(db, hf)), f, e);
+         bottom.val[0] = vbslq_u16(vbicq_u16(dh, vorrq_u16(db, hf)), d, e);
+         bottom.val[1] = vbslq_u16(vbicq_u16(hf, vorrq_u16(dh, bf)), f, e);
+
+         vst2q_u16(q + 2 * x, top);
+         vst2q_u16(q + dst_line + 2 * x, bottom);
+      }
+#endif
+
+      for (; x < width; x++)
+      {
+         uint16_t b = p[x - src_line], d = p[x - 1], e = p[x], f = p[x + 1], h = p[x + src_line];
+
+         q[2 * x] = d == b && b != f && d != h ? d : e;
+         q[2 * x + 1] = b == f && b != d && f != h ? f : e;
+         q[dst_line + 2 * x] = d == h && d != b && h != f ? d : e;
+         q[dst_line + 2 * x + 1] = h == f && d != h && b != f ? f : e;
+      }
+   }
+}
+#endif
+
+static void scale_band(unsigned band)
+{
+   unsigned lines = (scaler_pool.height / SCALER_BANDS) & ~1u;
+   unsigned first = band * lines;
+   unsigned out_stride = scaler_pool.width * scaler_pool.factor;
+
+   if (band == SCALER_BANDS - 1)
+   {
+      lines = scaler_pool.height - first;
+   }
+
+   scaler_pool.proc((const libspectrum_byte*)(scaler_source + (first + SCALER_PAD) * scaler_pool.stride + SCALER_PAD),
+               scaler_pool.stride * sizeof(uint16_t),
+               (libspectrum_byte*)(scaler_pool.output + first * scaler_pool.factor * out_stride),
+               out_stride * sizeof(uint16_t), scaler_pool.width, lines);
+}
+
+static void scaler_thread_main(void* data)
+{
+   unsigned helper = (unsigned)(uintptr_t)data;
+
+   compat_mutex_lock(scaler_pool.mutex);
+
+   for (;;)
+   {
+      while (!scaler_pool.busy[helper] && !scaler_pool.quit)
+         compat_cond_wait(scaler_pool.work_cond[helper], scaler_pool.mutex);
+
+      if (scaler_pool.quit)
+         break;
+
+      compat_mutex_unlock(scaler_pool.mutex);
+      scale_band(helper + 1);
+      compat_mutex_lock(scaler_pool.mutex);
+
+      scaler_pool.busy[helper] = 0;
+
+      if (--scaler_pool.pending == 0)
+         compat_cond_signal(scaler_pool.done_cond);
+   }
+
+   compat_mutex_unlock(scaler_pool.mutex);
+}
+
+static void scaler_pool_stop(void)
+{
+   int i;
+
+   if (scaler_pool.running)
+   {
+      compat_mutex_lock(scaler_pool.mutex);
+      scaler_pool.quit = 1;
+
+      for (i = 0; i < scaler_pool.running; i++)
+         compat_cond_signal(scaler_pool.work_cond[i]);
+
+      compat_mutex_unlock(scaler_pool.mutex);
+
+      for (i = 0; i < scaler_pool.running; i++)
+         compat_thread_join(scaler_pool.thread[i]);
+   }
+
+   for (i = 0; i < SCALER_BANDS - 1; i++)
+   {
+      if (scaler_pool.work_cond[i]) compat_cond_destroy(scaler_pool.work_cond[i]);
+   }
+
+   if (scaler_pool.done_cond) compat_cond_destroy(scaler_pool.done_cond);
+   if (scaler_pool.mutex) compat_mutex_destroy(scaler_pool.mutex);
+
+   memset(&scaler_pool, 0, sizeof(scaler_pool));
+}
+
+// Starts as many helpers as it can, the bands left over are scaled on the
+// calling thread. Only tried once until scaler_pool_stop()
+static void scaler_pool_start(void)
+{
+   scaler_pool.started = 1;
+   scaler_pool.mutex = compat_mutex_create();
+   scaler_pool.done_cond = compat_cond_create();
+
+   if (!scaler_pool.mutex || !scaler_pool.done_cond)
+      return;
+
+   while (scaler_pool.running < SCALER_BANDS - 1)
+   {
+      int i = scaler_pool.running;
+
+      scaler_pool.work_cond[i] = compat_cond_create();
+
+      if (!scaler_pool.work_cond[i])
+         break;
+
+      scaler_pool.thread[i] = compat_thread_create(scaler_thread_main, (void*)(uintptr_t)i);
+
+      if (!scaler_pool.thread[i])
+         break;
+
+      scaler_pool.running++;
+   }
+}
+
+// Scales the visible part of picture into output, which is the size of
+// scaler_output. Only one thread scales at a time: the emulation thread, or
+// the video helper while it has a frame (see video_thread_present())
+static void scale_picture(const uint16_t* picture, const picture_layout_t* layout, uint16_t* output)
+{
+   unsigned stride = layout->width + 2 * SCALER_PAD;
+   unsigned band, y, i;
+
+   for (y = 0; y < layout->height; y++)
+   {
+      uint16_t* line = scaler_source + (y + SCALER_PAD) * stride;
+
+      memcpy(line + SCALER_PAD, picture + layout->first_pixel + y * layout->pitch, layout->width * sizeof(uint16_t));
+
+      for (i = 0; i < SCALER_PAD; i++)
+      {
+         line[i] = line[SCALER_PAD];
+         line[SCALER_PAD + layout->width + i] = line[SCALER_PAD + layout->width - 1];
+      }
+   }
+
+   for (i = 0; i < SCALER_PAD; i++)
+   {
+      memcpy(scaler_source + i * stride, scaler_source + SCALER_PAD * stride, stride * sizeof(uint16_t));
+      memcpy(scaler_source + (SCALER_PAD + layout->height + i) * stride, scaler_source + (SCALER_PAD + layout->height - 1) * stride, stride * sizeof(uint16_t));
+   }
+
+   if (!scaler_pool.started)
+      scaler_pool_start();
+
+   // The helpers are idle, so nothing here needs the lock
+   scaler_pool.proc = scaler_get_proc16(layout->scaler);
+
+#if defined(VIDEO_SIMD_SSE2) || defined(VIDEO_SIMD_NEON)
+   if (layout->scaler == SCALER_ADVMAME2X)
+      scaler_pool.proc = scale_advmame2x;
+#endif
+
+   scaler_pool.output = output;
+   scaler_pool.width = layout->width;
+   scaler_pool.height = layout->height;
+   scaler_pool.stride = stride;
+   scaler_pool.factor = layout->scale;
+
+   if (scaler_pool.running)
+   {
+      compat_mutex_lock(scaler_pool.mutex);
+      scaler_pool.pending = scaler_pool.running;
+
+      for (i = 0; i < (unsigned)scaler_pool.running; i++)
+      {
+         scaler_pool.busy[i] = 1;
+         compat_cond_signal(scaler_pool.work_cond[i]);
+      }
+
+      compat_mutex_unlock(scaler_pool.mutex);
+   }
+
+   scale_band(0);
+
+   for (band = scaler_pool.running + 1; band < SCALER_BANDS; band++)
+      scale_band(band);
+
+   if (scaler_pool.running)
+   {
+      compat_mutex_lock(scaler_pool.mutex);
+
+      while (scaler_pool.pending)
+         compat_cond_wait(scaler_pool.done_cond, scaler_pool.mutex);
+
+      compat_mutex_unlock(scaler_pool.mutex);
+   }
+}
+
+// With fuse_video_thread the overlay is drawn on a helper thread. At the
+// end of each frame the emulation thread presents what it drew from the
+// previous frame and hands it a copy of the picture, so the overlay is shown
+// a frame late but only costs the emulation thread the copy. With fuse_scaler
+// the helper scales the picture too, into buffers of its own. The helper
+// draws into the output buffer that wasn't presented last, as the frontend
+// may still be showing that one.
+static struct
+{
+   compat_thread thread;
+   compat_mutex mutex;
+   compat_cond work_cond, done_cond;
+   int busy, quit;
+   int drawn, submitted, presented;
+   unsigned current;
+   overlay_state_t state;
+   uint16_t* source;
+   uint16_t* output[2];
+
+   // Each output's layout as it was submitted, and whether the helper
+   // scaled it into scaled[], allocated the first time it's needed
+   picture_layout_t layout[2];
+   int scaling[2];
+   uint16_t* scaled[2];
+}
+video_thread;
+
+// The output and scaled buffers of a stopped helper. The frontend may show
+// the last picture it drew again, e.g. for a duped frame or while its menu
+// is open, so they are kept until another picture has been presented
+static uint16_t* video_thread_retired[4];
+
+static void video_thread_release(void)
+{
+   unsigned i;
+
+   for (i = 0; i < 4; i++)
+   {
+      free(video_thread_retired[i]);
+      video_thread_retired[i] = NULL;
+   }
+}
+
+static void video_thread_main(void* data)
+{
+   unsigned slot;
+
+   (void)data;
+
+   compat_mutex_lock(video_thread.mutex);
+
+   for (;;)
+   {
+      while (!video_thread.busy && !video_thread.quit)
+         compat_cond_wait(video_thread.work_cond, video_thread.mutex);
+
+      if (video_thread.quit)
+         break;
+
+      compat_mutex_unlock(video_thread.mutex);
+      slot = video_thread.current;
+      draw_overlay(video_thread.output[slot], video_thread.source, &video_thread.state);
+
+      if (video_thread.scaling[slot])
+         scale_picture(video_thread.output[slot], &video_thread.layout[slot], video_thread.scaled[slot]);
+
+      compat_mutex_lock(video_thread.mutex);
+
+      video_thread.busy = 0;
+      video_thread.drawn = 1;
+      compat_cond_signal(video_thread.done_cond);
+   }
+
+   compat_mutex_unlock(video_thread.mutex);
+}
+
+static void video_thread_stop(void)
+{
+   if (video_thread.thread)
+   {
+      compat_mutex_lock(video_thread.mutex);
+      video_thread.quit = 1;
+      compat_cond_signal(video_thread.work_cond);
+      compat_mutex_unlock(video_thread.mutex);
+
+      compat_thread_join(video_thread.thread);
+   }
+
+   if (video_thread.mutex) compat_mutex_destroy(video_thread.mutex);
+   if (video_thread.work_cond) compat_cond_destroy(video_thread.work_cond);
+   if (video_thread.done_cond) compat_cond_destroy(video_thread.done_cond);
+
+   free(video_thread.source);
+
+   if (video_thread.presented)
+   {
+      video_thread_release();
+      video_thread_retired[0] = video_thread.output[0];
+      video_thread_retired[1] = video_thread.output[1];
+      video_thread_retired[2] = video_thread.scaled[0];
+      video_thread_retired[3] = video_thread.scaled[1];
+   }
+   else
+   {
+      free(video_thread.output[0]);
+      free(video_thread.output[1]);
+      free(video_thread.scaled[0]);
+      free(video_thread.scaled[1]);
+   }
+
+   memset(&video_thread, 0, sizeof(video_thread));
+}
+
+// Without threads, or if anything fails, the overlay is drawn in place
+static void video_thread_start(void)
+{
+   memset(&video_thread, 0, sizeof(video_thread));
+
+   video_thread.source = (uint16_t*)malloc(sizeof(image_buffer));
+   video_thread.output[0] = (uint16_t*)calloc(1, sizeof(image_buffer));
+   video_thread.output[1] = (uint16_t*)calloc(1, sizeof(image_buffer));
+   video_thread.mutex = compat_mutex_create();
+   video_thread.work_cond = compat_cond_create();
+   video_thread.done_cond = compat_cond_create();
+
+   if (video_thread.source && video_thread.output[0] && video_thread.output[1] &&
+       video_thread.mutex && video_thread.work_cond && video_thread.done_cond)
+   {
+      video_thread.thread = compat_thread_create(video_thread_main, NULL);
+   }
 
-      for (i = 0; i < 2; i++)
-      {
-         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_PLUS3, i, 0);
-         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_PLUSD, i, 0);
-         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_OPUS, i, 0);
-         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_DISCIPLE, i, 0);
-      }
+   if (!video_thread.thread)
+      video_thread_stop();
+}
 
-      for (i = 0; i < 4; i++)
+// Waits for the helper to finish the frame it was given
+static void video_thread_wait(void)
+{
+   compat_mutex_lock(video_thread.mutex);
+
+   while (video_thread.busy)
+      compat_cond_wait(video_thread.done_cond, video_thread.mutex);
+
+   compat_mutex_unlock(video_thread.mutex);
+}
+
+// Hands the picture to the frontend, through the scaler if there is one,
+// or the copy of it the video helper already scaled. NULL tells the
+// frontend to show the previous frame again
+static void present_picture(const uint16_t* picture, const picture_layout_t* layout, const uint16_t* scaled)
+{
+   unsigned scale = layout->scale;
+
+   if (scale == 1)
+   {
+      video_cb(picture ? picture + layout->first_pixel : NULL, layout->width, layout->height, layout->pitch * sizeof(uint16_t));
+   }
+   else if (picture)
+   {
+      if (!scaled)
       {
-         ui_media_drive_writeprotect(UI_MEDIA_CONTROLLER_BETA, i, 0);
+         scale_picture(picture, layout, scaler_output);
+         scaled = scaler_output;
       }
 
-      for (i = 0; i < 8; i++)
+      video_cb(scaled, layout->width * scale, layout->height * scale, layout->width * scale * sizeof(uint16_t));
+   }
+   else
+   {
+      video_cb(NULL, layout->width * scale, layout->height * scale, layout->width * scale * sizeof(uint16_t));
+   }
+
+   if (picture)
+      video_thread_release();
+}
+
+// Presents what the helper drew from the previous frame, or shows the
+// previous frame again if there wasn't one, and gives it the frame just
+// emulated. The helper is idle while its last picture is presented, so a
+// picture it didn't scale can be scaled here
+static void video_thread_present(const overlay_state_t* state, const picture_layout_t* layout)
+{
+   unsigned slot = video_thread.current;
+
+   video_thread_wait();
+
+   // The helper is idle, so nothing here needs the lock
+   if (video_thread.drawn)
+   {
+      present_picture(video_thread.output[slot], &video_thread.layout[slot], video_thread.scaling[slot] ? video_thread.scaled[slot] : NULL);
+      video_thread.presented = 1;
+   }
+   else
+   {
+      present_picture(NULL, layout, NULL);
+   }
+
+   if (layout->scale > 1 && !video_thread.scaled[0])
+   {
+      video_thread.scaled[0] = (uint16_t*)malloc(sizeof(scaler_output));
+      video_thread.scaled[1] = (uint16_t*)malloc(sizeof(scaler_output));
+
+      if (!video_thread.scaled[0] || !video_thread.scaled[1])
       {
-         if1_mdr_writeprotect( i, 0 );
+         free(video_thread.scaled[0]);
+         free(video_thread.scaled[1]);
+         video_thread.scaled[0] = video_thread.scaled[1] = NULL;
       }
+   }
 
-      // Set up memory map interface
-      struct retro_memory_descriptor desc[MEMORY_PAGES_IN_64K];
-      memset(desc, 0, sizeof(desc));
+   slot ^= 1;
+   video_thread.submitted = 1;
+   video_thread.current = slot;
+   video_thread.state = *state;
+   video_thread.layout[slot] = *layout;
+   video_thread.scaling[slot] = layout->scale > 1 && video_thread.scaled[0];
+   memcpy(video_thread.source, image_buffer, hard_width * hard_height * sizeof(uint16_t));
+
+   compat_mutex_lock(video_thread.mutex);
+   video_thread.busy = 1;
+   compat_cond_signal(video_thread.work_cond);
+   compat_mutex_unlock(video_thread.mutex);
+}
 
-      for (i = 0; i < MEMORY_PAGES_IN_64K; i++)
+static void render_video(void)
+{
+   picture_layout_t layout;
+   get_picture_layout(&layout);
+
+   if (!keyb_overlay)
+   {
+      // Don't present an old overlay when it is next shown
+      if (video_thread.submitted)
       {
-         desc[i].start  = i * MEMORY_PAGE_SIZE;
-         desc[i].len    = MEMORY_PAGE_SIZE;
-         desc[i].select = 0;
-         desc[i].ptr    = memory_map_read[i].page;
+         video_thread_wait();
+         video_thread.drawn = video_thread.submitted = 0;
       }
-      struct retro_memory_map memory_map = {desc, MEMORY_PAGES_IN_64K};
-
-      env_cb(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, &memory_map);
 
-      // Re-apply the live controller-port wiring: if a frontend assigned
-      // RETRO_DEVICE_KEMPSTON_MOUSE before retro_load_game(), fuse_init()'s
-      // settings_defaults() has just wiped settings_current.kempston_mouse
-      // (and the deferral flag was never armed because fuse_init_called was
-      // still 0); likewise, loading snapshot content re-derives the flag
-      // from the file via kempmouse_snapshot_enabled(). Port wiring is
-      // frontend state, not machine state - see retro_unserialize().
-      sync_kempston_mouse_from_ports();
+      overlay_composite.valid = 0;
 
-      return true;
+      present_picture(show_frame ? image_buffer : NULL, &layout, NULL);
    }
+   else if (show_frame)
+   {
+      overlay_state_t state;
+      get_overlay_state(&state);
 
-   return false;
+      if (video_thread.thread)
+      {
+         // The helper may still be reading the cache
+         video_thread_wait();
+         update_overlay_cache(&state);
+
+         video_thread_present(&state, &layout);
+         overlay_composite.valid = 0;
+      }
+      else
+      {
+         update_overlay_cache(&state);
+         update_overlay(&state);
+         present_picture(core->image_buffer_2, &layout, NULL);
+      }
+   }
+   else
+   {
+      present_picture(NULL, &layout, NULL);
+   }
 }
 
-size_t retro_get_memory_size(unsigned id)
+static void save_dir_path(char* path, const char* name, size_t size)
 {
-   return 0;
+   const char* dir = NULL;
+
+   if (!env_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &dir) || !dir || !*dir)
+      dir = ".";
+
+   fill_pathname_join(path, dir, name, size);
 }
 
-void *retro_get_memory_data(unsigned id)
+// Writes the execution trace to fuse.trace in the save directory
+static void save_exec_trace(void)
 {
-   return NULL;
+   char path[1024];
+
+   if (!trace_active)
+      return;
+
+   save_dir_path(path, "fuse.trace", sizeof(path));
+
+   if (trace_dump(path) == 0)
+      log_cb(RETRO_LOG_INFO, "Execution trace written to %s\n", path);
 }
 
-void retro_set_video_refresh(retro_video_refresh_t cb)
+// Writes the profile to the save directory and stops profiling
+static void save_profile(void)
 {
-   video_cb = cb;
+   char path[1024];
+
+   if (!profile_active || !core->profile_file)
+      return;
+
+   save_dir_path(path, core->profile_file, sizeof(path));
+   if (profile_finish(path))
+      log_cb(RETRO_LOG_ERROR, "Failed to write profile to %s\n", path);
+   else
+      log_cb(RETRO_LOG_INFO, "Profile written to %s\n", path);
 }
 
-void retro_set_audio_sample(retro_audio_sample_t cb)
+// Autoloading content waits for the ROM to boot before the phantom typist
+// can start typing, which takes a few seconds on the 128K machines and the
+// +3. The state of the machine at the end of the frame in which it finished
+// booting is kept in the save directory, named by a hash of everything the
+// boot depends on, and restored in place of booting on later loads. Only
+// the media differ between those loads, and the ROMs don't touch them
+// while booting. A restored load starts that many frames further on than a
+// cold boot, so runs which have to match frame for frame (netplay, replays)
+// need the cache turned off, which is why it is off by default.
+static void boot_cache_hash_data(uint64_t* hash, const void* data, size_t size)
 {
-   (void)cb;
+   const uint8_t* bytes = (const uint8_t*)data;
+
+   while (size--)
+      *hash = (*hash ^ *bytes++) * 0x100000001b3ULL;
 }
 
-void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb)
+static void boot_cache_hash_string(uint64_t* hash, const char* string)
 {
-   audio_cb = cb;
+   if (string)
+      boot_cache_hash_data(hash, string, strlen(string) + 1);
+   else
+      boot_cache_hash_data(hash, "", 1);
 }
 
-void retro_set_input_state(retro_input_state_t cb)
+static uint64_t boot_cache_hash(void)
 {
-   input_state_cb = cb;
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   int value;
+   size_t i;
+
+   boot_cache_hash_string(&hash, version);
+
+   value = machine_current->machine;
+   boot_cache_hash_data(&hash, &value, sizeof(value));
+   value = settings_current.late_timings;
+   boot_cache_hash_data(&hash, &value, sizeof(value));
+
+   // An empty Interface 2 isn't kept in snapshots, so restoring the boot
+   // state turns it off; it does nothing without a cartridge anyway
+   for (i = PERIPH_TYPE_UNKNOWN; i <= PERIPH_TYPE_ZXPRINTER_FULL_DECODE; i++)
+   {
+      value = i != PERIPH_TYPE_INTERFACE2 && periph_is_active((periph_type)i);
+      boot_cache_hash_data(&hash, &value, sizeof(value));
+   }
+
+   // The +3 ROM looks for a second drive
+   boot_cache_hash_string(&hash, settings_current.drive_plus3a_type);
+   boot_cache_hash_string(&hash, settings_current.drive_plus3b_type);
+
+   for (i = 0; i < SPECTRUM_ROM_PAGES * MEMORY_PAGES_IN_16K; i++)
+   {
+      if (memory_map_rom[i].page)
+         boot_cache_hash_data(&hash, memory_map_rom[i].page, MEMORY_PAGE_SIZE);
+   }
+
+   return hash;
 }
 
-void retro_set_input_poll(retro_input_poll_t cb)
+// Restoring a snapshot turns off every optional peripheral and then back on
+// those the snapshot records, see snapshot_copy_from(). Does the same to
+// the settings alone and reports whether that leaves the same peripherals
+// active, so that a configuration which SZX can't represent boots as usual
+static int boot_cache_keeps_peripherals(libspectrum_snap* snap)
 {
-   input_poll_cb = cb;
+   settings_info configured = settings_current;
+   int mouse_grabbed = ui_mouse_grabbed;
+   int kept;
+
+   periph_disable_optional();
+   module_snapshot_enabled(snap);
+
+   // An empty Interface 2 isn't kept, see boot_cache_hash()
+   settings_current.interface2 = configured.interface2;
+
+   kept = !periph_update_changes();
+   settings_current = configured;
+   ui_mouse_grabbed = mouse_grabbed;
+
+   return kept;
 }
 
-void retro_get_system_av_info(struct retro_system_av_info *info)
+static void boot_cache_path(char* path, size_t size)
 {
-   // Report the currently visible output geometry.
-   info->geometry.base_width = soft_width;
-   info->geometry.base_height = soft_height;
+   char name[32];
 
-   info->geometry.max_width = MAX_WIDTH;
-   info->geometry.max_height = MAX_HEIGHT;
-   info->geometry.aspect_ratio = 0.0f;
-   info->timing.fps = machine_id_is_60hz(machine->id) ? 60.0 : 50.0;
-   info->timing.sample_rate = 44100.0;
+   snprintf(name, sizeof(name), "fuse-boot-%016llx.szx", (unsigned long long)core->boot_cache_key);
+   save_dir_path(path, name, size);
 }
 
-static void render_video(void)
+// Called after content has been opened with autoload. If the phantom typist
+// is now waiting for the machine to boot, restores the booted machine from
+// the cache, or arranges for it to be saved once it has booted
+static void boot_cache_restore(void)
 {
-   if (!keyb_overlay)
+   char path[1024];
+   libspectrum_snap* snap;
+   void* data;
+   int64_t size;
+
+   core->boot_cache_pending = 0;
+
+   if (!core->boot_cache_enabled || !phantom_typist_is_waiting())
+      return;
+
+   core->boot_cache_key = boot_cache_hash();
+   boot_cache_path(path, sizeof(path));
+
+   if (!path_is_valid(path) || !filestream_read_file(path, &data, &size))
    {
-      video_cb(show_frame ? image_buffer + first_pixel : NULL, soft_width, soft_height, hard_width * sizeof(uint16_t));
+      core->boot_cache_pending = 1;
+      return;
    }
-   else
+
+   snap = libspectrum_snap_alloc();
+
+   if (libspectrum_snap_read(snap, (const libspectrum_byte*)data, (size_t)size, LIBSPECTRUM_ID_SNAPSHOT_SZX, NULL) != 0)
+   {
+      // Boot as usual and replace the file
+      core->boot_cache_pending = 1;
+   }
+   else if (!boot_cache_keeps_peripherals(snap))
+   {
+      log_cb(RETRO_LOG_INFO, "Not restoring boot state from %s, the peripherals differ\n", path);
+   }
+   else if (snapshot_copy_from(snap) == 0)
+   {
+      phantom_typist_skip_wait();
+      sync_kempston_mouse_from_ports();
+      log_cb(RETRO_LOG_INFO, "Restored boot state from %s\n", path);
+   }
+
+   libspectrum_snap_free(snap);
+   free(data);
+}
+
+// Written under a temporary name and renamed, so a later load never sees a
+// partly written file
+static void boot_cache_save(void)
+{
+   char path[1024], temp_path[1040];
+   libspectrum_snap* snap;
+   libspectrum_byte* buffer = NULL;
+   size_t length = 0;
+   int flags = 0;
+
+   core->boot_cache_pending = 0;
+
+   snap = libspectrum_snap_alloc();
+
+   if (snapshot_copy_to(snap) == 0 && boot_cache_keeps_peripherals(snap) &&
+       libspectrum_snap_write(&buffer, &length, &flags, snap, LIBSPECTRUM_ID_SNAPSHOT_SZX, fuse_creator, 0) == 0)
    {
-      if (show_frame)
+      boot_cache_path(path, sizeof(path));
+      snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+      if (!filestream_write_file(temp_path, buffer, length))
       {
-         if (machine->is_timex)
-         {
-            const uint16_t* src1 = keyboard_overlay;
-            const uint16_t* src2 = image_buffer + (48 * hard_width); // Centre doubled 480px overlay in 576px canvas
-            uint16_t* dest = image_buffer_2 + (48 * hard_width);     // Centre doubled 480px overlay in 576px canvas
-            int x, y;
+         log_cb(RETRO_LOG_WARN, "Couldn't write boot state to %s\n", temp_path);
+      }
+      else if (filestream_rename(temp_path, path) != 0 &&
+               (filestream_delete(path) != 0 || filestream_rename(temp_path, path) != 0))
+      {
+         // rename() doesn't replace an existing file on Windows
+         log_cb(RETRO_LOG_WARN, "Couldn't rename boot state to %s\n", path);
+         filestream_delete(temp_path);
+      }
+      else
+      {
+         log_cb(RETRO_LOG_INFO, "Boot state written to %s\n", path);
+      }
+   }
 
-            if (keyb_transparent)
-            {
-               for (y = 0; y < 240; y++) // Process only 240px height
-               {
-                  for (x = 0; x < 320; x++)
-                  {
-                     uint32_t src1_pixel = (*src1++ & 0xe79c) * 3;
-
-                     dest[0] = (src1_pixel + (src2[0] & 0xe79c)) >> 2;
-                     dest[1] = (src1_pixel + (src2[1] & 0xe79c)) >> 2;
-                     dest[640] = (src1_pixel + (src2[640] & 0xe79c)) >> 2;
-                     dest[641] = (src1_pixel + (src2[641] & 0xe79c)) >> 2;
-
-                     src2 += 2;
-                     dest += 2;
-                  }
-
-                  src2 += 640;
-                  dest += 640;
-               }
-            }
-            else
-            {
-               for (y = 0; y < 240; y++) // Process only 240px height
-               {
-                  for (x = 0; x < 320; x++)
-                  {
-                     uint32_t src1_pixel = *src1++;
-
-                     dest[0] = src1_pixel;
-                     dest[1] = src1_pixel;
-                     dest[640] = src1_pixel;
-                     dest[641] = src1_pixel;
-
-                     src2 += 2;
-                     dest += 2;
-                  }
-
-                  src2 += 640;
-                  dest += 640;
-               }
-            }
-         }
-         else
-         {
-            if (keyb_transparent)
-            {
-               const uint16_t* src1 = keyboard_overlay;
-               const uint16_t* src2 = image_buffer + (24 * hard_width); // Offset by 24px
-               const uint16_t* end = src1 + (240 * 320);                // Limit to 240px height
-               uint16_t* dest = image_buffer_2 + (24 * hard_width);    // Offset by 24px
-
-               while (src1 < end)
-               {
-                  uint32_t src1_pixel = *src1++ & 0xe79c;
-                  uint32_t src2_pixel = *src2++ & 0xe79c;
-
-                  *dest++ = (src1_pixel * 3 + src2_pixel) >> 2;
-               }
-            }
-            else
-            {
-               memcpy(image_buffer_2 + (24 * hard_width), keyboard_overlay, 240 * 320 * sizeof(uint16_t)); // Copy to offset position
-            }
-         }
+   libspectrum_free(buffer);
+   libspectrum_snap_free(snap);
+}
 
-         // Render virtual keyboard highlighting
-         unsigned x = keyb_positions[keyb_y].x + keyb_x * 24;
-         unsigned y = keyb_positions[keyb_y].y + 24; // Offset highlighting by 24px
-         unsigned width = 23;
+// Saves the boot state once the machine has booted, see boot_cache_restore()
+static void boot_cache_frame(void)
+{
+   if (!core->boot_cache_pending)
+      return;
 
-         if (keyb_y == 3)
-         {
-            if (keyb_x == 8)
-            {
-               width = 24;
-            }
-            else if (keyb_x == 9)
-            {
-               x++;
-               width = 30;
-            }
-         }
+   if (phantom_typist_booted())
+      boot_cache_save();
+   else if (!phantom_typist_is_waiting())
+      core->boot_cache_pending = 0;
+}
 
-         unsigned mult = machine->is_timex ? 2 : 1;
-         uint16_t* pixel = image_buffer_2 + ((y * hard_width) + x + 1) * mult;
-         unsigned i, j;
+// Logs the state hash every state_hash_interval frames, one line per frame
+// so that the logs of two netplay peers can be diffed. The frame number is
+// kept in savestates (see retro_serialize()), so frames the frontend runs
+// again after loading a state (netplay rollback, run-ahead) are logged
+// again under the same number, and the last line for a frame is the one
+// that counts
+static void state_hash_log(void)
+{
+   state_hash_t hash;
+   char line[(STATE_HASH_PARTS + SPECTRUM_RAM_PAGES) * 24 + 16];
+   size_t length = 0;
+   unsigned frame;
+   int i;
 
-         for (j = mult; j > 0; --j )
-         {
-            for (i = (width - 2) * mult; i > 0; --i)
-            {
-               *pixel = ~*pixel;
-               pixel++;
-            }
+   frame = core->state_hash_frame++;
 
-            pixel += hard_width - (width - 2) * mult;
-         }
+   if (!core->state_hash_interval || frame % core->state_hash_interval != 0)
+      return;
 
-         pixel -= mult;
+   state_hash_compute(&hash);
 
-         for (j = 22 * mult; j > 0; --j)
-         {
-            for (i = width * mult; i > 0; --i)
-            {
-               *pixel = ~*pixel;
-               pixel++;
-            }
+   for (i = 0; i < STATE_HASH_PARTS; i++)
+      length += snprintf(line + length, sizeof(line) - length, " %s %016llx",
+                         state_hash_part_name(i), (unsigned long long)hash.parts[i]);
 
-            pixel += hard_width - width * mult;
-         }
+   length += snprintf(line + length, sizeof(line) - length, " pages");
 
-         pixel += mult;
+   for (i = 0; i < hash.ram_page_count; i++)
+      length += snprintf(line + length, sizeof(line) - length, " %016llx",
+                         (unsigned long long)hash.ram_pages[i]);
 
-         for (j = mult; j > 0; --j)
-         {
-            for (i = (width - 2) * mult; i > 0; --i)
-            {
-               *pixel = ~*pixel;
-               pixel++;
-            }
+   log_cb(RETRO_LOG_INFO, "State hash frame %u: %016llx%s\n", frame,
+          (unsigned long long)hash.total, line);
+}
 
-            pixel += hard_width - (width - 2) * mult;
-         }
+// The number of frames to run in this retro_run(). Movies record every
+// frame, and without sound there is no end of frame to wait for (see below)
+static int fast_forward_batch(void)
+{
+   bool fast_forwarding = false;
 
-         video_cb(image_buffer_2 + first_pixel, soft_width, soft_height, hard_width * sizeof(uint16_t));
-      }
-      else
-      {
-         video_cb(NULL, soft_width, soft_height, hard_width * sizeof(uint16_t));
-      }
+   if (!core->fast_forward_frames || movie_recording || !sound_enabled ||
+       !env_cb(RETRO_ENVIRONMENT_GET_FASTFORWARDING, &fast_forwarding) || !fast_forwarding)
+   {
+      return 1;
    }
+
+   return core->fast_forward_frames;
 }
 
 void retro_run(void)
 {
    bool updated = false;
 
-   if (kempston_mouse_needs_periph_update)
+   if (core->kempston_mouse_needs_periph_update)
    {
-      kempston_mouse_needs_periph_update = 0;
+      core->kempston_mouse_needs_periph_update = 0;
       periph_update();
    }
 
-   if (display_joystick_type == TRUE)
+   if (core->display_joystick_type == TRUE)
    {
       int port;
       for (port = 0; port < MAX_PADS; port++) {
@@ -2137,14 +3754,14 @@ void retro_run(void)
             Retro_Msg(title);
          }
       }
-      display_joystick_type = FALSE;
+      core->display_joystick_type = FALSE;
    }
 
-   if (display_emulation_speed == TRUE) {
+   if (core->display_emulation_speed == TRUE) {
       char title[80];
       snprintf(title, sizeof(title), "Emulation speed set to %d%%", settings_current.emulation_speed);
       Retro_Msg(title);
-      display_emulation_speed = FALSE;
+      core->display_emulation_speed = FALSE;
    }
 
    if (env_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
@@ -2161,16 +3778,7 @@ void retro_run(void)
       if (flags & UPDATE_GEOMETRY)
       {
          struct retro_game_geometry geometry;
-
-         // Here we use the "soft" resolution that is changed according to the
-         // fuse_size_border variable
-         geometry.base_width = soft_width;
-         geometry.base_height = soft_height;
-
-         geometry.max_width = MAX_WIDTH;
-         geometry.max_height = MAX_HEIGHT;
-         geometry.aspect_ratio = 0.0f;
-
+         get_geometry(&geometry);
          env_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &geometry);
       }
 
@@ -2178,9 +3786,64 @@ void retro_run(void)
       {
          machine_select( machine->id );
       }
+
+      if (flags & UPDATE_SOUND)
+      {
+         // Pausing tears down the blip buffers and unpausing rebuilds them
+         // at the new rate
+         fuse_emulation_pause();
+         fuse_emulation_unpause();
+      }
+   }
+
+   if (core->exec_trace_size != core->exec_trace_requested)
+   {
+      // Changing the size (or disabling the trace) writes out what has been
+      // recorded so far
+      save_exec_trace();
+      trace_stop();
+
+      core->exec_trace_size = core->exec_trace_requested;
+
+      if (core->exec_trace_size != 0)
+         trace_start(core->exec_trace_size);
+   }
+
+   if (core->video_thread_enabled != core->video_thread_requested)
+   {
+      core->video_thread_enabled = core->video_thread_requested;
+
+      if (core->video_thread_enabled)
+         video_thread_start();
+      else
+         video_thread_stop();
+   }
+
+   if (core->profile_file != core->profile_requested)
+   {
+      save_profile();
+
+      // Only switch files once the old profile has really stopped
+      if (!profile_active)
+      {
+         core->profile_file = core->profile_requested;
+
+         if (core->profile_file)
+            profile_start();
+      }
    }
 
-   total_time_ms += frame_time;
+   if (core->frameskip_latency_changed)
+   {
+      // Auto frameskip works best with some slack in the audio buffer:
+      // ask for six frames' worth, and go back to the frontend's default
+      // when it's turned off
+      unsigned latency = core->frameskip_mode == FRAMESKIP_AUTO ? (unsigned)(core->frame_time * 6.0 + 0.5) : 0;
+      env_cb(RETRO_ENVIRONMENT_SET_MINIMUM_AUDIO_LATENCY, &latency);
+      core->frameskip_latency_changed = 0;
+   }
+
+   total_time_ms += core->frame_time;
    show_frame = some_audio = 0;
 
    /*
@@ -2202,8 +3865,17 @@ void retro_run(void)
       state on poll and serves it through input_state_cb() - and frontends
       that record, replay or re-run frames (netplay, runahead, BSV replay)
       consume one input sample per poll, so extra polls desync them.
-      Reading state inside the loop via input_state_cb() remains fine. */
-   input_poll_cb();
+      Reading state inside the loop via input_state_cb() remains fine.
+
+      Input read this way only reaches the keyboard matrix and joystick
+      ports at the end of the frame, in ui_event(). With low latency input
+      the poll moves to the frame's first read of one of those ports
+      instead (see ui_input_latch()), so the program sees it in the same
+      frame; a frame which never reads them polls once after running. */
+   input_latched = !input_latch_lazy;
+
+   if (input_latched)
+      input_poll_cb();
 
    /* Bounded wait. some_audio is set by sound_lowlevel_frame(), reached only
       via sound_frame(), which returns early whenever sound_enabled is clear
@@ -2217,6 +3889,29 @@ void retro_run(void)
       emitting a frame without audio degrades far better than hanging. */
    {
       int guard = 10000;
+      int batch = fast_forward_batch();
+
+      // While fast-forwarding, all but the last frame of the batch are
+      // neither drawn nor heard
+      display_frame_skip = sound_frame_skip = 1;
+
+      for (; batch > 1; batch--)
+      {
+         do {
+            z80_do_opcodes();
+            event_do_events();
+         }
+         while (!some_audio && --guard > 0);
+
+         some_audio = 0;
+         guard = 10000;
+         total_time_ms += core->frame_time;
+         boot_cache_frame();
+         state_hash_log();
+      }
+
+      sound_frame_skip = 0;
+      display_frame_skip = frameskip_this_frame();
 
       do {
          z80_do_opcodes();
@@ -2224,6 +3919,13 @@ void retro_run(void)
       }
       while (!some_audio && --guard > 0);
 
+      display_frame_skip = 0;
+      boot_cache_frame();
+      state_hash_log();
+
+      if (!input_latched)
+         ui_input_latch();
+
       if (!some_audio)
       {
          static int warned_no_audio = 0;
@@ -2239,12 +3941,13 @@ void retro_run(void)
       }
    }
 
+   update_memory_maps(0);
    render_video();
 }
 
 void retro_deinit(void)
 {
-   cheat_t* cheat = active_cheats;
+   cheat_t* cheat = core->active_cheats;
    cheat_t* next = NULL;
 
    while (cheat != NULL)
@@ -2254,11 +3957,13 @@ void retro_deinit(void)
       cheat = next;
    }
 
-   active_cheats = NULL;
+   core->active_cheats = NULL;
 
-   if ( fuse_init_called )
+   video_thread_release();
+
+   if ( core->fuse_init_called )
    {
-      fuse_init_called = 0;
+      core->fuse_init_called = 0;
       fuse_end();
    }
 }
@@ -2293,8 +3998,8 @@ static void sync_kempston_mouse_from_ports(void)
       // See the comment in retro_set_controller_port_device(): defer the
       // actual periph_update() to the top of retro_run() rather than
       // calling it here synchronously.
-      if (fuse_init_called)
-         kempston_mouse_needs_periph_update = 1;
+      if (core->fuse_init_called)
+         core->kempston_mouse_needs_periph_update = 1;
    }
 }
 
@@ -2304,8 +4009,8 @@ void retro_set_controller_port_device(unsigned port, unsigned device)
 
    if (device == RETRO_DEVICE_AUTO_CFG)
    {
-      if (port == 0 && show_joystick_type_at_startup == TRUE)
-         display_joystick_type = TRUE;
+      if (port == 0 && core->show_joystick_type_at_startup == TRUE)
+         core->display_joystick_type = TRUE;
       return;
    }
 
@@ -2363,20 +4068,21 @@ void retro_reset(void)
    libspectrum_id_t type;
    char filename[32];
 
-   if (content_is_m3u)
+   if (core->content_is_m3u)
    {
       // tape_data holds the M3U's playlist text, not an image -
       // re-identifying it here would misread it (possibly as a raw TRD).
       // Reset means reboot with the currently selected disk inserted,
       // mirroring the initial load; autoload forced like the normal
       // reset path below.
-      if (num_disk_images > 0 && current_disk_index < num_disk_images)
+      if (core->num_disk_images > 0 && core->current_disk_index < core->num_disk_images)
       {
          fuse_emulation_pause();
-         utils_open_file(disk_image_paths[current_disk_index], 1, &type);
+         utils_open_file(core->disk_image_paths[core->current_disk_index], 1, &type);
+         boot_cache_restore();
          display_refresh_all();
          fuse_emulation_unpause();
-         disk_tray_ejected = false;
+         core->disk_tray_ejected = false;
       }
       else
       {
@@ -2394,6 +4100,7 @@ void retro_reset(void)
 
    fuse_emulation_pause();
    utils_open_file(filename, 1, &type);
+   boot_cache_restore();
    display_refresh_all();
    fuse_emulation_unpause();
 
@@ -2404,11 +4111,43 @@ void retro_reset(void)
    sync_kempston_mouse_from_ports();
 }
 
+// Savestates end with the state hash frame number, which isn't part of the
+// machine and so has no place in the SZX. At least four 0xFF bytes go
+// before it, which libspectrum's SZX reader takes as the end of the
+// snapshot, like the padding below
+#define SERIALIZE_TRAILER_SIZE 12
+
+static const uint8_t serialize_trailer_id[4] = { 'F', 'H', 'S', 'H' };
+
+static void serialize_write_trailer(uint8_t* data, size_t size)
+{
+   uint8_t* trailer = data + size - 8;
+   unsigned frame = core->state_hash_frame;
+
+   memcpy(trailer, serialize_trailer_id, 4);
+   trailer[4] = frame & 0xff;
+   trailer[5] = (frame >> 8) & 0xff;
+   trailer[6] = (frame >> 16) & 0xff;
+   trailer[7] = (frame >> 24) & 0xff;
+}
+
+static void serialize_read_trailer(const uint8_t* data, size_t size)
+{
+   const uint8_t* trailer = data + size - 8;
+
+   // States saved before the trailer was added keep counting on
+   if (size < SERIALIZE_TRAILER_SIZE || memcmp(trailer, serialize_trailer_id, 4) ||
+       memcmp(trailer - 4, "\xFF\xFF\xFF\xFF", 4))
+      return;
+
+   core->state_hash_frame = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (unsigned)trailer[7] << 24;
+}
+
 size_t retro_serialize_size(void)
 {
-   if (auto_size_savestate) {
+   if (core->auto_size_savestate) {
       snapshot_update();
-      return snapshot_size;
+      return snapshot_size + SERIALIZE_TRAILER_SIZE;
    }
    else
    {
@@ -2442,9 +4181,9 @@ bool retro_serialize(void *data, size_t size)
 {
    snapshot_update();
 
-   if (auto_size_savestate)
+   if (core->auto_size_savestate)
    {
-      if (size < snapshot_size)
+      if (size < snapshot_size + SERIALIZE_TRAILER_SIZE)
       {
          log_cb(RETRO_LOG_WARN, "Data size is not enough for snapshot\n");
          return false;
@@ -2456,16 +4195,18 @@ bool retro_serialize(void *data, size_t size)
       // instead of stale ring-buffer bytes that would parse as garbage
       // chunks on unserialize.
       memset(data + snapshot_size, 0xFF, size - snapshot_size);
+      serialize_write_trailer(data, size);
       return true;
    }
 
-   if (size < snapshot_size)
+   if (size < snapshot_size + SERIALIZE_TRAILER_SIZE)
    {
       log_cb(RETRO_LOG_WARN, "Snapshot size is larger than fixed size\n");
       return false;
    }
    memcpy(data, snapshot_buffer, snapshot_size);
    memset(data + snapshot_size, 0xFF, size - snapshot_size);
+   serialize_write_trailer(data, size);
    return true;
 }
 
@@ -2482,14 +4223,17 @@ bool retro_unserialize(const void *data, size_t size)
    // every restore (rewind or manual load) rather than leaving whatever
    // the snapshot happened to say.
    if (ok)
+   {
       sync_kempston_mouse_from_ports();
+      serialize_read_trailer((const uint8_t*)data, size);
+   }
 
    return ok;
 }
 
 void retro_cheat_reset(void)
 {
-   cheat_t* cheat = active_cheats;
+   cheat_t* cheat = core->active_cheats;
    cheat_t* next = NULL;
 
    while (cheat != NULL)
@@ -2504,7 +4248,7 @@ void retro_cheat_reset(void)
       cheat = next;
    }
 
-   active_cheats = NULL;
+   core->active_cheats = NULL;
 }
 
 static void skip_spaces(const char** c)
@@ -2554,8 +4298,8 @@ void retro_cheat_set(unsigned index, bool b, const char* code)
          if (cheat == NULL)
             return;
          
-         cheat->next = active_cheats;
-         active_cheats = cheat;
+         cheat->next = core->active_cheats;
+         core->active_cheats = cheat;
 
          if (bank == 8)
          {
@@ -2600,6 +4344,20 @@ bool retro_load_game_special(unsigned a, const struct retro_game_info *b, size_t
 
 void retro_unload_game(void)
 {
+   save_exec_trace();
+   trace_stop();
+   core->exec_trace_size = 0;
+
+   state_hash_end();
+   core->state_hash_frame = 0;
+
+   save_profile();
+   core->profile_file = NULL;
+
+   video_thread_stop();
+   core->video_thread_enabled = 0;
+   scaler_pool_stop();
+
    free(snapshot_buffer);
    snapshot_buffer = NULL;
    snapshot_size = 0;
@@ -585,6 +585,24 @@ LIBSPECTRUM_API libspectrum_error
 libspectrum_identify_class( libspectrum_class_t *libspectrum_class,
                             libspectrum_id_t type );
 
+/* Decompress a file of class LIBSPECTRUM_CLASS_COMPRESSED. Bypasses the
+   cache below, so may be called from another thread provided the error
+   function can be */
+LIBSPECTRUM_API libspectrum_error
+libspectrum_uncompress( libspectrum_byte **new_buffer, size_t *new_length,
+			libspectrum_id_t type,
+			const libspectrum_byte *old_buffer, size_t old_length );
+
+/* Hand the result of decompressing a file to the cache which the library
+   consults whenever it needs to decompress that file again, e.g. on
+   identifying it and then reading it. Takes ownership of new_buffer */
+LIBSPECTRUM_API libspectrum_error
+libspectrum_uncompress_cache_add( libspectrum_id_t type,
+				  const libspectrum_byte *old_buffer,
+				  size_t old_length,
+				  libspectrum_byte *new_buffer,
+				  size_t new_length );
+
 /* Different Spectrum variants and their capabilities */
 
 /* The machine types we can handle */
@@ -0,0 +1,857 @@
+// Headless batch replay runner for regression testing the core.
+//
+// Usage: replay [options] <directory|file>...
+//
+//   -n FRAMES     frames to run each title for (default 500)
+//   -j JOBS       titles run at once (default: one per online CPU)
+//   -c MANIFEST   check the hashes against MANIFEST instead of printing them
+//   -o KEY=VALUE  core option, as the frontend would set it (repeatable)
+//   -s DIR        system directory (default .)
+//   -t SECONDS    give up on a title after this long (default: never)
+//   -v            show the core's log output
+//
+// Directories are searched recursively for snapshots, tapes and input
+// recordings. Each title is loaded through retro_load_game(), so it goes
+// through utils_open_file() and, for .rzx files, rzx_start_playback()
+// exactly as in a frontend, and is then run for the given number of frames
+// with no input. After each frame the screen and RETRO_MEMORY_SYSTEM_RAM are
+// hashed together.
+//
+// Without -c the hashes are printed to stdout as a manifest, one line per
+// frame of the form "<hash> <frame> <title>", which can be saved and used
+// with -c to check a later build. Titles are named relative to the
+// directory they were found in.
+//
+// The core keeps its state in globals, so every title runs in a process of
+// its own, forked from the runner. A title which crashes or times out only
+// fails that title. Each process gets an empty save directory of its own,
+// removed once the title is done, so titles running at once don't share
+// files.
+//
+// Options which make a run depend on anything but the title and the build,
+// such as files left by earlier runs, are always turned off whatever -o
+// says (see forced_options), so that a manifest can be checked against a
+// later run.
+
+#include <libretro.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_OPTIONS 64
+
+// Outcome of running one title, kept in memory shared with the workers
+enum
+{
+   TITLE_PENDING = 0,
+   TITLE_DONE,
+   TITLE_READ_FAILED,
+   TITLE_LOAD_FAILED,
+};
+
+typedef struct
+{
+   char* path;    // For opening the file
+   char* name;    // For the manifest
+   char* save_dir;
+   pid_t pid;
+   int exit_status;
+}
+title_t;
+
+typedef struct
+{
+   char* name;
+   unsigned frame;
+   uint64_t hash;
+}
+manifest_entry_t;
+
+static const char* progname;
+
+static unsigned num_frames = 500;
+static int verbose;
+static const char* system_dir = ".";
+static unsigned timeout;
+
+static const char* options[MAX_OPTIONS][2];
+static int num_options;
+
+// The boot state cache restores a snapshot taken by an earlier run, auto
+// frameskip depends on how fast the host is, and the rest write files
+static const char* const forced_options[][2] = {
+   { "fuse_boot_cache", "disabled" },
+   { "fuse_frameskip", "disabled" },
+   { "fuse_state_hash", "disabled" },
+   { "fuse_profiler", "disabled" },
+   { "fuse_trace_buffer", "disabled" },
+};
+
+static title_t* titles;
+static size_t num_titles, max_titles;
+
+// Per title status and hashes, shared with the worker processes
+static volatile int* title_status;
+static uint64_t* title_hashes;
+
+// State of the worker's core
+static uint64_t screen_hash;
+static const char* save_dir;
+
+static const char* const extensions[] = {
+   ".szx", ".z80", ".sna", ".sp", ".snp", ".zxs",
+   ".rzx", ".tzx", ".tap", ".pzx", ".csw",
+   NULL
+};
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+// Hashes whole little endian words at a time, so the result is the same
+// on every host and the RAM can be hashed after every frame without
+// slowing the replay down much
+static uint64_t hash_buffer(uint64_t hash, const void* data, size_t size)
+{
+   const uint8_t* bytes = (const uint8_t*)data;
+
+   while (size >= 8)
+   {
+      uint64_t word = (uint64_t)bytes[0]       | (uint64_t)bytes[1] << 8  |
+                      (uint64_t)bytes[2] << 16 | (uint64_t)bytes[3] << 24 |
+                      (uint64_t)bytes[4] << 32 | (uint64_t)bytes[5] << 40 |
+                      (uint64_t)bytes[6] << 48 | (uint64_t)bytes[7] << 56;
+
+      hash = (hash ^ word) * 0x100000001b3ULL;
+      hash ^= hash >> 29;
+      bytes += 8;
+      size -= 8;
+   }
+
+   while (size--)
+      hash = (hash ^ *bytes++) * 0x100000001b3ULL;
+
+   return hash;
+}
+
+static void fatal(const char* format, ...)
+{
+   va_list ap;
+
+   va_start(ap, format);
+   fprintf(stderr, "%s: ", progname);
+   vfprintf(stderr, format, ap);
+   fprintf(stderr, "\n");
+   va_end(ap);
+
+   exit(2);
+}
+
+static char* safe_strdup(const char* string)
+{
+   char* copy = strdup(string);
+
+   if (!copy)
+      fatal("out of memory");
+
+   return copy;
+}
+
+// Frontend callbacks for the worker
+
+static void RETRO_CALLCONV log_printf(enum retro_log_level level, const char* format, ...)
+{
+   va_list ap;
+
+   (void)level;
+
+   if (!verbose)
+      return;
+
+   va_start(ap, format);
+   vfprintf(stderr, format, ap);
+   va_end(ap);
+}
+
+static bool RETRO_CALLCONV environment(unsigned cmd, void* data)
+{
+   switch (cmd)
+   {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         ((struct retro_log_callback*)data)->log = log_printf;
+         return true;
+
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+         return *(const enum retro_pixel_format*)data == RETRO_PIXEL_FORMAT_RGB565;
+
+      case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+         *(const char**)data = system_dir;
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY:
+         *(const char**)data = save_dir;
+         return true;
+
+      case RETRO_ENVIRONMENT_GET_VARIABLE:
+      {
+         struct retro_variable* var = (struct retro_variable*)data;
+         size_t i;
+
+         for (i = 0; i < sizeof(forced_options) / sizeof(forced_options[0]); i++)
+         {
+            if (!strcmp(forced_options[i][0], var->key))
+            {
+               var->value = forced_options[i][1];
+               return true;
+            }
+         }
+
+         for (i = 0; i < (size_t)num_options; i++)
+         {
+            if (!strcmp(options[i][0], var->key))
+            {
+               var->value = options[i][1];
+               return true;
+            }
+         }
+
+         var->value = NULL;
+         return false;
+      }
+   }
+
+   return false;
+}
+
+static void RETRO_CALLCONV video_refresh(const void* data, unsigned width, unsigned height, size_t pitch)
+{
+   unsigned y;
+
+   // A NULL frame repeats the previous one
+   if (!data)
+      return;
+
+   screen_hash = HASH_SEED;
+
+   for (y = 0; y < height; y++)
+      screen_hash = hash_buffer(screen_hash, (const uint8_t*)data + y * pitch, width * sizeof(uint16_t));
+}
+
+static size_t RETRO_CALLCONV audio_sample_batch(const int16_t* data, size_t frames)
+{
+   (void)data;
+   return frames;
+}
+
+static void RETRO_CALLCONV audio_sample(int16_t left, int16_t right)
+{
+   (void)left;
+   (void)right;
+}
+
+static void RETRO_CALLCONV input_poll(void)
+{
+}
+
+static int16_t RETRO_CALLCONV input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   (void)port;
+   (void)device;
+   (void)index;
+   (void)id;
+   return 0;
+}
+
+static void* read_title(const char* path, size_t* size)
+{
+   FILE* file = fopen(path, "rb");
+   long length;
+   void* data;
+
+   if (!file)
+      return NULL;
+
+   if (fseek(file, 0, SEEK_END) || (length = ftell(file)) <= 0 || fseek(file, 0, SEEK_SET))
+   {
+      fclose(file);
+      return NULL;
+   }
+
+   data = malloc(length);
+
+   if (!data || fread(data, 1, length, file) != (size_t)length)
+   {
+      free(data);
+      fclose(file);
+      return NULL;
+   }
+
+   fclose(file);
+   *size = length;
+   return data;
+}
+
+// Runs in the worker process
+static int run_title(size_t index)
+{
+   struct retro_game_info info;
+   uint64_t* hashes = title_hashes + index * num_frames;
+   unsigned frame;
+   void* data;
+   size_t size;
+
+   data = read_title(titles[index].path, &size);
+
+   if (!data)
+      return TITLE_READ_FAILED;
+
+   retro_set_environment(environment);
+   retro_set_video_refresh(video_refresh);
+   retro_set_audio_sample(audio_sample);
+   retro_set_audio_sample_batch(audio_sample_batch);
+   retro_set_input_poll(input_poll);
+   retro_set_input_state(input_state);
+   retro_init();
+
+   info.path = titles[index].path;
+   info.data = data;
+   info.size = size;
+   info.meta = NULL;
+
+   if (!retro_load_game(&info))
+      return TITLE_LOAD_FAILED;
+
+   screen_hash = HASH_SEED;
+
+   for (frame = 0; frame < num_frames; frame++)
+   {
+      retro_run();
+
+      hashes[frame] = hash_buffer(screen_hash,
+                                  retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM),
+                                  retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM));
+   }
+
+   retro_unload_game();
+   retro_deinit();
+   free(data);
+
+   return TITLE_DONE;
+}
+
+// Finding titles
+
+static int is_title(const char* filename)
+{
+   char name[256];
+   const char* ext;
+   size_t length = strlen(filename);
+   int i;
+
+   if (length >= sizeof(name))
+      return 0;
+
+   strcpy(name, filename);
+
+   // Compressed titles are identified by the extension underneath
+   ext = strrchr(name, '.');
+
+   if (ext && (!strcasecmp(ext, ".gz") || !strcasecmp(ext, ".bz2")))
+   {
+      name[ext - name] = '\0';
+      ext = strrchr(name, '.');
+   }
+   else if (ext && !strcasecmp(ext, ".zip"))
+   {
+      return 1;
+   }
+
+   if (!ext)
+      return 0;
+
+   for (i = 0; extensions[i]; i++)
+   {
+      if (!strcasecmp(ext, extensions[i]))
+         return 1;
+   }
+
+   return 0;
+}
+
+static void add_title(const char* path, const char* name)
+{
+   if (num_titles == max_titles)
+   {
+      max_titles = max_titles ? max_titles * 2 : 256;
+      titles = (title_t*)realloc(titles, max_titles * sizeof(*titles));
+
+      if (!titles)
+         fatal("out of memory");
+   }
+
+   titles[num_titles].path = safe_strdup(path);
+   titles[num_titles].name = safe_strdup(name);
+   titles[num_titles].save_dir = NULL;
+   titles[num_titles].pid = 0;
+   titles[num_titles].exit_status = 0;
+   num_titles++;
+}
+
+// name_offset is where the path relative to the directory given on the
+// command line starts
+static void scan_directory(const char* path, size_t name_offset)
+{
+   DIR* dir = opendir(path);
+   struct dirent* entry;
+
+   if (!dir)
+      fatal("couldn't open '%s': %s", path, strerror(errno));
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      struct stat info;
+      char* child;
+      size_t length;
+
+      if (entry->d_name[0] == '.')
+         continue;
+
+      length = strlen(path) + strlen(entry->d_name) + 2;
+      child = (char*)malloc(length);
+
+      if (!child)
+         fatal("out of memory");
+
+      snprintf(child, length, "%s/%s", path, entry->d_name);
+
+      if (stat(child, &info) == 0)
+      {
+         if (S_ISDIR(info.st_mode))
+            scan_directory(child, name_offset);
+         else if (S_ISREG(info.st_mode) && is_title(entry->d_name))
+            add_title(child, child + name_offset);
+      }
+
+      free(child);
+   }
+
+   closedir(dir);
+}
+
+static int compare_titles(const void* a, const void* b)
+{
+   return strcmp(((const title_t*)a)->name, ((const title_t*)b)->name);
+}
+
+// The worker pool
+
+static char* make_save_dir(void)
+{
+   const char* tmp = getenv("TMPDIR");
+   size_t length;
+   char* path;
+
+   if (!tmp || !*tmp)
+      tmp = "/tmp";
+
+   length = strlen(tmp) + sizeof("/replay-XXXXXX");
+   path = (char*)malloc(length);
+
+   if (!path)
+      fatal("out of memory");
+
+   snprintf(path, length, "%s/replay-XXXXXX", tmp);
+
+   if (!mkdtemp(path))
+      fatal("couldn't create a directory in '%s': %s", tmp, strerror(errno));
+
+   return path;
+}
+
+// The core only writes files straight into the save directory
+static void remove_save_dir(char* path)
+{
+   DIR* dir = opendir(path);
+   struct dirent* entry;
+
+   if (dir)
+   {
+      while ((entry = readdir(dir)) != NULL)
+      {
+         char* child;
+         size_t length;
+
+         if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+         length = strlen(path) + strlen(entry->d_name) + 2;
+         child = (char*)malloc(length);
+
+         if (!child)
+            fatal("out of memory");
+
+         snprintf(child, length, "%s/%s", path, entry->d_name);
+         unlink(child);
+         free(child);
+      }
+
+      closedir(dir);
+   }
+
+   if (rmdir(path))
+      fprintf(stderr, "%s: couldn't remove '%s': %s\n", progname, path, strerror(errno));
+
+   free(path);
+}
+
+static int run_titles(int jobs)
+{
+   size_t next = 0, running = 0, i;
+   int failed = 0;
+
+   while (next < num_titles || running > 0)
+   {
+      pid_t pid;
+      int status;
+
+      while (next < num_titles && running < (size_t)jobs)
+      {
+         titles[next].save_dir = make_save_dir();
+         pid = fork();
+
+         if (pid < 0)
+            fatal("couldn't fork: %s", strerror(errno));
+
+         if (pid == 0)
+         {
+            // Fuse prints its banner to stdout, which carries the manifest
+            if (!freopen("/dev/null", "w", stdout))
+               _exit(1);
+
+            // SIGALRM's default action kills the worker
+            if (timeout)
+               alarm(timeout);
+
+            save_dir = titles[next].save_dir;
+            title_status[next] = run_title(next);
+            _exit(0);
+         }
+
+         titles[next++].pid = pid;
+         running++;
+      }
+
+      pid = wait(&status);
+
+      if (pid < 0)
+         fatal("wait failed: %s", strerror(errno));
+
+      for (i = 0; i < num_titles; i++)
+      {
+         if (titles[i].pid == pid)
+         {
+            titles[i].exit_status = status;
+            titles[i].pid = 0;
+            remove_save_dir(titles[i].save_dir);
+            titles[i].save_dir = NULL;
+            running--;
+            break;
+         }
+      }
+   }
+
+   for (i = 0; i < num_titles; i++)
+   {
+      const char* name = titles[i].name;
+      int status = titles[i].exit_status;
+
+      if (WIFSIGNALED(status))
+      {
+         if (WTERMSIG(status) == SIGALRM)
+            fprintf(stderr, "TIMEOUT %s\n", name);
+         else
+            fprintf(stderr, "CRASH %s: signal %d\n", name, WTERMSIG(status));
+      }
+      else if (title_status[i] == TITLE_READ_FAILED)
+      {
+         fprintf(stderr, "FAIL %s: couldn't read file\n", name);
+      }
+      else if (title_status[i] == TITLE_LOAD_FAILED)
+      {
+         fprintf(stderr, "FAIL %s: core couldn't load it\n", name);
+      }
+      else if (title_status[i] != TITLE_DONE)
+      {
+         fprintf(stderr, "FAIL %s: worker exited early\n", name);
+      }
+      else
+      {
+         continue;
+      }
+
+      failed++;
+   }
+
+   return failed;
+}
+
+// Manifests
+
+static void print_manifest(void)
+{
+   size_t i;
+   unsigned frame;
+
+   for (i = 0; i < num_titles; i++)
+   {
+      if (title_status[i] != TITLE_DONE)
+         continue;
+
+      for (frame = 0; frame < num_frames; frame++)
+         printf("%016llx %u %s\n", (unsigned long long)title_hashes[i * num_frames + frame], frame, titles[i].name);
+   }
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+   const manifest_entry_t* entry_a = (const manifest_entry_t*)a;
+   const manifest_entry_t* entry_b = (const manifest_entry_t*)b;
+   int result = strcmp(entry_a->name, entry_b->name);
+
+   if (result)
+      return result;
+
+   return entry_a->frame < entry_b->frame ? -1 : entry_a->frame > entry_b->frame;
+}
+
+static manifest_entry_t* read_manifest(const char* filename, size_t* count)
+{
+   manifest_entry_t* entries = NULL;
+   size_t num_entries = 0, max_entries = 0;
+   char line[4096];
+   FILE* file = fopen(filename, "r");
+
+   if (!file)
+      fatal("couldn't open '%s': %s", filename, strerror(errno));
+
+   while (fgets(line, sizeof(line), file))
+   {
+      unsigned long long hash;
+      unsigned frame;
+      int name_start;
+      size_t length = strlen(line);
+
+      while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+         line[--length] = '\0';
+
+      if (sscanf(line, "%llx %u %n", &hash, &frame, &name_start) < 2 || !line[name_start])
+         fatal("'%s': bad line '%s'", filename, line);
+
+      if (num_entries == max_entries)
+      {
+         max_entries = max_entries ? max_entries * 2 : 4096;
+         entries = (manifest_entry_t*)realloc(entries, max_entries * sizeof(*entries));
+
+         if (!entries)
+            fatal("out of memory");
+      }
+
+      // Consecutive lines are normally for the same title
+      if (num_entries > 0 && !strcmp(entries[num_entries - 1].name, line + name_start))
+         entries[num_entries].name = entries[num_entries - 1].name;
+      else
+         entries[num_entries].name = safe_strdup(line + name_start);
+
+      entries[num_entries].frame = frame;
+      entries[num_entries].hash = hash;
+      num_entries++;
+   }
+
+   fclose(file);
+
+   qsort(entries, num_entries, sizeof(*entries), compare_entries);
+
+   *count = num_entries;
+   return entries;
+}
+
+static int check_manifest(const char* filename)
+{
+   manifest_entry_t* entries;
+   size_t num_entries, entry = 0, i;
+   size_t passed = 0, failed = 0, unknown = 0, missing = 0;
+
+   entries = read_manifest(filename, &num_entries);
+
+   // Both lists are sorted by name, so walk them together
+   for (i = 0; i < num_titles; i++)
+   {
+      const char* name = titles[i].name;
+      int mismatch = 0;
+
+      for (; entry < num_entries && strcmp(entries[entry].name, name) < 0; entry++)
+      {
+         if (entry == 0 || strcmp(entries[entry - 1].name, entries[entry].name))
+         {
+            fprintf(stderr, "MISSING %s\n", entries[entry].name);
+            missing++;
+         }
+      }
+
+      if (title_status[i] != TITLE_DONE)
+      {
+         // Already reported by run_titles()
+         for (; entry < num_entries && !strcmp(entries[entry].name, name); entry++)
+            ;
+         continue;
+      }
+
+      if (entry == num_entries || strcmp(entries[entry].name, name))
+      {
+         fprintf(stderr, "NEW %s\n", name);
+         unknown++;
+         continue;
+      }
+
+      for (; entry < num_entries && !strcmp(entries[entry].name, name); entry++)
+      {
+         unsigned frame = entries[entry].frame;
+         uint64_t hash;
+
+         if (mismatch || frame >= num_frames)
+            continue;
+
+         hash = title_hashes[i * num_frames + frame];
+
+         if (hash != entries[entry].hash)
+         {
+            fprintf(stderr, "FAIL %s: frame %u is %016llx, expected %016llx\n", name, frame,
+                    (unsigned long long)hash, (unsigned long long)entries[entry].hash);
+            mismatch = 1;
+         }
+      }
+
+      if (mismatch)
+         failed++;
+      else
+         passed++;
+   }
+
+   for (; entry < num_entries; entry++)
+   {
+      if (entry == 0 || strcmp(entries[entry - 1].name, entries[entry].name))
+      {
+         fprintf(stderr, "MISSING %s\n", entries[entry].name);
+         missing++;
+      }
+   }
+
+   fprintf(stderr, "%s: %lu passed, %lu failed, %lu new, %lu missing\n", progname,
+           (unsigned long)passed, (unsigned long)failed, (unsigned long)unknown, (unsigned long)missing);
+
+   return failed > 0 || missing > 0;
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+           "Usage: %s [-n frames] [-j jobs] [-c manifest] [-o key=value]... [-s dir]\n"
+           "       [-t seconds] [-v] <directory|file>...\n", progname);
+   exit(2);
+}
+
+int main(int argc, char** argv)
+{
+   const char* manifest = NULL;
+   long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+   size_t shared_size;
+   void* shared;
+   int opt, failed;
+
+   progname = argv[0];
+
+   while ((opt = getopt(argc, argv, "n:j:c:o:s:t:v")) != -1)
+   {
+      switch (opt)
+      {
+         case 'n': num_frames = strtoul(optarg, NULL, 10); break;
+         case 'j': jobs = strtol(optarg, NULL, 10); break;
+         case 'c': manifest = optarg; break;
+         case 's': system_dir = optarg; break;
+         case 't': timeout = strtoul(optarg, NULL, 10); break;
+         case 'v': verbose = 1; break;
+
+         case 'o':
+         {
+            char* equals = strchr(optarg, '=');
+
+            if (!equals || num_options == MAX_OPTIONS)
+               usage();
+
+            *equals = '\0';
+            options[num_options][0] = optarg;
+            options[num_options][1] = equals + 1;
+            num_options++;
+            break;
+         }
+
+         default:
+            usage();
+      }
+   }
+
+   if (optind == argc || num_frames == 0)
+      usage();
+
+   if (jobs < 1)
+      jobs = 1;
+
+   for (; optind < argc; optind++)
+   {
+      struct stat info;
+      const char* path = argv[optind];
+
+      if (stat(path, &info))
+         fatal("couldn't stat '%s': %s", path, strerror(errno));
+
+      if (S_ISDIR(info.st_mode))
+         scan_directory(path, strlen(path) + 1);
+      else
+         add_title(path, path);
+   }
+
+   if (num_titles == 0)
+      fatal("no titles found");
+
+   qsort(titles, num_titles, sizeof(*titles), compare_titles);
+
+   shared_size = num_titles * (sizeof(*title_status) + num_frames * sizeof(*title_hashes));
+   shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+   if (shared == MAP_FAILED)
+      fatal("couldn't map %lu bytes: %s", (unsigned long)shared_size, strerror(errno));
+
+   title_hashes = (uint64_t*)shared;
+   title_status = (volatile int*)(title_hashes + num_titles * num_frames);
+
+   failed = run_titles((int)jobs);
+
+   if (manifest)
+      failed += check_manifest(manifest);
+   else
+      print_manifest();
+
+   munmap(shared, shared_size);
+
+   return failed ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+const char* fuse_gitstamp =
+  "+------------------------------------------+\n"
+  "|              FUSE-LIBRETRO               |\n"
+  "|    ____    _   _   ___   _      ____     |\n"
+  "|   | __ )  | | | | |_ _| | |    |  _ \\    |\n"
+  "|   |  _ \\  | | | |  | |  | |    | | | |   |\n"
+  "|   | |_) | | |_| |  | |  | |__  | |_| |   |\n"
+  "|   |____/   \\___/  |___| |____| |____/    |\n"
+  "|                                          |\n"
+  "| df23e95b96d6eb9412b5160bee8cd821242705f4 |\n"
+  "+------------------------------------------+\n";
+
+const char* fuse_githash = "df23e95b96d6eb9412b5160bee8cd821242705f4";